@@ -0,0 +1,271 @@
+/*
+ * Host-side microbenchmark for the serial protocol (lib/Rover6Protocol).
+ * Compares the String-concatenation builder that Rover6Serial used to have
+ * (reproduced here with std::string, which allocates the same way) against
+ * rover6_packet::PacketWriter, and vsnprintf text messages against tokenized
+ * rover6_log arguments. Then pushes enc, bno and m frames through
+ * rover6_codec::Rover6Codec: ASCII and binary formatting, and ASCII parsing
+ * with every field decoded the way the command handlers do it.
+ *
+ * Build and run with scripts/benchmark-packets, or with PlatformIO:
+ *     pio run -e native && .pio/build/native/program
+ */
+
+#include <stdio.h>
+#include <string>
+#include <chrono>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define READ_CYCLES() __rdtsc()
+#else
+#define READ_CYCLES() 0ULL
+#endif
+
+#include "rover6_packet.h"
+#include "rover6_log.h"
+#include "rover6_codec.h"
+
+#define NUM_FRAMES 1000000
+
+// std::string stand-in for the old Arduino String based make_packet
+std::string make_string_packet(uint32_t packet_num, const char* name, const char *formats, va_list args)
+{
+    char num_buffer[32];
+    std::string packet = std::string(1, PACKET_START_0) + std::string(1, PACKET_START_1);
+    packet += std::to_string(packet_num) + "\t";
+    packet += name;
+    while (*formats != '\0') {
+        packet += "\t";
+        if (*formats == 'd') {
+            packet += std::to_string(va_arg(args, int32_t));
+        }
+        else if (*formats == 'u' || *formats == 'l') {
+            packet += std::to_string(va_arg(args, uint32_t));
+        }
+        else if (*formats == 's') {
+            packet += va_arg(args, char*);
+        }
+        else if (*formats == 'f') {
+            snprintf(num_buffer, sizeof(num_buffer), "%.2f", va_arg(args, double));
+            packet += std::string(num_buffer);
+        }
+        ++formats;
+    }
+    uint8_t calc_checksum = 0;
+    for (size_t index = 2; index < packet.length(); index++) {
+        calc_checksum += (uint8_t)packet.at(index);
+    }
+    snprintf(num_buffer, sizeof(num_buffer), "%02x", calc_checksum);
+    packet += std::string(num_buffer);
+    packet += std::string(1, PACKET_STOP);
+    return packet;
+}
+
+size_t string_frame(uint32_t packet_num, const char* name, const char *formats, ...)
+{
+    va_list args;
+    va_start(args, formats);
+    std::string packet = make_string_packet(packet_num, name, formats, args);
+    va_end(args);
+    return packet.length();
+}
+
+char write_packet[0x200];
+rover6_packet::PacketWriter writer(write_packet, sizeof(write_packet));
+
+size_t writer_frame(uint32_t packet_num, const char* name, const char *formats, ...)
+{
+    va_list args;
+    va_start(args, formats);
+    writer.make_packet(packet_num, name, formats, args);
+    va_end(args);
+    return writer.get_length();
+}
+
+// one encoder, IMU and ToF report per iteration, same as a busy cycle_update pass
+template <typename FrameFn>
+void run(const char* label, FrameFn frame)
+{
+    size_t total_bytes = 0;
+    auto start_time = std::chrono::steady_clock::now();
+    unsigned long long start_cycles = READ_CYCLES();
+    for (uint32_t n = 0; n < NUM_FRAMES; n++) {
+        uint32_t t = 1000 + n * 33;
+        total_bytes += frame(n * 3, "enc", "uddff", t, (int32_t)(n * 7), -(int32_t)(n * 5), 1234.5678, -876.54321);
+        total_bytes += frame(n * 3 + 1, "bno", "ufffffffffd", t, 359.9375, -2.5, 12.125, 0.0012, -0.0345, 1.5, 0.02, -9.81, 0.15, 31);
+        total_bytes += frame(n * 3 + 2, "lox", "udddddd", t, 812, 8190, 0, 4, 0, 0);
+    }
+    unsigned long long cycles = READ_CYCLES() - start_cycles;
+    double elapsed_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start_time).count();
+    double num_frames = 3.0 * NUM_FRAMES;
+    printf("%-14s %8.1f ns/frame  %8.1f cycles/frame  %5.1f bytes/frame\n",
+        label, elapsed_ns / num_frames, cycles / num_frames, total_bytes / num_frames);
+}
+
+// the serial layer copies the encoded arguments into a packet. Stand in for it with a checksum
+uint32_t log_sink = 0;
+void rover6_serial::write_log(rover6_log::LOG_LEVELS level, uint32_t id, const uint8_t* args, size_t length)
+{
+    log_sink += level + id + length + args[0];
+}
+
+char message_buffer[0xff];
+
+void text_message(const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message_buffer, sizeof(message_buffer), format, args);
+    va_end(args);
+    log_sink += message_buffer[0];
+}
+
+// the ToF error message that's sent on every failed sample
+template <typename MessageFn>
+void run_messages(const char* label, MessageFn message)
+{
+    auto start_time = std::chrono::steady_clock::now();
+    unsigned long long start_cycles = READ_CYCLES();
+    for (uint32_t n = 0; n < NUM_FRAMES; n++) {
+        message((int)(n & 0xff) - 128, "VL53L0X_ERROR_RANGE_ERROR", 12.5f + n);
+    }
+    unsigned long long cycles = READ_CYCLES() - start_cycles;
+    double elapsed_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start_time).count();
+    printf("%-14s %8.1f ns/message  %8.1f cycles/message\n", label, elapsed_ns / NUM_FRAMES, (double)cycles / NUM_FRAMES);
+}
+
+// Collects the codec's output instead of queueing it for a serial device
+class BenchmarkCodec : public rover6_codec::Rover6Codec {
+public:
+    BenchmarkCodec(void (*read_callback)(uint32_t)) : Rover6Codec(read_callback) {
+        output_len = 0;
+        total_bytes = 0;
+    }
+    void clear_output() {
+        output_len = 0;
+    }
+    const uint8_t* get_output() {
+        return output;
+    }
+    size_t get_output_len() {
+        return output_len;
+    }
+    size_t get_total_bytes() {
+        return total_bytes;
+    }
+
+protected:
+    uint8_t output[0x100000];
+    size_t output_len;
+    size_t total_bytes;
+
+    void enqueue(const uint8_t* data, size_t length, TX_PRIORITIES /* priority */)
+    {
+        total_bytes += length;
+        if (output_len + length > sizeof(output)) {
+            output_len = 0;  // only the parse benchmark reads this back, and it clears it first
+        }
+        memcpy(output + output_len, data, length);
+        output_len += length;
+    }
+};
+
+#define CODEC_CHUNK_FRAMES 1000  // frames per format/parse round. Keeps the stream in cache
+
+// the telemetry the rover sends most often, and the motor command the host sends most often
+void write_frames(BenchmarkCodec* codec, uint32_t n)
+{
+    uint32_t t = 1000 + n * 33;
+    codec->write("enc", "uuddf1f1", t, 33u, (int32_t)(n * 7), -(int32_t)(n * 5), 1234.5678, -876.54321);
+    codec->write("bno", "uf4f4f4f4f4f4f2f2f2d", t, 0.7071, 0.0012, -0.0345, 0.7071, 0.02, -0.15, -0.02, 0.15, 9.81, 31);
+    codec->write("m", "f2f2", 250.0 + (n & 0x3f), -250.0 - (n & 0x3f));
+}
+
+BenchmarkCodec* parse_codec;
+float field_sink = 0.0f;
+
+// decodes every field the way set_motors_command and friends do
+void parse_callback(uint32_t category_id)
+{
+    switch (category_id) {
+        case rover6_packet::category_id("enc"):
+        case rover6_packet::category_id("bno"):
+        case rover6_packet::category_id("m"):
+            while (parse_codec->next_segment()) {
+                field_sink += parse_codec->get_segment_float();
+            }
+            break;
+        default:
+            field_sink -= 1.0f;
+            break;
+    }
+}
+
+void no_callback(uint32_t /* category_id */) {}
+
+void run_codec_format(const char* label, bool binary_mode)
+{
+    BenchmarkCodec* codec = new BenchmarkCodec(no_callback);
+    codec->set_binary_mode(binary_mode);
+    auto start_time = std::chrono::steady_clock::now();
+    unsigned long long start_cycles = READ_CYCLES();
+    for (uint32_t n = 0; n < NUM_FRAMES; n++) {
+        write_frames(codec, n);
+    }
+    unsigned long long cycles = READ_CYCLES() - start_cycles;
+    double elapsed_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start_time).count();
+    double num_frames = 3.0 * NUM_FRAMES;
+    printf("%-14s %8.1f ns/frame  %8.1f cycles/frame  %5.1f bytes/frame\n",
+        label, elapsed_ns / num_frames, cycles / num_frames, codec->get_total_bytes() / num_frames);
+    delete codec;
+}
+
+// Only the parsing is timed. The stream is formatted in chunks by a second codec so the
+// packet numbers stay in sequence, like they do on the wire
+void run_codec_parse(const char* label)
+{
+    BenchmarkCodec* formatter = new BenchmarkCodec(no_callback);
+    parse_codec = new BenchmarkCodec(parse_callback);
+    double elapsed_ns = 0.0;
+    unsigned long long cycles = 0;
+    size_t total_bytes = 0;
+    for (uint32_t chunk_start = 0; chunk_start < NUM_FRAMES; chunk_start += CODEC_CHUNK_FRAMES) {
+        formatter->clear_output();
+        for (uint32_t n = chunk_start; n < chunk_start + CODEC_CHUNK_FRAMES && n < NUM_FRAMES; n++) {
+            write_frames(formatter, n);
+        }
+        const char* stream = (const char*)formatter->get_output();
+        size_t stream_len = formatter->get_output_len();
+        total_bytes += stream_len;
+
+        auto start_time = std::chrono::steady_clock::now();
+        unsigned long long start_cycles = READ_CYCLES();
+        for (size_t index = 0; index < stream_len; index++) {
+            parse_codec->read_char(stream[index]);
+        }
+        cycles += READ_CYCLES() - start_cycles;
+        elapsed_ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start_time).count();
+    }
+    double num_frames = 3.0 * NUM_FRAMES;
+    printf("%-14s %8.1f ns/frame  %8.1f cycles/frame  %5.1f bytes/frame  %u errors\n",
+        label, elapsed_ns / num_frames, cycles / num_frames, total_bytes / num_frames, parse_codec->get_rx_error_count());
+    delete formatter;
+    delete parse_codec;
+}
+
+int main()
+{
+    run("String concat", string_frame);
+    run("PacketWriter", writer_frame);
+    run_messages("vsnprintf", [](int status, const char* s, float f) {
+        text_message("lox1 Error: %d, %s, %0.2f", status, s, f);
+    });
+    run_messages("LOG_ERROR", [](int status, const char* s, float f) {
+        LOG_ERROR("lox1 Error: %d, %s, %0.2f", status, s, f);
+    });
+    run_codec_format("codec ASCII", false);
+    run_codec_format("codec binary", true);
+    run_codec_parse("codec parse");
+    return log_sink == 0 || field_sink == 0.0f;
+}
@@ -84,14 +84,15 @@ bool Adafruit_BNO055::begin(adafruit_bno055_opmode_t mode) {
   _wire->setClockStretchLimit(1000); // Allow for 1000us of clock stretching
 #endif
 
-  /* Make sure we have the right device */
+  /* Make sure we have the right device. Poll while it boots (650 ms after
+     power on or a reset) */
   uint8_t id = read8(BNO055_CHIP_ID_ADDR);
-  if (id != BNO055_ID) {
-    delay(1000); // hold on for boot
+  for (int wait_ms = 0; id != BNO055_ID && wait_ms < 1000; wait_ms += 10) {
+    delay(10); // hold on for boot
     id = read8(BNO055_CHIP_ID_ADDR);
-    if (id != BNO055_ID) {
-      return false; // still not? ok bail
-    }
+  }
+  if (id != BNO055_ID) {
+    return false; // still not? ok bail
   }
 
   /* Switch to config mode (just in case since this is the default) */
@@ -237,6 +238,51 @@ void Adafruit_BNO055::setExtCrystalUse(boolean usextal) {
   delay(20);
 }
 
+/*!
+ *  @brief  Drives the INT pin high when new fusion output is ready (100 Hz
+ *          in NDOF mode). The pin stays high until BNO055_SYS_TRIGGER_RST_INT
+ *          is written to BNO055_SYS_TRIGGER_ADDR. Other interrupts are turned off
+ *  @param  enable
+ *          true to enable the data ready interrupt
+ */
+void Adafruit_BNO055::enableDataReadyInterrupt(boolean enable) {
+  adafruit_bno055_opmode_t modeback = _mode;
+  uint8_t bits = enable ? BNO055_INT_ACC_BSX_DRDY : 0x00;
+
+  /* Interrupt settings can only be changed in config mode */
+  setMode(OPERATION_MODE_CONFIG);
+  delay(25);
+  write8(BNO055_PAGE_ID_ADDR, 1);
+  write8((adafruit_bno055_reg_t)BNO055_INT_MSK_ADDR, bits);
+  write8((adafruit_bno055_reg_t)BNO055_INT_EN_ADDR, bits);
+  write8(BNO055_PAGE_ID_ADDR, 0);
+  setMode(modeback);
+  delay(20);
+}
+
+/*!
+ *  @brief  Sets the accelerometer and gyroscope range, bandwidth and power
+ *          mode (section 3.5). The fusion modes overwrite these, so set a
+ *          non-fusion mode like OPERATION_MODE_AMG first
+ *  @param  acc_config
+ *          ACC_Config register value
+ *  @param  gyr_config_0
+ *          GYR_Config_0 register value
+ */
+void Adafruit_BNO055::setRawSensorConfig(uint8_t acc_config,
+                                         uint8_t gyr_config_0) {
+  adafruit_bno055_opmode_t modeback = _mode;
+
+  setMode(OPERATION_MODE_CONFIG);
+  delay(25);
+  write8(BNO055_PAGE_ID_ADDR, 1);
+  write8((adafruit_bno055_reg_t)BNO055_ACC_CONFIG_ADDR, acc_config);
+  write8((adafruit_bno055_reg_t)BNO055_GYR_CONFIG_0_ADDR, gyr_config_0);
+  write8(BNO055_PAGE_ID_ADDR, 0);
+  setMode(modeback);
+  delay(20);
+}
+
 /*!
  *   @brief  Gets the latest system status info
  *   @param  system_status
@@ -468,6 +514,74 @@ imu::Quaternion Adafruit_BNO055::getQuat() {
   return quat;
 }
 
+/*!
+ *  @brief  Reads gyro, euler, quaternion, linear accel, gravity and
+ *          temperature in one transaction. They are contiguous registers
+ *  @param  data
+ *          decoded readings
+ *  @return true if read is successful
+ */
+bool Adafruit_BNO055::getFusionData(adafruit_bno055_fusion_t *data) {
+  uint8_t buffer[NUM_BNO055_FUSION_REGISTERS];
+  memset(buffer, 0, NUM_BNO055_FUSION_REGISTERS);
+
+  if (!readLen(BNO055_GYRO_DATA_X_LSB_ADDR, buffer,
+               NUM_BNO055_FUSION_REGISTERS)) {
+    return false;
+  }
+  decodeFusionData(buffer, data);
+  return true;
+}
+
+/*!
+ *  @brief  Decodes the registers from BNO055_GYRO_DATA_X_LSB_ADDR to
+ *          BNO055_TEMP_ADDR, for callers that read them themselves
+ *  @param  buffer
+ *          NUM_BNO055_FUSION_REGISTERS bytes
+ *  @param  data
+ *          decoded readings, in the same units as getVector and getQuat
+ */
+void Adafruit_BNO055::decodeFusionData(const uint8_t *buffer,
+                                       adafruit_bno055_fusion_t *data) {
+  int16_t raw[16];
+  for (uint8_t i = 0; i < 16; i++) {
+    raw[i] = (int16_t)(((uint16_t)buffer[2 * i + 1] << 8) | buffer[2 * i]);
+  }
+
+  /* 1dps = 16 LSB, 1 degree = 16 LSB, 1m/s^2 = 100 LSB (section 3.6.4) */
+  const float quat_scale = (1.0f / (1 << 14));
+  for (uint8_t i = 0; i < 3; i++) {
+    data->gyro[i] = raw[i] / 16.0f;
+    data->euler[i] = raw[3 + i] / 16.0f;
+    data->linear_accel[i] = raw[10 + i] / 100.0f;
+    data->gravity[i] = raw[13 + i] / 100.0f;
+  }
+  for (uint8_t i = 0; i < 4; i++) {
+    data->quat[i] = raw[6 + i] * quat_scale;
+  }
+  data->temperature = (int8_t)buffer[NUM_BNO055_FUSION_REGISTERS - 1];
+}
+
+/*!
+ *  @brief  Decodes the registers from BNO055_ACCEL_DATA_X_LSB_ADDR to
+ *          BNO055_GYRO_DATA_Z_MSB_ADDR without scaling them
+ *  @param  buffer
+ *          NUM_BNO055_RAW_REGISTERS bytes
+ *  @param  data
+ *          register values
+ */
+void Adafruit_BNO055::decodeRawData(const uint8_t *buffer,
+                                    adafruit_bno055_raw_t *data) {
+  for (uint8_t i = 0; i < 3; i++) {
+    data->accel[i] =
+        (int16_t)(((uint16_t)buffer[2 * i + 1] << 8) | buffer[2 * i]);
+    data->mag[i] =
+        (int16_t)(((uint16_t)buffer[2 * i + 7] << 8) | buffer[2 * i + 6]);
+    data->gyro[i] =
+        (int16_t)(((uint16_t)buffer[2 * i + 13] << 8) | buffer[2 * i + 12]);
+  }
+}
+
 /*!
  *  @brief  Provides the sensor_t data for this sensor
  *  @param  sensor
@@ -39,6 +39,25 @@
 /** Offsets registers **/
 #define NUM_BNO055_OFFSET_REGISTERS (22)
 
+/** Gyro, euler, quaternion, linear accel, gravity and temperature registers (0x14 - 0x34) **/
+#define NUM_BNO055_FUSION_REGISTERS (33)
+
+/** Accel, mag and gyro data registers (0x08 - 0x19) **/
+#define NUM_BNO055_RAW_REGISTERS (18)
+
+/** Page 1 sensor config registers. Writable in the non-fusion modes only **/
+#define BNO055_ACC_CONFIG_ADDR (0x08)
+#define BNO055_GYR_CONFIG_0_ADDR (0x0A)
+
+/** Page 1 interrupt mask and enable registers **/
+#define BNO055_INT_MSK_ADDR (0x0F)
+#define BNO055_INT_EN_ADDR (0x10)
+/** Interrupt bit set when new fusion (BSX) output is ready **/
+#define BNO055_INT_ACC_BSX_DRDY (0x01)
+/** SYS_TRIGGER bits **/
+#define BNO055_SYS_TRIGGER_RST_INT (0x40)
+#define BNO055_SYS_TRIGGER_CLK_SEL (0x80)
+
 /** A structure to represent offsets **/
 typedef struct {
   int16_t accel_offset_x; /**< x acceleration offset */
@@ -271,6 +290,23 @@ public:
     uint8_t bl_rev;    /**< bootloader rev */
   } adafruit_bno055_rev_info_t;
 
+  /** A structure to represent one read of the fusion outputs **/
+  typedef struct {
+    float gyro[3];         /**< x, y, z in dps */
+    float euler[3];        /**< heading, roll, pitch in degrees */
+    float quat[4];         /**< w, x, y, z */
+    float linear_accel[3]; /**< x, y, z in m/s^2 */
+    float gravity[3];      /**< x, y, z in m/s^2 */
+    int8_t temperature;    /**< degrees celsius */
+  } adafruit_bno055_fusion_t;
+
+  /** A structure to represent one read of the raw sensors, in register LSBs **/
+  typedef struct {
+    int16_t accel[3]; /**< x, y, z in 0.01 m/s^2 */
+    int16_t mag[3];   /**< x, y, z in 1/16 uT */
+    int16_t gyro[3];  /**< x, y, z in 1/16 dps */
+  } adafruit_bno055_raw_t;
+
   /** Vector Mappings **/
   typedef enum {
     VECTOR_ACCELEROMETER = BNO055_ACCEL_DATA_X_LSB_ADDR,
@@ -290,6 +326,8 @@ public:
   void setAxisSign(adafruit_bno055_axis_remap_sign_t remapsign);
   void getRevInfo(adafruit_bno055_rev_info_t *);
   void setExtCrystalUse(boolean usextal);
+  void enableDataReadyInterrupt(boolean enable);
+  void setRawSensorConfig(uint8_t acc_config, uint8_t gyr_config_0);
   void getSystemStatus(uint8_t *system_status, uint8_t *self_test_result,
                        uint8_t *system_error);
   void getCalibration(uint8_t *system, uint8_t *gyro, uint8_t *accel,
@@ -298,6 +336,10 @@ public:
   imu::Vector<3> getVector(adafruit_vector_type_t vector_type);
   imu::Quaternion getQuat();
   int8_t getTemp();
+  bool getFusionData(adafruit_bno055_fusion_t *data);
+  static void decodeFusionData(const uint8_t *buffer,
+                               adafruit_bno055_fusion_t *data);
+  static void decodeRawData(const uint8_t *buffer, adafruit_bno055_raw_t *data);
 
   /* Adafruit_Sensor implementation */
   bool getEvent(sensors_event_t *);
@@ -0,0 +1,184 @@
+#ifndef ROVER6_BAUD
+#define ROVER6_BAUD
+
+#include <Arduino.h>
+#include "rover6_general.h"
+#include "rover6_serial.h"
+
+/*
+ * Data UART baud rate negotiation
+ * 1. host: baud <rate> 0. Device replies baud <rate> 1 (or 0 if unsupported) and switches
+ *    once the reply has gone out. Packets queued after the reply wait for the new rate.
+ * 2. host: prb <n> at the new rate. Device replies with n checksummed probe packets.
+ * 3. host: baud <rate> 1 if every probe arrived intact. Device replies baud <rate> 2.
+ * The device falls back to its previous rate if step 3 doesn't happen in time, and to
+ * DATA_BAUD_DEFAULT if the receive error rate climbs or the host goes silent.
+ */
+
+#define BAUD_TRIAL_TIMEOUT_MS 1500
+#define BAUD_ERROR_WINDOW_MS 1000
+#define BAUD_MIN_ERRORS 3  // errors per window before the error rate is considered
+#define BAUD_MAX_ERROR_PERCENT 10
+#define BAUD_SILENCE_TIMEOUT_MS 3000  // the host sends prb 0 as a heartbeat when above the default rate
+#define BAUD_PROBE_MAX_PACKETS 32
+
+namespace rover6_baud
+{
+    const uint32_t BAUD_RATES[] = {2000000, 1000000, 500000, 460800, 230400, 115200};
+    #define NUM_BAUD_RATES (sizeof(BAUD_RATES) / sizeof(BAUD_RATES[0]))
+
+    enum BAUD_STATES {
+        BAUD_CONFIRMED,
+        BAUD_SWITCH_PENDING,  // to a requested rate, then BAUD_TRIAL
+        BAUD_FALLBACK_PENDING,  // then BAUD_CONFIRMED
+        BAUD_TRIAL
+    };
+
+    BAUD_STATES baud_state = BAUD_CONFIRMED;
+    uint32_t current_baud = DATA_BAUD_DEFAULT;
+    uint32_t prev_baud = DATA_BAUD_DEFAULT;
+    uint32_t pending_baud = DATA_BAUD_DEFAULT;
+    uint32_t trial_timer = 0;
+    const char* fall_back_reason = "";
+
+    uint32_t error_window_timer = 0;
+    uint32_t window_start_packets = 0;
+    uint32_t window_start_errors = 0;
+    uint32_t last_rx_packets = 0;
+    uint32_t last_rx_time = 0;
+
+    uint32_t get_max_baud() {
+        return BAUD_RATES[0];
+    }
+
+    bool is_supported(uint32_t baud)
+    {
+        for (size_t index = 0; index < NUM_BAUD_RATES; index++) {
+            if (BAUD_RATES[index] == baud) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // The switch happens in update() once everything queued so far has gone out at the current rate
+    void start_switch(uint32_t baud, BAUD_STATES state)
+    {
+        rover6_serial::data->send_ack();  // for the packets that arrived at the current rate
+        rover6_serial::data->hold_tx();
+        pending_baud = baud;
+        baud_state = state;
+    }
+
+    void switch_baud(uint32_t baud)
+    {
+        rover6_serial::data->set_baud(baud);
+        current_baud = baud;
+        last_rx_time = CURRENT_TIME;
+    }
+
+    void fall_back(uint32_t baud, const char* reason)
+    {
+        baud_state = BAUD_CONFIRMED;
+        if (baud == current_baud) {
+            return;
+        }
+        fall_back_reason = reason;
+        start_switch(baud, BAUD_FALLBACK_PENDING);
+    }
+
+    void request_baud(uint32_t baud)
+    {
+        if (!is_supported(baud)) {
+            rover6_serial::data->write_high_priority("baud", "ud", baud, 0);
+            return;
+        }
+        rover6_serial::data->write_high_priority("baud", "ud", baud, 1);
+        prev_baud = current_baud;
+        start_switch(baud, BAUD_SWITCH_PENDING);
+    }
+
+    void confirm_baud(uint32_t baud)
+    {
+        if (baud != current_baud) {
+            rover6_serial::data->write_high_priority("baud", "ud", current_baud, 0);
+            return;
+        }
+        baud_state = BAUD_CONFIRMED;
+        rover6_serial::data->write_high_priority("baud", "ud", current_baud, 2);
+    }
+
+    void send_probe(uint32_t num_packets)
+    {
+        if (num_packets > BAUD_PROBE_MAX_PACKETS) {
+            num_packets = BAUD_PROBE_MAX_PACKETS;
+        }
+        // the host checks the pattern as well as the checksum
+        for (uint32_t index = 0; index < num_packets; index++) {
+            uint32_t pattern = index * 2654435761UL;
+            rover6_serial::data->write_high_priority("prb", "uuuuu", index, num_packets, pattern, ~pattern, current_baud);
+        }
+    }
+
+    void check_error_rate()
+    {
+        if (CURRENT_TIME - error_window_timer < BAUD_ERROR_WINDOW_MS) {
+            return;
+        }
+        error_window_timer = CURRENT_TIME;
+
+        uint32_t packets = rover6_serial::data->get_rx_packet_count() - window_start_packets;
+        uint32_t errors = rover6_serial::data->get_rx_error_count() - window_start_errors;
+        window_start_packets = rover6_serial::data->get_rx_packet_count();
+        window_start_errors = rover6_serial::data->get_rx_error_count();
+
+        if (current_baud == DATA_BAUD_DEFAULT) {
+            return;
+        }
+        if (errors >= BAUD_MIN_ERRORS && errors * 100 > packets * BAUD_MAX_ERROR_PERCENT) {
+            fall_back(DATA_BAUD_DEFAULT, "receive error rate too high");
+        }
+    }
+
+    void update()
+    {
+        uint32_t rx_packets = rover6_serial::data->get_rx_packet_count() - rover6_serial::data->get_rx_error_count();
+        if (rx_packets != last_rx_packets) {
+            last_rx_packets = rx_packets;
+            last_rx_time = CURRENT_TIME;
+        }
+
+        switch (baud_state) {
+            case BAUD_SWITCH_PENDING:
+            case BAUD_FALLBACK_PENDING:
+                if (!rover6_serial::data->is_tx_drained()) {
+                    break;  // data->update() is still sending at the current rate
+                }
+                switch_baud(pending_baud);
+                if (baud_state == BAUD_SWITCH_PENDING) {
+                    trial_timer = CURRENT_TIME;
+                    baud_state = BAUD_TRIAL;
+                }
+                else {
+                    baud_state = BAUD_CONFIRMED;
+                    LOG_ERROR("Data baud fell back to %lu: %s", (unsigned long)pending_baud, fall_back_reason);
+                }
+                break;
+            case BAUD_TRIAL:
+                if (CURRENT_TIME - trial_timer > BAUD_TRIAL_TIMEOUT_MS) {
+                    fall_back(prev_baud, "host didn't confirm the new rate");
+                }
+                break;
+            case BAUD_CONFIRMED:
+                if (current_baud != DATA_BAUD_DEFAULT && CURRENT_TIME - last_rx_time > BAUD_SILENCE_TIMEOUT_MS) {
+                    fall_back(DATA_BAUD_DEFAULT, "no packets from host");
+                }
+                else {
+                    check_error_rate();
+                }
+                break;
+        }
+    }
+};  // namespace rover6_baud
+
+#endif  // ROVER6_BAUD
@@ -2,20 +2,50 @@
 #define ROVER6_BNO
 
 #include <Arduino.h>
+#include <EEPROM.h>
 #include <Adafruit_BNO055_Teensy.h>
 
 #include "rover6_i2c.h"
 #include "rover6_serial.h"
 #include "rover6_general.h"
+#include "rover6_streams.h"
 
 /*
  * Adafruit 9-DOF Absolute Orientation IMU
  * BNO055
+ * The library sets the sensor up. Each sample is one queued I2C read (see rover6_i2c.h) of all
+ * the fusion output registers, which are contiguous, decoded by Adafruit_BNO055::decodeFusionData.
+ *
+ * Samples are either started on a timer, or in interrupt mode, by the BNO055's data ready
+ * interrupt on BNO055_INT_PIN. That reads each new fusion output once (100 Hz) and stamps it with
+ * the time of the interrupt, instead of the time the main loop got to it. The INT pin latches, so
+ * each sample queues a write that clears it ahead of the read. While it's latched there are no
+ * more interrupts, so a read that starts more than a fusion period after the interrupt gets a
+ * newer output than the one that was stamped, and the ones in between are lost. Those samples are
+ * stamped with an estimate (the interrupt time plus the whole periods since) and the lost outputs
+ * are counted and logged at most every BNO_LATE_LOG_DELAY_MS. If the interrupt never comes (the
+ * pin isn't wired), the driver falls back to the timer.
+ *
+ * Raw mode puts the BNO055 in AMG mode (no fusion) and samples the accel and gyro registers at up
+ * to BNO_RAW_MAX_RATE_HZ into a ring buffer. Samples are stamped with the time their read started
+ * on the bus. Every BNO_RAW_BATCH_LEN samples go out in one bnor packet:
+ *     time of the first sample (ms) | then per sample: us since the previous sample | gyro x, y, z (1/16 dps) | accel x, y, z (0.01 m/s^2)
+ * The fusion reports stop while it's on.
+ *
+ * Calibration: the BNO055 forgets its calibration on every reset and takes minutes of motion to
+ * get it back. The first time it's fully calibrated with nothing in EEPROM, its offsets are saved
+ * there and every start after that loads them (like the library's restore_offsets example), so
+ * heading is usable about a second after power on. Restored offsets count as saved, so a normal
+ * boot doesn't rewrite EEPROM. bcal 1 saves newer offsets on request. The calibration status register is a queued read every
+ * BNO_CALIBRATION_DELAY_MS. Changes go out in a bcal packet:
+ *     time (ms) | system, gyro, accel, mag calibration (0-3) | offsets: 0 none, 1 restored from EEPROM, 2 saved to EEPROM
  */
 
 #define BNO055_COPYSTRING(str, ...) strcpy(str, ##__VA_ARGS__)
 
 #define BNO055_RST_PIN 25
+#define BNO055_INT_PIN 39
+#define BNO055_RESET_PULSE_MS 10  // begin() waits for it to boot
 const uint16_t BNO055_SAMPLERATE_DELAY_MS = 100;
 #define BNO055_DATA_BUF_LEN 9
 
@@ -38,7 +68,128 @@ namespace rover6_bno
 
 
     uint32_t bno_report_timer = 0;
-    #define BNO_SAMPLERATE_DELAY_MS 100
+    uint32_t bno_sample_time = 0;  // reports use this instead of the current time
+    #define BNO_SAMPLERATE_DELAY_MS 10
+
+    #define BNO_INTERRUPT_TIMEOUT_MS 100  // fusion output is every 10 ms
+    #define BNO_FUSION_PERIOD_US 10000
+    #define BNO_LATE_LOG_DELAY_MS 1000
+    bool is_interrupt_mode_enabled = false;
+    volatile bool bno_data_ready = false;
+    volatile uint32_t bno_data_ready_time_us = 0;
+    uint32_t bno_read_ready_time_us = 0;  // the interrupt the pending read is for
+    bool is_read_interrupt_stamped = false;
+    uint32_t bno_late_samples = 0;  // since the last log
+    uint32_t bno_skipped_frames = 0;
+    uint32_t bno_late_log_timer = 0;
+    uint32_t bno_interrupt_timer = 0;
+    rover6_i2c::transaction bno_interrupt_reset;
+    uint8_t bno_interrupt_reset_data[1] = {BNO055_SYS_TRIGGER_RST_INT | BNO055_SYS_TRIGGER_CLK_SEL};  // keeps the external crystal
+
+    #define BNO_RAW_MAX_RATE_HZ 400
+    #define BNO_RAW_BUFFER_LEN 64
+    #define BNO_RAW_BATCH_LEN 4
+    #define BNO_RAW_ACC_CONFIG 0x15  // 4 G, 250 Hz bandwidth (500 Hz output), normal power
+    #define BNO_RAW_GYR_CONFIG 0x10  // 2000 dps, 116 Hz bandwidth (1 kHz output)
+    #define BNO_RAW_SAMPLE_FORMAT "vvvvvvv"
+    #define BNO_RAW_SAMPLE_ARGS(__SAMPLE__, __PREV_TIME_US__)  (int32_t)((__SAMPLE__)->time_us - (__PREV_TIME_US__)), \
+        (__SAMPLE__)->gyro[0], (__SAMPLE__)->gyro[1], (__SAMPLE__)->gyro[2], \
+        (__SAMPLE__)->accel[0], (__SAMPLE__)->accel[1], (__SAMPLE__)->accel[2]
+    static_assert(BNO_RAW_BATCH_LEN == 4, "report_BNO055_raw sends 4 samples per packet");
+
+    struct raw_sample {
+        uint32_t time_us;
+        int16_t gyro[3];
+        int16_t accel[3];
+    };
+
+    uint16_t raw_rate_hz = 0;  // 0 is off
+    uint32_t raw_period_us = 0;
+    uint32_t raw_timer_us = 0;
+    rover6_i2c::transaction bno_raw_read;
+    uint8_t bno_raw_read_data[NUM_BNO055_RAW_REGISTERS];
+    Adafruit_BNO055::adafruit_bno055_raw_t bno_raw;
+    // oldest first. Only the main loop touches these
+    raw_sample raw_samples[BNO_RAW_BUFFER_LEN];
+    size_t raw_head = 0;
+    size_t raw_count = 0;
+
+    // compressed reports are fixed point deltas against the last keyframe
+    #define BNO_KEYFRAME_DELAY_MS 1000
+    #define BNO_NUM_VECTOR_VALUES 9
+    // the BNO055's own LSBs: 1/16 deg euler angles, 1/16 dps gyro rates, 0.01 m/s^2 linear acceleration
+    const int32_t BNO_COMPRESSED_SCALES[BNO_NUM_VECTOR_VALUES] = {16, 16, 16, 16, 16, 16, 100, 100, 100};
+    bool is_compression_enabled = false;
+    uint8_t bno_keyframe_id = 0;
+    bool bno_needs_keyframe = true;
+    uint32_t bno_key_time = 0;
+
+    // quaternion mode sends the BNO055's fused orientation (w, x, y, z, LSB 2^-14) in place of the
+    // euler angles, so the host doesn't convert them. The packets are bnoq, bnqk, bnqd, and stateq
+    #define BNO_NUM_QUAT_VECTOR_VALUES 10
+    const int32_t BNO_QUAT_COMPRESSED_SCALES[BNO_NUM_QUAT_VECTOR_VALUES] = {16384, 16384, 16384, 16384, 16, 16, 16, 100, 100, 100};
+    bool is_quaternion_enabled = false;
+
+    #define BNO_CALIBRATION_DELAY_MS 1000
+    #define BNO_CALIBRATION_EEPROM_ADDR 0
+    #define BNO_CALIBRATION_MAGIC 0x42433031  // change it if stored_calibration changes
+
+    enum CALIBRATION_OFFSETS {
+        CALIBRATION_OFFSETS_NONE,
+        CALIBRATION_OFFSETS_RESTORED,
+        CALIBRATION_OFFSETS_SAVED
+    };
+
+    struct stored_calibration {
+        uint32_t magic;
+        adafruit_bno055_offsets_t offsets;
+    };
+
+    rover6_i2c::transaction bno_calibration_read;
+    uint8_t bno_calibration_read_data[1];
+    uint8_t bno_calibration_status = 0;  // BNO055_CALIB_STAT_ADDR: system, gyro, accel, mag. 2 bits each
+    bool bno_calibration_changed = false;
+    uint32_t bno_calibration_timer = 0;
+    CALIBRATION_OFFSETS bno_calibration_offsets = CALIBRATION_OFFSETS_NONE;
+
+    int32_t bno_key_values[BNO_NUM_QUAT_VECTOR_VALUES];
+    int32_t bno_values[BNO_NUM_QUAT_VECTOR_VALUES];
+
+    rover6_i2c::transaction bno_read;
+    uint8_t bno_read_data[NUM_BNO055_FUSION_REGISTERS];
+    Adafruit_BNO055::adafruit_bno055_fusion_t bno_fusion;
+    bool bno_has_sample = false;
+
+    void bno_read_done(rover6_i2c::transaction* t, bool ok)
+    {
+        if (!ok) {
+            LOG_ERROR("BNO055 read failed: %d", t->error);
+            return;
+        }
+        if (is_read_interrupt_stamped) {
+            uint32_t frame_time_us = bno_read_ready_time_us;
+            uint32_t late_us = t->start_time_us - frame_time_us;
+            if (late_us > BNO_FUSION_PERIOD_US) {  // the output that was stamped got overwritten
+                uint32_t skipped = late_us / BNO_FUSION_PERIOD_US;
+                frame_time_us += skipped * BNO_FUSION_PERIOD_US;
+                bno_skipped_frames += skipped;
+                bno_late_samples++;
+            }
+            bno_sample_time = CURRENT_TIME - (micros() - frame_time_us) / 1000;
+        }
+        Adafruit_BNO055::decodeFusionData(bno_read_data, &bno_fusion);
+        orientationData.orientation.x = bno_fusion.euler[0];
+        orientationData.orientation.y = bno_fusion.euler[1];
+        orientationData.orientation.z = bno_fusion.euler[2];
+        angVelocityData.gyro.x = bno_fusion.gyro[0];
+        angVelocityData.gyro.y = bno_fusion.gyro[1];
+        angVelocityData.gyro.z = bno_fusion.gyro[2];
+        linearAccelData.acceleration.x = bno_fusion.linear_accel[0];
+        linearAccelData.acceleration.y = bno_fusion.linear_accel[1];
+        linearAccelData.acceleration.z = bno_fusion.linear_accel[2];
+        bno_temperature = bno_fusion.temperature;
+        bno_has_sample = true;
+    }
 
     void get_system_status_string(uint8_t system_status, char* status)
     {
@@ -56,7 +207,7 @@ namespace rover6_bno
     void bno_print_system_status()
     {
         get_system_status_string(bno_system_status, bno_status_string);
-        rover6_serial::println_info("BNO055 system status - %d, %s", bno_system_status, bno_status_string);
+        LOG_INFO("BNO055 system status - %d, %s", bno_system_status, bno_status_string);
     }
 
 
@@ -68,7 +219,7 @@ namespace rover6_bno
         else {
             BNO055_COPYSTRING(bno_status_string, "fail");
         }
-        rover6_serial::println_info("BNO055 accel self test - %s", bno_status_string);
+        LOG_INFO("BNO055 accel self test - %s", bno_status_string);
 
         if (((bno_self_test_result >> 1) & 1) == 1) {
             BNO055_COPYSTRING(bno_status_string, "pass");
@@ -76,7 +227,7 @@ namespace rover6_bno
         else {
             BNO055_COPYSTRING(bno_status_string, "fail");
         }
-        rover6_serial::println_info("BNO055 mag self test - %s", bno_status_string);
+        LOG_INFO("BNO055 mag self test - %s", bno_status_string);
 
         if (((bno_self_test_result >> 2) & 1) == 1) {
             BNO055_COPYSTRING(bno_status_string, "pass");
@@ -84,7 +235,7 @@ namespace rover6_bno
         else {
             BNO055_COPYSTRING(bno_status_string, "fail");
         }
-        rover6_serial::println_info("BNO055 gyro self test - %s", bno_status_string);
+        LOG_INFO("BNO055 gyro self test - %s", bno_status_string);
 
         if (((bno_self_test_result >> 3) & 1) == 1) {
             BNO055_COPYSTRING(bno_status_string, "pass");
@@ -92,7 +243,7 @@ namespace rover6_bno
         else {
             BNO055_COPYSTRING(bno_status_string, "fail");
         }
-        rover6_serial::println_info("BNO055 mcu self test - %s", bno_status_string);
+        LOG_INFO("BNO055 mcu self test - %s", bno_status_string);
     }
 
     void get_system_error_string(uint8_t system_error, char* status)
@@ -115,7 +266,7 @@ namespace rover6_bno
     void bno_print_system_error()
     {
         get_system_error_string(bno_system_error, bno_status_string);
-        rover6_serial::println_info("BNO055 system error - %d, %s", bno_system_error, bno_status_string);
+        LOG_INFO("BNO055 system error - %d, %s", bno_system_error, bno_status_string);
     }
 
     void get_bno_status()
@@ -123,7 +274,9 @@ namespace rover6_bno
         uint8_t new_bno_system_status;
         uint8_t new_bno_self_test_result;
         uint8_t new_bno_system_error;
+        rover6_i2c::lock_bus(rover6_i2c::BUS_2);
         bno.getSystemStatus(&new_bno_system_status, &new_bno_self_test_result, &new_bno_system_error);
+        rover6_i2c::unlock_bus(rover6_i2c::BUS_2);
         if (new_bno_system_status != bno_system_status || new_bno_self_test_result != bno_self_test_result || new_bno_system_error != bno_system_error)
         {
             bno_system_status = new_bno_system_status;
@@ -135,24 +288,160 @@ namespace rover6_bno
         }
     }
 
+    void bno_raw_read_done(rover6_i2c::transaction* t, bool ok)
+    {
+        if (!ok) {
+            LOG_ERROR("BNO055 raw read failed: %d", t->error);
+            return;
+        }
+        Adafruit_BNO055::decodeRawData(bno_raw_read_data, &bno_raw);
+        if (raw_count == BNO_RAW_BUFFER_LEN) {  // nobody is sending them. Drop the oldest
+            raw_head = (raw_head + 1) % BNO_RAW_BUFFER_LEN;
+            raw_count--;
+        }
+        raw_sample* s = &raw_samples[(raw_head + raw_count) % BNO_RAW_BUFFER_LEN];
+        s->time_us = t->start_time_us;
+        memcpy(s->gyro, bno_raw.gyro, sizeof(s->gyro));
+        memcpy(s->accel, bno_raw.accel, sizeof(s->accel));
+        raw_count++;
+    }
+
+    // Call with the bus locked
+    void apply_raw_mode()
+    {
+        if (raw_rate_hz > 0) {
+            bno.setMode(Adafruit_BNO055::OPERATION_MODE_AMG);
+            bno.setRawSensorConfig(BNO_RAW_ACC_CONFIG, BNO_RAW_GYR_CONFIG);
+        }
+        else {
+            bno.setMode(Adafruit_BNO055::OPERATION_MODE_NDOF);
+        }
+    }
+
+    void bno_data_ready_isr()
+    {
+        bno_data_ready_time_us = micros();
+        bno_data_ready = true;
+    }
+
+    void bno_calibration_read_done(rover6_i2c::transaction* t, bool ok)
+    {
+        if (!ok) {
+            LOG_ERROR("BNO055 calibration read failed: %d", t->error);
+            return;
+        }
+        if (bno_calibration_read_data[0] != bno_calibration_status) {
+            bno_calibration_status = bno_calibration_read_data[0];
+            bno_calibration_changed = true;
+        }
+    }
+
+    uint8_t get_calibration(size_t index) {  // 0: system, 1: gyro, 2: accel, 3: mag
+        return (bno_calibration_status >> (6 - 2 * index)) & 0x03;
+    }
+
+    bool is_fully_calibrated() {
+        return bno_calibration_status == 0xff;  // all four at 3
+    }
+
+    // Call with the bus locked, before setExtCrystalUse (see the restore_offsets example)
+    void restore_calibration()
+    {
+        stored_calibration stored;
+        EEPROM.get(BNO_CALIBRATION_EEPROM_ADDR, stored);
+        if (stored.magic != BNO_CALIBRATION_MAGIC) {
+            bno_calibration_offsets = CALIBRATION_OFFSETS_NONE;
+            LOG_INFO("No BNO055 calibration in EEPROM. Move the rover around to calibrate");
+            return;
+        }
+        bno.setSensorOffsets(stored.offsets);
+        bno_calibration_offsets = CALIBRATION_OFFSETS_RESTORED;
+        LOG_INFO("BNO055 calibration restored from EEPROM");
+    }
+
+    // Blocks for about 100 ms while the BNO055 is in config mode. Only works in fusion mode
+    bool save_calibration()
+    {
+        if (!is_bno_setup || raw_rate_hz > 0) {
+            LOG_ERROR("BNO055 calibration can only be saved in fusion mode");
+            return false;
+        }
+        stored_calibration stored;
+        stored.magic = BNO_CALIBRATION_MAGIC;
+        rover6_i2c::lock_bus(rover6_i2c::BUS_2);
+        bool ok = bno.getSensorOffsets(stored.offsets);  // false if it isn't fully calibrated
+        rover6_i2c::unlock_bus(rover6_i2c::BUS_2);
+        bno_interrupt_timer = CURRENT_TIME;  // fusion output was paused
+        if (is_interrupt_mode_enabled) {
+            rover6_i2c::submit(rover6_i2c::BUS_2, &bno_interrupt_reset);
+        }
+        if (!ok) {
+            LOG_ERROR("BNO055 isn't fully calibrated. Not saving");
+            return false;
+        }
+        EEPROM.put(BNO_CALIBRATION_EEPROM_ADDR, stored);  // only writes the bytes that changed
+        bno_calibration_offsets = CALIBRATION_OFFSETS_SAVED;
+        bno_calibration_changed = true;
+        LOG_INFO("BNO055 calibration saved to EEPROM");
+        return true;
+    }
+
+    void clear_calibration()
+    {
+        EEPROM.put(BNO_CALIBRATION_EEPROM_ADDR, (uint32_t)0);
+        bno_calibration_offsets = CALIBRATION_OFFSETS_NONE;  // the next full calibration is saved again
+        bno_calibration_changed = true;
+        LOG_INFO("BNO055 calibration cleared from EEPROM");
+    }
+
+    // Call with the bus locked. begin() resets the sensor, so this sets everything up again
+    bool start_bno()
+    {
+        if (!bno.begin()) {
+            return false;
+        }
+        restore_calibration();
+        bno.setExtCrystalUse(true);
+        if (raw_rate_hz > 0) {
+            apply_raw_mode();  // begin() went back to NDOF
+        }
+        if (is_interrupt_mode_enabled) {
+            bno.enableDataReadyInterrupt(true);  // the reset cleared it
+            bno_interrupt_timer = CURRENT_TIME;
+        }
+        bno_calibration_status = 0;
+        bno_calibration_changed = true;
+        bno.getSystemStatus(&bno_system_status, &bno_self_test_result, &bno_system_error);
+        return true;
+    }
+
     void hardware_reset_bno()
     {
+        rover6_i2c::lock_bus(rover6_i2c::BUS_2);
         digitalWrite(BNO055_RST_PIN, LOW);
-        delay(100);
+        delay(BNO055_RESET_PULSE_MS);
         digitalWrite(BNO055_RST_PIN, HIGH);
-        delay(800);
-        if (!bno.begin()) {
-            rover6_serial::println_error("No BNO055 detected!! Check your wiring or I2C address");
+        bool started = start_bno();
+        rover6_i2c::unlock_bus(rover6_i2c::BUS_2);
+        if (!started) {
+            LOG_ERROR("No BNO055 detected!! Check your wiring or I2C address");
             return;
         }
-        bno.setExtCrystalUse(true);
-
-        bno.getSystemStatus(&bno_system_status, &bno_self_test_result, &bno_system_error);
+        if (is_interrupt_mode_enabled) {
+            rover6_i2c::submit(rover6_i2c::BUS_2, &bno_interrupt_reset);
+        }
         bno_print_system_status();
         bno_print_self_test();
         bno_print_system_error();
     }
 
+    // Running fusion (or AMG in raw mode) with no errors
+    bool is_bno_running()
+    {
+        get_bno_status();
+        return bno_system_error == 0 && (bno_system_status == 5 || bno_system_status == 6);
+    }
+
 
     void set_bno_active(bool active)
     {
@@ -161,7 +450,9 @@ namespace rover6_bno
         }
         is_bno_active = active;
 
-        if (active) {
+        // The sensor keeps running and calibrating while the rover is inactive. A reset would
+        // throw that away, so it's only reset if it stopped
+        if (active && (!is_bno_setup || !is_bno_running())) {
             // bno.enterNormalMode();
             hardware_reset_bno();
         }
@@ -173,58 +464,334 @@ namespace rover6_bno
 
     void setup_BNO055()
     {
-        if (!bno.begin()) {
-            rover6_serial::println_error("No BNO055 detected!! Check your wiring or I2C address");
-            return;
-        }
         pinMode(BNO055_RST_PIN, OUTPUT);
         digitalWrite(BNO055_RST_PIN, HIGH);
-
-        delay(1000);
+        pinMode(BNO055_INT_PIN, INPUT);
+
+        rover6_i2c::init_read(&bno_read, BNO055_ADDRESS_A, Adafruit_BNO055::BNO055_GYRO_DATA_X_LSB_ADDR,
+            bno_read_data, NUM_BNO055_FUSION_REGISTERS, bno_read_done);
+        rover6_i2c::init_write(&bno_interrupt_reset, BNO055_ADDRESS_A, Adafruit_BNO055::BNO055_SYS_TRIGGER_ADDR,
+            bno_interrupt_reset_data, 1, NULL);
+        rover6_i2c::init_read(&bno_raw_read, BNO055_ADDRESS_A, Adafruit_BNO055::BNO055_ACCEL_DATA_X_LSB_ADDR,
+            bno_raw_read_data, NUM_BNO055_RAW_REGISTERS, bno_raw_read_done);
+        rover6_i2c::init_read(&bno_calibration_read, BNO055_ADDRESS_A, Adafruit_BNO055::BNO055_CALIB_STAT_ADDR,
+            bno_calibration_read_data, 1, bno_calibration_read_done);
+
+        // power on already reset it. begin() resets it again and waits until it's booted
+        rover6_i2c::lock_bus(rover6_i2c::BUS_2);
+        bool started = start_bno();
+        rover6_i2c::unlock_bus(rover6_i2c::BUS_2);
+        if (!started) {
+            LOG_ERROR("No BNO055 detected!! Check your wiring or I2C address");
+            return;
+        }
         is_bno_setup = true;
-        rover6_serial::println_info("BNO055 initialized.");
-
-        bno.setExtCrystalUse(true);
-        delay(100);
+        LOG_INFO("BNO055 initialized.");
 
-        bno.getSystemStatus(&bno_system_status, &bno_self_test_result, &bno_system_error);
         bno_print_system_status();
         bno_print_self_test();
         bno_print_system_error();
 
-        delay(100);
-
         set_bno_active(true);
     }
 
+    void set_interrupt_mode(bool enabled)
+    {
+        if (!is_bno_setup || is_interrupt_mode_enabled == enabled) {
+            return;
+        }
+        is_interrupt_mode_enabled = enabled;
+        rover6_i2c::lock_bus(rover6_i2c::BUS_2);
+        bno.enableDataReadyInterrupt(enabled);
+        rover6_i2c::unlock_bus(rover6_i2c::BUS_2);
+        if (enabled) {
+            bno_interrupt_timer = CURRENT_TIME;
+            attachInterrupt(digitalPinToInterrupt(BNO055_INT_PIN), bno_data_ready_isr, RISING);
+            rover6_i2c::submit(rover6_i2c::BUS_2, &bno_interrupt_reset);  // in case it's already latched
+        }
+        else {
+            detachInterrupt(digitalPinToInterrupt(BNO055_INT_PIN));
+            bno_data_ready = false;
+        }
+    }
+
+    // Returns the rate in effect, which is clamped to BNO_RAW_MAX_RATE_HZ. 0 turns raw mode off
+    uint16_t set_raw_rate(uint16_t rate_hz)
+    {
+        if (!is_bno_setup) {
+            return 0;
+        }
+        if (rate_hz > BNO_RAW_MAX_RATE_HZ) {
+            rate_hz = BNO_RAW_MAX_RATE_HZ;
+        }
+        bool was_raw = raw_rate_hz > 0;
+        raw_rate_hz = rate_hz;
+        if (rate_hz > 0) {
+            raw_period_us = 1000000 / rate_hz;
+            raw_timer_us = micros();
+        }
+        if ((rate_hz > 0) != was_raw) {
+            rover6_i2c::lock_bus(rover6_i2c::BUS_2);
+            apply_raw_mode();
+            rover6_i2c::unlock_bus(rover6_i2c::BUS_2);
+            raw_count = 0;
+            bno_has_sample = false;
+            bno_interrupt_timer = CURRENT_TIME;  // fusion output was paused
+        }
+        return rate_hz;
+    }
+
+    // Starts a calibration status read when it's time. Returns true if the status changed
+    bool read_calibration()
+    {
+        if (!is_bno_setup || !is_bno_active || raw_rate_hz > 0) {
+            return false;  // AMG mode doesn't calibrate
+        }
+        if (bno_calibration_changed) {
+            bno_calibration_changed = false;
+            return true;
+        }
+        if (rover6_i2c::is_pending(&bno_calibration_read) || CURRENT_TIME - bno_calibration_timer < BNO_CALIBRATION_DELAY_MS) {
+            return false;
+        }
+        if (rover6_i2c::submit(rover6_i2c::BUS_2, &bno_calibration_read)) {
+            bno_calibration_timer = CURRENT_TIME;
+        }
+        return false;
+    }
+
+    // Saves the offsets the first time the sensor is fully calibrated without stored offsets
+    void check_calibration()
+    {
+        if (is_fully_calibrated() && bno_calibration_offsets == CALIBRATION_OFFSETS_NONE) {
+            save_calibration();
+        }
+    }
+
+    void report_calibration()
+    {
+        if (!rover6::rover_state.is_reporting_enabled) {
+            return;
+        }
+        ROVER6_SERIAL_WRITE_BOTH("bcal", "uuuuuu", CURRENT_TIME,
+            get_calibration(0), get_calibration(1), get_calibration(2), get_calibration(3),
+            (uint32_t)bno_calibration_offsets
+        );
+    }
+
+    // Starts a raw sample when it's time. Returns true when there's a full batch to send
+    bool read_BNO055_raw()
+    {
+        if (!is_bno_setup || !is_bno_active || raw_rate_hz == 0) {
+            return false;
+        }
+        uint32_t now = micros();
+        if (!rover6_i2c::is_pending(&bno_raw_read) && now - raw_timer_us >= raw_period_us) {
+            if (rover6_i2c::submit(rover6_i2c::BUS_2, &bno_raw_read)) {
+                raw_timer_us += raw_period_us;
+                if (now - raw_timer_us >= raw_period_us) {
+                    raw_timer_us = now;  // fell behind. Don't read back to back to catch up
+                }
+            }
+        }
+        return raw_count >= BNO_RAW_BATCH_LEN;
+    }
+
+    void report_BNO055_raw()
+    {
+        while (raw_count >= BNO_RAW_BATCH_LEN) {
+            raw_sample* s[BNO_RAW_BATCH_LEN];
+            for (size_t index = 0; index < BNO_RAW_BATCH_LEN; index++) {
+                s[index] = &raw_samples[(raw_head + index) % BNO_RAW_BUFFER_LEN];
+            }
+            if (rover6::rover_state.is_reporting_enabled) {
+                uint32_t first_time_ms = CURRENT_TIME - (micros() - s[0]->time_us) / 1000;
+                rover6_serial::data->write(
+                    "bnor", "u" BNO_RAW_SAMPLE_FORMAT BNO_RAW_SAMPLE_FORMAT BNO_RAW_SAMPLE_FORMAT BNO_RAW_SAMPLE_FORMAT,
+                    first_time_ms,
+                    BNO_RAW_SAMPLE_ARGS(s[0], s[0]->time_us),
+                    BNO_RAW_SAMPLE_ARGS(s[1], s[0]->time_us),
+                    BNO_RAW_SAMPLE_ARGS(s[2], s[1]->time_us),
+                    BNO_RAW_SAMPLE_ARGS(s[3], s[2]->time_us)
+                );
+            }
+            raw_head = (raw_head + BNO_RAW_BATCH_LEN) % BNO_RAW_BUFFER_LEN;
+            raw_count -= BNO_RAW_BATCH_LEN;
+        }
+    }
+
+    // Starts a sample when it's time. Returns true once a sample has arrived
     bool read_BNO055()
     {
-        if (!is_bno_setup || !is_bno_active) {
+        if (!is_bno_setup || !is_bno_active || raw_rate_hz > 0) {
+            return false;
+        }
+        if (bno_late_samples > 0 && CURRENT_TIME - bno_late_log_timer >= BNO_LATE_LOG_DELAY_MS) {
+            LOG_ERROR("BNO055 read %d samples late, %d fusion outputs lost", bno_late_samples, bno_skipped_frames);
+            bno_late_samples = 0;
+            bno_skipped_frames = 0;
+            bno_late_log_timer = CURRENT_TIME;
+        }
+        if (bno_has_sample) {
+            bno_has_sample = false;
+            return true;
+        }
+        if (rover6_i2c::is_pending(&bno_read) || rover6_i2c::is_pending(&bno_interrupt_reset)) {
+            return false;
+        }
+        if (is_interrupt_mode_enabled) {
+            if (!bno_data_ready) {
+                if (CURRENT_TIME - bno_interrupt_timer > BNO_INTERRUPT_TIMEOUT_MS) {
+                    LOG_ERROR("No BNO055 data ready interrupt. Check pin %d. Using the timer", BNO055_INT_PIN);
+                    set_interrupt_mode(false);
+                }
+                return false;
+            }
+            if (rover6_i2c::queue_space(rover6_i2c::BUS_2) < 2) {
+                return false;  // try again next time
+            }
+            noInterrupts();
+            bno_read_ready_time_us = bno_data_ready_time_us;
+            bno_data_ready = false;
+            interrupts();
+            is_read_interrupt_stamped = true;
+            bno_interrupt_timer = CURRENT_TIME;
+            rover6_i2c::submit(rover6_i2c::BUS_2, &bno_interrupt_reset);
+            rover6_i2c::submit(rover6_i2c::BUS_2, &bno_read);
             return false;
         }
 
-        if (CURRENT_TIME - bno_report_timer < BNO_SAMPLERATE_DELAY_MS) {
+        if (CURRENT_TIME - bno_report_timer < rover6_streams::get_sample_delay_ms(rover6_streams::STREAM_BNO, BNO_SAMPLERATE_DELAY_MS)) {
             return false;
         }
-        bno_report_timer = CURRENT_TIME;
+        if (rover6_i2c::submit(rover6_i2c::BUS_2, &bno_read)) {
+            bno_report_timer = CURRENT_TIME;
+            bno_sample_time = CURRENT_TIME;
+            is_read_interrupt_stamped = false;
+        }
+        return false;
+    }
 
-        bno.getEvent(&orientationData, Adafruit_BNO055::VECTOR_EULER);
-        bno.getEvent(&angVelocityData, Adafruit_BNO055::VECTOR_GYROSCOPE);
-        bno.getEvent(&linearAccelData, Adafruit_BNO055::VECTOR_LINEARACCEL);
-        bno_temperature = bno.getTemp();
+    void set_compression(bool enabled)
+    {
+        is_compression_enabled = enabled;
+        bno_needs_keyframe = true;
+    }
 
-        return true;
+    void set_quaternion_mode(bool enabled)
+    {
+        is_quaternion_enabled = enabled;
+        bno_needs_keyframe = true;  // the keyframe values change meaning
+    }
+
+    void report_BNO055_compressed()
+    {
+        // same order as the bno or bnoq packet
+        float vectors[BNO_NUM_QUAT_VECTOR_VALUES];
+        const int32_t* scales;
+        size_t num_values;
+        if (is_quaternion_enabled) {
+            memcpy(vectors, bno_fusion.quat, sizeof(bno_fusion.quat));
+            memcpy(vectors + 4, bno_fusion.gyro, sizeof(bno_fusion.gyro));
+            memcpy(vectors + 7, bno_fusion.linear_accel, sizeof(bno_fusion.linear_accel));
+            scales = BNO_QUAT_COMPRESSED_SCALES;
+            num_values = BNO_NUM_QUAT_VECTOR_VALUES;
+        }
+        else {
+            vectors[0] = orientationData.orientation.x;
+            vectors[1] = orientationData.orientation.y;
+            vectors[2] = orientationData.orientation.z;
+            vectors[3] = angVelocityData.gyro.x;
+            vectors[4] = angVelocityData.gyro.y;
+            vectors[5] = angVelocityData.gyro.z;
+            vectors[6] = linearAccelData.acceleration.x;
+            vectors[7] = linearAccelData.acceleration.y;
+            vectors[8] = linearAccelData.acceleration.z;
+            scales = BNO_COMPRESSED_SCALES;
+            num_values = BNO_NUM_VECTOR_VALUES;
+        }
+        for (size_t index = 0; index < num_values; index++) {
+            bno_values[index] = (int32_t)lroundf(vectors[index] * scales[index]);
+        }
+
+        if (bno_needs_keyframe || CURRENT_TIME - bno_key_time >= BNO_KEYFRAME_DELAY_MS) {
+            // keep ids below 64 so they fit in a one byte varint
+            bno_keyframe_id = (bno_keyframe_id + 1) & 0x3f;
+            bno_key_time = bno_sample_time;
+            memcpy(bno_key_values, bno_values, sizeof(bno_values));
+            bno_needs_keyframe = false;
+            if (is_quaternion_enabled) {
+                rover6_serial::data->write(
+                    "bnqk", "uuddddddddddd",
+                    bno_keyframe_id, bno_key_time,
+                    bno_values[0], bno_values[1], bno_values[2], bno_values[3],
+                    bno_values[4], bno_values[5], bno_values[6],
+                    bno_values[7], bno_values[8], bno_values[9],
+                    bno_temperature
+                );
+                return;
+            }
+            rover6_serial::data->write(
+                "bnok", "uudddddddddd",
+                bno_keyframe_id, bno_key_time,
+                bno_values[0], bno_values[1], bno_values[2],
+                bno_values[3], bno_values[4], bno_values[5],
+                bno_values[6], bno_values[7], bno_values[8],
+                bno_temperature
+            );
+        }
+        else if (is_quaternion_enabled) {
+            rover6_serial::data->write(
+                "bnqd", "vvvvvvvvvvvv",
+                bno_keyframe_id, (int32_t)(bno_sample_time - bno_key_time),
+                bno_values[0] - bno_key_values[0], bno_values[1] - bno_key_values[1],
+                bno_values[2] - bno_key_values[2], bno_values[3] - bno_key_values[3],
+                bno_values[4] - bno_key_values[4], bno_values[5] - bno_key_values[5], bno_values[6] - bno_key_values[6],
+                bno_values[7] - bno_key_values[7], bno_values[8] - bno_key_values[8], bno_values[9] - bno_key_values[9]
+            );
+        }
+        else {
+            rover6_serial::data->write(
+                "bnod", "vvvvvvvvvvv",
+                bno_keyframe_id, (int32_t)(bno_sample_time - bno_key_time),
+                bno_values[0] - bno_key_values[0], bno_values[1] - bno_key_values[1], bno_values[2] - bno_key_values[2],
+                bno_values[3] - bno_key_values[3], bno_values[4] - bno_key_values[4], bno_values[5] - bno_key_values[5],
+                bno_values[6] - bno_key_values[6], bno_values[7] - bno_key_values[7], bno_values[8] - bno_key_values[8]
+            );
+        }
     }
 
     void report_BNO055()
     {
-        if (!rover6::rover_state.is_reporting_enabled) {
+        if (!rover6_streams::should_report(rover6_streams::STREAM_BNO)) {
+            return;
+        }
+        if (is_compression_enabled) {
+            report_BNO055_compressed();
+            return;
+        }
+        if (is_quaternion_enabled) {
+            rover6_serial::data->write(
+                "bnoq", "uf5f5f5f5f4f4f4f2f2f2d",  // quaternion LSB is 2^-14, about 6e-5
+                bno_sample_time,
+                bno_fusion.quat[0],
+                bno_fusion.quat[1],
+                bno_fusion.quat[2],
+                bno_fusion.quat[3],
+                angVelocityData.gyro.x,
+                angVelocityData.gyro.y,
+                angVelocityData.gyro.z,
+                linearAccelData.acceleration.x,
+                linearAccelData.acceleration.y,
+                linearAccelData.acceleration.z,
+                bno_temperature
+            );
             return;
         }
 
         rover6_serial::data->write(
-            "bno", "ufffffffffd",
-            CURRENT_TIME,
+            "bno", "uf4f4f4f4f4f4f2f2f2d",  // BNO055 LSBs are 1/16 deg, 1/16 dps, and 0.01 m/s^2
+            bno_sample_time,
             orientationData.orientation.x,
             orientationData.orientation.y,
             orientationData.orientation.z,
@@ -0,0 +1,146 @@
+#ifndef ROVER6_CONTROL
+#define ROVER6_CONTROL
+
+#include <Arduino.h>
+#include "rover6_general.h"
+#include "rover6_serial.h"
+#include "rover6_streams.h"
+#include "rover6_encoders.h"
+#include "rover6_pid.h"
+#include "rover6_profiler.h"
+
+/*
+ * Speed control loop
+ * An IntervalTimer samples both encoders and runs both speed PIDs at a fixed rate of up to
+ * 1 kHz, so the control period doesn't depend on what the main loop is doing. The interrupt and
+ * the main loop never wait on each other. See rover6_pid.h for the setpoint handoff,
+ * rover6_encoders.h for the sample handoff and rover6_motors.h for stops.
+ *
+ * The interrupt measures its own period. The ctl stream reports the min, mean and max
+ * difference from the nominal period (jitter) and the longest run, since the last report:
+ *     time (ms) | rate (Hz) | periods measured | min jitter (us) | mean jitter (us) | max jitter (us) | max run (us)
+ */
+
+#define CONTROL_RATE_DEFAULT_HZ 200
+#define CONTROL_RATE_MAX_HZ 1000
+#define CONTROL_TIMER_PRIORITY 144  // Teensy default is 128. Encoder pin interrupts need to preempt this one
+
+namespace rover6_control
+{
+    IntervalTimer control_timer;
+    uint32_t control_rate_hz = CONTROL_RATE_DEFAULT_HZ;
+    volatile uint32_t control_period_us = 1000000 / CONTROL_RATE_DEFAULT_HZ;
+
+    struct period_stats {
+        uint32_t count;
+        int32_t min_jitter_us;
+        int32_t max_jitter_us;
+        int64_t jitter_sum_us;
+        uint32_t max_run_us;
+    };
+
+    // The interrupt fills stats[stats_index]. report_control flips the index and reports the other one
+    period_stats stats[2];
+    volatile uint8_t stats_index = 0;
+
+    // interrupt only
+    uint32_t prev_tick_us = 0;
+    bool has_prev_tick = false;
+    int profile_id = -1;
+
+    void reset_stats(period_stats* s)
+    {
+        s->count = 0;
+        s->min_jitter_us = INT32_MAX;
+        s->max_jitter_us = INT32_MIN;
+        s->jitter_sum_us = 0;
+        s->max_run_us = 0;
+    }
+
+    void control_isr()
+    {
+        uint32_t start_cycles = PROFILE_CYCLES();
+        uint32_t now = micros();
+        period_stats* s = &stats[stats_index];
+        if (has_prev_tick) {
+            int32_t jitter = (int32_t)(now - prev_tick_us) - (int32_t)control_period_us;
+            if (jitter < s->min_jitter_us) {
+                s->min_jitter_us = jitter;
+            }
+            if (jitter > s->max_jitter_us) {
+                s->max_jitter_us = jitter;
+            }
+            s->jitter_sum_us += jitter;
+            s->count++;
+        }
+        prev_tick_us = now;
+        has_prev_tick = true;
+
+        rover6_encoders::sample_encoders(now);
+        rover6_pid::update_speed_pid();
+
+        uint32_t run_cycles = PROFILE_CYCLES() - start_cycles;
+        rover6_profiler::record(profile_id, run_cycles);
+        uint32_t run_us = CYCLES_TO_US(run_cycles);
+        if (run_us > s->max_run_us) {
+            s->max_run_us = run_us;
+        }
+    }
+
+    // Returns the rate in effect, which is clamped to 1..CONTROL_RATE_MAX_HZ
+    uint32_t set_control_rate(uint32_t rate_hz)
+    {
+        if (rate_hz < 1) {
+            rate_hz = 1;
+        }
+        if (rate_hz > CONTROL_RATE_MAX_HZ) {
+            rate_hz = CONTROL_RATE_MAX_HZ;
+        }
+        uint32_t period_us = 1000000 / rate_hz;
+        control_rate_hz = rate_hz;
+
+        rover6_encoders::set_sample_period(period_us);
+        rover6_pid::set_period(period_us);
+        noInterrupts();
+        control_period_us = period_us;
+        has_prev_tick = false;  // the period being measured has the old length
+        interrupts();
+        control_timer.update(period_us);  // takes effect after the current period
+        return rate_hz;
+    }
+
+    void setup_control()
+    {
+        reset_stats(&stats[0]);
+        reset_stats(&stats[1]);
+        profile_id = rover6_profiler::add_point("ctl_isr");
+        uint32_t period_us = 1000000 / control_rate_hz;
+        rover6_encoders::set_sample_period(period_us);
+        rover6_pid::set_period(period_us);
+        control_period_us = period_us;
+        control_timer.priority(CONTROL_TIMER_PRIORITY);
+        control_timer.begin(control_isr, period_us);
+        LOG_INFO("Control loop running at %d Hz", control_rate_hz);
+    }
+
+    void report_control()
+    {
+        if (!rover6_streams::should_report(rover6_streams::STREAM_CTL)) {
+            return;
+        }
+        uint8_t index = stats_index;
+        stats_index = index ^ 1;
+        period_stats* s = &stats[index];
+        if (s->count == 0) {
+            rover6_serial::data->write("ctl", "uuudf1du", CURRENT_TIME, control_rate_hz, 0, 0, 0.0, 0, s->max_run_us);
+        }
+        else {
+            rover6_serial::data->write("ctl", "uuudf1du", CURRENT_TIME, control_rate_hz, s->count,
+                s->min_jitter_us, (double)s->jitter_sum_us / s->count, s->max_jitter_us, s->max_run_us
+            );
+        }
+        reset_stats(s);
+    }
+};  // namespace rover6_control
+
+#endif  // ROVER6_CONTROL
@@ -3,35 +3,120 @@
 #define ROVER6_ENCODERS
 
 #include <Arduino.h>
-#include <Encoder.h>
 #include "rover6_general.h"
 #include "rover6_serial.h"
+#include "rover6_streams.h"
+#include "rover6_quadrature.h"
 
 
 /*
  * Encoders
+ * The control timer samples both encoders and estimates their speed every sample.
+ * There are three speed estimators:
+ *     window: ticks counted over the speed window. Good at speed. Below ~200 ticks/s it's only a
+ *         few ticks per window, so the estimate is mostly quantization noise
+ *     edge: time between ticks. A tick is timed as the middle of the sample it showed up in, so the
+ *         error is in time (up to one control period) instead of ticks. Run the control loop fast
+ *         to get the most out of it
+ *     blended: edge below ENCODER_BLEND_LOW_TPS, window above ENCODER_BLEND_HIGH_TPS and a mix in between
+ * See rover6_quadrature.h for the two ways the encoders can be counted.
  */
 
+#if ENCODER_BACKEND == ENCODER_BACKEND_FTM
+#define MOTORA_ENCA 3
+#define MOTORA_ENCB 4
+#define MOTORB_ENCA 29
+#define MOTORB_ENCB 30
+#else
+#include <Encoder.h>
 #define MOTORA_ENCA 23
 #define MOTORA_ENCB 22
 #define MOTORB_ENCA 21
 #define MOTORB_ENCB 20
+#endif
 
 #define ENCODER_SAMPLERATE_DELAY_MS 33  // ~30 Hz
+#define ENCODER_COMPRESSED_SAMPLERATE_DELAY_MS 5  // 200 Hz when reports are delta compressed
+#define ENCODER_SPEED_WINDOW_MS 33  // speed is computed over this window regardless of the sample rate
+#define ENCODER_KEYFRAME_DELAY_MS 500
+#define ENCODER_HISTORY_LEN 64  // control samples kept for the speed window. Covers 33 ms at 1 kHz
+#define ENCODER_EDGE_HISTORY_LEN 8  // the edge estimator averages over up to this many ticks
+#define ENCODER_EDGE_MAX_SPAN_US 100000  // ...that happened within this time of the latest one
+#define ENCODER_EDGE_TIMEOUT_US 250000  // no tick for this long is 0 ticks/s (4 ticks/s)
+#define ENCODER_BLEND_LOW_TPS 300.0f  // the edge estimate is the better one up to about here
+#define ENCODER_BLEND_HIGH_TPS 500.0f
+
+enum ENCODER_ESTIMATORS {
+    ENCODER_ESTIMATOR_WINDOW,
+    ENCODER_ESTIMATOR_EDGE,
+    ENCODER_ESTIMATOR_BLENDED,
+    NUM_ENCODER_ESTIMATORS
+};
 
 namespace rover6_encoders
 {
+#if ENCODER_BACKEND == ENCODER_BACKEND_FTM
+    // motor A counts the other way, like its swapped pins with the Encoder library. Check the signs after rewiring
+    rover6_quadrature::FtmEncoder motorA_enc(&FTM1_CNT, true);
+    rover6_quadrature::FtmEncoder motorB_enc(&FTM2_CNT, false);
+#else
     Encoder motorA_enc(MOTORA_ENCB, MOTORA_ENCA);
     Encoder motorB_enc(MOTORB_ENCA, MOTORB_ENCB);
+#endif
 
+    // main loop copies of the latest control sample. Updated by read_encoders
     long encA_pos, encB_pos = 0;
     double enc_speedA, enc_speedB = 0.0;  // ticks/s, smoothed
     double enc_speedA_raw, enc_speedB_raw = 0.0;  // ticks/s
 
     uint32_t prev_enc_time = 0;
+    uint32_t encoder_samplerate_delay_ms = ENCODER_SAMPLERATE_DELAY_MS;
+
+    // The control timer (rover6_control.h) samples the encoders. Everything below up to
+    // get_encoder_sample belongs to the interrupt. The main loop only writes it with interrupts off
+    struct encoder_sample {
+        uint32_t time_us;
+        long posA, posB;
+        float speedA, speedB;  // ticks/s, smoothed
+        float speedA_raw, speedB_raw;  // ticks/s from the selected estimator
+    };
+    encoder_sample latest_sample;
+    volatile uint32_t sample_seq = 0;  // odd while latest_sample is being written
+    volatile bool reset_requested = false;  // set by reset_encoders, handled at the next sample
+
+    uint32_t history_time_us[ENCODER_HISTORY_LEN];
+    long history_posA[ENCODER_HISTORY_LEN];
+    long history_posB[ENCODER_HISTORY_LEN];
+    size_t history_index = 0;
+    size_t history_count = 0;
+    size_t speed_window_samples = 1;
+    uint32_t sample_period_us = ENCODER_SPEED_WINDOW_MS * 1000;
+    ENCODER_ESTIMATORS estimator = ENCODER_ESTIMATOR_BLENDED;
 
-    double speed_smooth_kA = 1.0;
+    // ticks timed at the middle of the sample they showed up in. All in the same direction
+    struct edge_history {
+        uint32_t time_us[ENCODER_EDGE_HISTORY_LEN];
+        long pos[ENCODER_EDGE_HISTORY_LEN];
+        size_t index;
+        size_t count;
+        int direction;  // 1 or -1
+        uint32_t seen_us;  // the sample the newest tick showed up in. It happened before this
+    };
+    edge_history edgesA, edgesB;
+    uint32_t prev_sample_time_us = 0;
+    long prev_sample_posA, prev_sample_posB = 0;
+
+    // compressed reports are deltas against the last keyframe
+    bool is_compression_enabled = false;
+    uint8_t enc_keyframe_id = 0;
+    bool enc_needs_keyframe = true;
+    uint32_t enc_key_time = 0;
+    long enc_key_posA, enc_key_posB = 0;
+
+    double speed_smooth_kA = 1.0;  // per speed window. Set with the ks command, see rover6_pid::set_Ks
     double speed_smooth_kB = 1.0;
+    float sample_smooth_kA = 1.0f;  // the same smoothing applied once per control sample
+    float sample_smooth_kB = 1.0f;
 
     // cm per rotation = 2pi * wheel radius (cm); arc = angle * radius
     // ticks per rotation = 1920
@@ -39,35 +124,238 @@ namespace rover6_encoders
     // double wheel_radius_cm = 32.5;
     // double cm_per_tick = 2.0 * PI * wheel_radius_cm / 1920.0; //  * ticks / rotation
 
+    float per_sample_smoothing(double k_per_window)
+    {
+        float k = constrain((float)k_per_window, 0.0f, 1.0f);
+        return 1.0f - powf(1.0f - k, (float)sample_period_us / (ENCODER_SPEED_WINDOW_MS * 1000.0f));
+    }
+
+    // Call with interrupts off after changing speed_smooth_kA/B or the sample period.
+    // A window's worth of samples smooth as much as one update per window used to
+    void update_smoothing()
+    {
+        sample_smooth_kA = per_sample_smoothing(speed_smooth_kA);
+        sample_smooth_kB = per_sample_smoothing(speed_smooth_kB);
+    }
+
+    void set_sample_period(uint32_t period_us)
+    {
+        size_t window = (ENCODER_SPEED_WINDOW_MS * 1000 + period_us / 2) / period_us;
+        if (window < 1) {
+            window = 1;
+        }
+        if (window > ENCODER_HISTORY_LEN - 1) {
+            window = ENCODER_HISTORY_LEN - 1;
+        }
+        noInterrupts();
+        sample_period_us = period_us;
+        speed_window_samples = window;
+        history_count = 0;
+        edgesA.count = 0;
+        edgesB.count = 0;
+        update_smoothing();
+        interrupts();
+    }
+
+    void set_estimator(ENCODER_ESTIMATORS new_estimator)
+    {
+        noInterrupts();
+        estimator = new_estimator;
+        interrupts();
+    }
+
+    void setup_encoders()
+    {
+#if ENCODER_BACKEND == ENCODER_BACKEND_FTM
+        rover6_quadrature::setup_ftm_encoders();
+#endif
+        LOG_INFO("Encoder backend: %s", ENCODER_BACKEND_NAME);
+    }
+
+    // The counts and the speed history are reset by the control timer at its next sample.
+    // Encoder::write enables interrupts, so resetting them from here could let a sample in
+    // between the new count and the old history and turn the jump into a speed
     void reset_encoders()
     {
         encA_pos = 0;
         encB_pos = 0;
+        reset_requested = true;
+        enc_needs_keyframe = true;
+    }
+
+    // Control timer context
+    void apply_reset()
+    {
         motorA_enc.write(0);
         motorB_enc.write(0);
+        history_count = 0;
+        edgesA.count = 0;
+        edgesB.count = 0;
+        reset_requested = false;
+    }
+
+    // Control timer context. Records a tick if the position changed since the previous sample
+    // and returns the speed over the recorded ticks
+    float edge_speed(edge_history* edges, long pos, long prev_pos, uint32_t time_us)
+    {
+        if (pos != prev_pos) {
+            int direction = pos > prev_pos ? 1 : -1;
+            if (direction != edges->direction) {
+                edges->count = 0;
+                edges->direction = direction;
+            }
+            edges->index = (edges->index + 1) % ENCODER_EDGE_HISTORY_LEN;
+            edges->time_us[edges->index] = prev_sample_time_us + (time_us - prev_sample_time_us) / 2;
+            edges->pos[edges->index] = pos;
+            edges->seen_us = time_us;
+            if (edges->count < ENCODER_EDGE_HISTORY_LEN) {
+                edges->count++;
+            }
+        }
+        if (edges->count == 0) {
+            return 0.0f;
+        }
+
+        uint32_t since_seen_us = time_us - edges->seen_us;
+        if (since_seen_us > ENCODER_EDGE_TIMEOUT_US) {
+            edges->count = 0;
+            return 0.0f;
+        }
+        if (edges->count < 2) {
+            return 0.0f;
+        }
+
+        // the oldest tick within the span. Always at least the one before the newest
+        uint32_t newest_time = edges->time_us[edges->index];
+        size_t oldest = (edges->index + ENCODER_EDGE_HISTORY_LEN - 1) % ENCODER_EDGE_HISTORY_LEN;
+        for (size_t age = 2; age < edges->count; age++) {
+            size_t candidate = (edges->index + ENCODER_EDGE_HISTORY_LEN - age) % ENCODER_EDGE_HISTORY_LEN;
+            if (newest_time - edges->time_us[candidate] > ENCODER_EDGE_MAX_SPAN_US) {
+                break;
+            }
+            oldest = candidate;
+        }
+        uint32_t span_us = newest_time - edges->time_us[oldest];
+        if (span_us == 0) {
+            return 0.0f;
+        }
+        float speed = (float)(edges->pos[edges->index] - edges->pos[oldest]) * 1E6f / (float)span_us;
+
+        // slowing down. No tick since seen_us, so the next one is at least that far from the newest
+        if (pos == prev_pos && since_seen_us > 0) {
+            float bound = 1E6f / (float)since_seen_us;
+            if (fabsf(speed) > bound) {
+                speed = edges->direction * bound;
+            }
+        }
+        return speed;
+    }
+
+    float blend_speed(float window, float edge)
+    {
+        float weight = (fabsf(edge) - ENCODER_BLEND_LOW_TPS) / (ENCODER_BLEND_HIGH_TPS - ENCODER_BLEND_LOW_TPS);
+        weight = constrain(weight, 0.0f, 1.0f);
+        return weight * window + (1.0f - weight) * edge;
+    }
+
+    // Control timer context. The window speed is measured over the last speed_window_samples samples,
+    // so it updates every sample instead of once per window
+    void sample_encoders(uint32_t time_us)
+    {
+        if (reset_requested) {
+            apply_reset();
+        }
+        long posA = motorA_enc.read();
+        long posB = motorB_enc.read();
+
+        history_index = (history_index + 1) % ENCODER_HISTORY_LEN;
+        history_time_us[history_index] = time_us;
+        history_posA[history_index] = posA;
+        history_posB[history_index] = posB;
+        if (history_count < ENCODER_HISTORY_LEN) {
+            history_count++;
+        }
+
+        float speedA_raw = 0.0f;
+        float speedB_raw = 0.0f;
+        size_t window = speed_window_samples < history_count ? speed_window_samples : history_count - 1;
+        if (window > 0) {
+            size_t oldest = (history_index + ENCODER_HISTORY_LEN - window) % ENCODER_HISTORY_LEN;
+            float dt = (float)(time_us - history_time_us[oldest]) * 1E-6f;
+            speedA_raw = (float)(posA - history_posA[oldest]) / dt;
+            speedB_raw = (float)(posB - history_posB[oldest]) / dt;
+        }
+
+        if (history_count > 1) {
+            // both run every sample so switching estimators doesn't start from nothing
+            float edge_speedA = edge_speed(&edgesA, posA, prev_sample_posA, time_us);
+            float edge_speedB = edge_speed(&edgesB, posB, prev_sample_posB, time_us);
+            if (estimator == ENCODER_ESTIMATOR_EDGE) {
+                speedA_raw = edge_speedA;
+                speedB_raw = edge_speedB;
+            }
+            else if (estimator == ENCODER_ESTIMATOR_BLENDED) {
+                speedA_raw = blend_speed(speedA_raw, edge_speedA);
+                speedB_raw = blend_speed(speedB_raw, edge_speedB);
+            }
+        }
+        prev_sample_time_us = time_us;
+        prev_sample_posA = posA;
+        prev_sample_posB = posB;
+
+        sample_seq++;
+        COMPILER_BARRIER();
+        latest_sample.time_us = time_us;
+        latest_sample.posA = posA;
+        latest_sample.posB = posB;
+        latest_sample.speedA_raw = speedA_raw;
+        latest_sample.speedB_raw = speedB_raw;
+        latest_sample.speedA += sample_smooth_kA * (speedA_raw - latest_sample.speedA);
+        latest_sample.speedB += sample_smooth_kB * (speedB_raw - latest_sample.speedB);
+        COMPILER_BARRIER();
+        sample_seq++;
+    }
+
+    // Main loop side. Copies the latest sample without blocking the interrupt.
+    // Tries again if the control timer wrote a new sample during the copy
+    void get_encoder_sample(encoder_sample* sample)
+    {
+        uint32_t seq;
+        do {
+            seq = sample_seq;
+            COMPILER_BARRIER();
+            *sample = latest_sample;
+            COMPILER_BARRIER();
+        } while ((seq & 1) || seq != sample_seq);
+    }
+
+    void set_compression(bool enabled)
+    {
+        is_compression_enabled = enabled;
+        encoder_samplerate_delay_ms = enabled ? ENCODER_COMPRESSED_SAMPLERATE_DELAY_MS : ENCODER_SAMPLERATE_DELAY_MS;
+        enc_needs_keyframe = true;
     }
 
     bool read_encoders()
     {
-        if (CURRENT_TIME - prev_enc_time < ENCODER_SAMPLERATE_DELAY_MS) {
+        if (CURRENT_TIME - prev_enc_time < rover6_streams::get_sample_delay_ms(rover6_streams::STREAM_ENC, encoder_samplerate_delay_ms)) {
             return false;
         }
 
-        long new_encA_pos = motorA_enc.read();
-        long new_encB_pos = motorB_enc.read();
+        encoder_sample sample;
+        get_encoder_sample(&sample);
 
         bool should_report = false;
-        if (new_encA_pos != encA_pos || new_encB_pos != encB_pos) {
+        if (sample.posA != encA_pos || sample.posB != encB_pos) {
             should_report = true;
         }
 
-        enc_speedA_raw = (double)(new_encA_pos - encA_pos) / (CURRENT_TIME - prev_enc_time) * 1000.0;
-        enc_speedB_raw = (double)(new_encB_pos - encB_pos) / (CURRENT_TIME - prev_enc_time) * 1000.0;
-        enc_speedA += speed_smooth_kA * (enc_speedA_raw - enc_speedA);
-        enc_speedB += speed_smooth_kB * (enc_speedB_raw - enc_speedB);
-
-        encA_pos = new_encA_pos;
-        encB_pos = new_encB_pos;
+        encA_pos = sample.posA;
+        encB_pos = sample.posB;
+        enc_speedA = sample.speedA;
+        enc_speedB = sample.speedB;
+        enc_speedA_raw = sample.speedA_raw;
+        enc_speedB_raw = sample.speedB_raw;
 
         prev_enc_time = CURRENT_TIME;
 
@@ -76,10 +364,29 @@ namespace rover6_encoders
 
     void report_encoders()
     {
-        if (!rover6::rover_state.is_reporting_enabled) {
+        if (!rover6_streams::should_report(rover6_streams::STREAM_ENC)) {
             return;
         }
-        rover6_serial::data->write("enc", "uddff", CURRENT_TIME, encA_pos, encB_pos, enc_speedA, enc_speedB);
+        if (!is_compression_enabled) {
+            rover6_serial::data->write("enc", "uddf1f1", CURRENT_TIME, encA_pos, encB_pos, enc_speedA, enc_speedB);
+            return;
+        }
+        if (enc_needs_keyframe || CURRENT_TIME - enc_key_time >= ENCODER_KEYFRAME_DELAY_MS) {
+            // keep ids below 64 so they fit in a one byte varint
+            enc_keyframe_id = (enc_keyframe_id + 1) & 0x3f;
+            enc_key_time = CURRENT_TIME;
+            enc_key_posA = encA_pos;
+            enc_key_posB = encB_pos;
+            enc_needs_keyframe = false;
+            rover6_serial::data->write("enck", "uuddf1f1", enc_keyframe_id, enc_key_time, encA_pos, encB_pos, enc_speedA, enc_speedB);
+        }
+        else {
+            // speeds are sent as whole ticks/s, rounded like the bridge rounds the keyframe's
+            rover6_serial::data->write("encd", "vvvvvv", enc_keyframe_id,
+                (int32_t)(CURRENT_TIME - enc_key_time), (int32_t)(encA_pos - enc_key_posA), (int32_t)(encB_pos - enc_key_posB),
+                (int32_t)lroundf(enc_speedA), (int32_t)lroundf(enc_speedB)
+            );
+        }
     }
 }; // namespace rover6_encoders
 
@@ -10,6 +10,7 @@
 #include <Arduino.h>
 #include "rover6_serial.h"
 #include "rover6_general.h"
+#include "rover6_streams.h"
 
 #define FSR_PIN_1 35
 #define FSR_PIN_2 36
@@ -29,7 +30,7 @@ namespace rover6_fsr
     {
         pinMode(FSR_PIN_1, INPUT);
         pinMode(FSR_PIN_2, INPUT);
-        rover6_serial::println_info("FSRs initialized.");
+        LOG_INFO("FSRs initialized.");
     }
 
 
@@ -43,7 +44,7 @@ namespace rover6_fsr
 
     bool read_fsrs()
     {
-        if (CURRENT_TIME - fsr_report_timer < FSR_SAMPLERATE_DELAY_MS) {
+        if (CURRENT_TIME - fsr_report_timer < rover6_streams::get_sample_delay_ms(rover6_streams::STREAM_FSR, FSR_SAMPLERATE_DELAY_MS)) {
             return false;
         }
         fsr_report_timer = CURRENT_TIME;
@@ -57,7 +58,7 @@ namespace rover6_fsr
 
     void report_fsrs()
     {
-        if (!rover6::rover_state.is_reporting_enabled) {
+        if (!rover6_streams::should_report(rover6_streams::STREAM_FSR)) {
             return;
         }
         rover6_serial::data->write("fsr", "udd", CURRENT_TIME, fsr_1_val, fsr_2_val);
@@ -8,6 +8,9 @@
 // uint32_t current_time = 0;
 #define CURRENT_TIME millis()
 
+// Keeps the compiler from moving memory accesses across it. For data shared with interrupts
+#define COMPILER_BARRIER()  __asm__ __volatile__("" ::: "memory")
+
 
 /*
  * Soft restart
@@ -1,4 +1,3 @@
-
 #ifndef ROVER6_I2C
 #define ROVER6_I2C
 
@@ -9,20 +8,315 @@
 
 /*
  * I2C
+ * Periodic sensor reads are queued transactions. Each bus runs its queue from i2c_t3's
+ * interrupt callbacks with the non-blocking sendTransmission/sendRequest, so the main loop
+ * never waits on a transfer and both buses run at the same time. A register read is a write
+ * of the register address, a repeated start and the read. A register write is one transfer.
+ * Drivers own their transactions and get a callback from update() (main loop) when one finishes.
+ *
+ * Libraries that use the blocking i2c_t3 calls (VL53L0X, servos, BNO055 setup and status) have
+ * to wrap them in lock_bus/unlock_bus, which waits for the transfer in progress and holds the queue.
  */
 
 #define I2C_BUS_1 Wire
 #define I2C_BUS_2 Wire1
 
+#define I2C_QUEUE_LEN 8
+#define I2C_TRANSACTION_TIMEOUT_US 5000  // the longest read is about 1 ms at 400 kHz
+#define I2C_BLOCKING_TIMEOUT_US 10000  // for the blocking library calls
+
 namespace rover6_i2c
 {
+    enum BUSES {
+        BUS_1,
+        BUS_2,
+        NUM_BUSES
+    };
+
+    enum TRANSACTION_STATES {
+        TRANSACTION_IDLE,  // never submitted, or finished and its callback ran
+        TRANSACTION_QUEUED,
+        TRANSACTION_WRITING,
+        TRANSACTION_READING,
+        TRANSACTION_DONE,
+        TRANSACTION_FAILED
+    };
+
+    struct transaction;
+    typedef void (*transaction_callback)(transaction* t, bool ok);  // ok is false if it failed. t->error has why
+
+    struct transaction {
+        // set by the driver
+        uint8_t address;
+        uint8_t reg;
+        uint8_t* data;  // read into, or written after reg
+        size_t length;
+        bool is_read;
+        transaction_callback callback;
+
+        // set by the bus
+        volatile TRANSACTION_STATES state;
+        uint8_t error;  // i2c_status when failed
+        uint32_t start_time_us;
+    };
+
+    struct bus_state {
+        i2c_t3* wire;
+        // queued transactions. The main loop adds, the interrupt takes. Changed with interrupts off
+        transaction* queue[I2C_QUEUE_LEN];
+        size_t queue_head;
+        size_t queue_tail;
+        // finished transactions waiting for update() to run their callbacks
+        transaction* finished[I2C_QUEUE_LEN];
+        size_t finished_head;
+        size_t finished_tail;
+        size_t pending;  // submitted and not given back yet. Main loop only
+
+        transaction* volatile active;
+        volatile bool is_resetting;  // callbacks are from the transfer that timed out. Ignore them
+        uint32_t lock_count;
+        uint32_t errors;
+        uint32_t timeouts;
+    };
+
+    bus_state buses[NUM_BUSES];
+
+    // Interrupt context, or interrupts off
+    void start_next(bus_state* bus)
+    {
+        if (bus->active != NULL || bus->is_resetting || bus->lock_count > 0 || bus->queue_head == bus->queue_tail) {
+            return;
+        }
+        transaction* t = bus->queue[bus->queue_head];
+        bus->queue_head = (bus->queue_head + 1) % I2C_QUEUE_LEN;
+        bus->active = t;
+        t->start_time_us = micros();
+        t->state = TRANSACTION_WRITING;
+
+        bus->wire->beginTransmission(t->address);
+        bus->wire->write(t->reg);
+        if (t->is_read) {
+            bus->wire->sendTransmission(I2C_NOSTOP);
+        }
+        else {
+            bus->wire->write(t->data, t->length);
+            bus->wire->sendTransmission(I2C_STOP);
+        }
+    }
+
+    // Interrupt context, or interrupts off
+    void detach_active(bus_state* bus, TRANSACTION_STATES state, uint8_t error)
+    {
+        transaction* t = bus->active;
+        bus->active = NULL;
+        t->error = error;
+        t->state = state;
+        bus->finished[bus->finished_tail] = t;
+        bus->finished_tail = (bus->finished_tail + 1) % I2C_QUEUE_LEN;
+    }
+
+    // Interrupt context, or interrupts off
+    void finish_active(bus_state* bus, TRANSACTION_STATES state, uint8_t error)
+    {
+        detach_active(bus, state, error);
+        start_next(bus);
+    }
+
+    // The i2c_t3 callbacks also fire for the blocking calls. Those run with nothing active
+    void on_transmit_done(bus_state* bus)
+    {
+        transaction* t = bus->active;
+        if (t == NULL || bus->is_resetting || t->state != TRANSACTION_WRITING) {
+            return;
+        }
+        if (t->is_read) {
+            t->state = TRANSACTION_READING;
+            bus->wire->sendRequest(t->address, t->length, I2C_STOP);
+        }
+        else {
+            finish_active(bus, TRANSACTION_DONE, I2C_WAITING);
+        }
+    }
+
+    void on_request_done(bus_state* bus)
+    {
+        transaction* t = bus->active;
+        if (t == NULL || bus->is_resetting || t->state != TRANSACTION_READING) {
+            return;
+        }
+        if ((size_t)bus->wire->available() < t->length) {
+            finish_active(bus, TRANSACTION_FAILED, I2C_BUF_OVF);
+            return;
+        }
+        bus->wire->read(t->data, t->length);
+        finish_active(bus, TRANSACTION_DONE, I2C_WAITING);
+    }
+
+    void on_error(bus_state* bus)
+    {
+        if (bus->active == NULL || bus->is_resetting) {
+            return;
+        }
+        finish_active(bus, TRANSACTION_FAILED, bus->wire->status());
+    }
+
+    void bus_1_transmit_done() { on_transmit_done(&buses[BUS_1]); }
+    void bus_1_request_done() { on_request_done(&buses[BUS_1]); }
+    void bus_1_error() { on_error(&buses[BUS_1]); }
+    void bus_2_transmit_done() { on_transmit_done(&buses[BUS_2]); }
+    void bus_2_request_done() { on_request_done(&buses[BUS_2]); }
+    void bus_2_error() { on_error(&buses[BUS_2]); }
+
+    void init_bus(bus_state* bus, i2c_t3* wire)
+    {
+        bus->wire = wire;
+        bus->queue_head = bus->queue_tail = 0;
+        bus->finished_head = bus->finished_tail = 0;
+        bus->pending = 0;
+        bus->active = NULL;
+        bus->is_resetting = false;
+        bus->lock_count = 0;
+        bus->errors = 0;
+        bus->timeouts = 0;
+    }
+
     void setup_i2c()
     {
+        init_bus(&buses[BUS_1], &I2C_BUS_1);
+        init_bus(&buses[BUS_2], &I2C_BUS_2);
+
         I2C_BUS_1.begin(I2C_MASTER, 0x00, I2C_PINS_18_19, I2C_PULLUP_EXT, 400000);
-        I2C_BUS_1.setDefaultTimeout(200000); // 200ms
+        I2C_BUS_1.setDefaultTimeout(I2C_BLOCKING_TIMEOUT_US);
+        I2C_BUS_1.onTransmitDone(bus_1_transmit_done);
+        I2C_BUS_1.onReqFromDone(bus_1_request_done);
+        I2C_BUS_1.onError(bus_1_error);
+
         I2C_BUS_2.begin(I2C_MASTER, 0x00, I2C_PINS_37_38, I2C_PULLUP_EXT, 400000);
-        I2C_BUS_2.setDefaultTimeout(200000); // 200ms
-        rover6_serial::println_info("I2C initialized.");
+        I2C_BUS_2.setDefaultTimeout(I2C_BLOCKING_TIMEOUT_US);
+        I2C_BUS_2.onTransmitDone(bus_2_transmit_done);
+        I2C_BUS_2.onReqFromDone(bus_2_request_done);
+        I2C_BUS_2.onError(bus_2_error);
+        LOG_INFO("I2C initialized.");
+    }
+
+    void init_read(transaction* t, uint8_t address, uint8_t reg, uint8_t* data, size_t length, transaction_callback callback)
+    {
+        t->address = address;
+        t->reg = reg;
+        t->data = data;
+        t->length = length;
+        t->is_read = true;
+        t->callback = callback;
+        t->state = TRANSACTION_IDLE;
+    }
+
+    void init_write(transaction* t, uint8_t address, uint8_t reg, uint8_t* data, size_t length, transaction_callback callback)
+    {
+        init_read(t, address, reg, data, length, callback);
+        t->is_read = false;
+    }
+
+    bool is_pending(transaction* t) {
+        return t->state != TRANSACTION_IDLE;
+    }
+
+    // How many more transactions submit will take. Drivers that submit a group check this first
+    size_t queue_space(BUSES bus_index) {
+        return I2C_QUEUE_LEN - buses[bus_index].pending;
+    }
+
+    // Returns false if the transaction is still pending or the queue is full
+    bool submit(BUSES bus_index, transaction* t)
+    {
+        bus_state* bus = &buses[bus_index];
+        if (is_pending(t) || bus->pending >= I2C_QUEUE_LEN) {
+            return false;
+        }
+        bus->pending++;
+        t->state = TRANSACTION_QUEUED;
+        noInterrupts();
+        bus->queue[bus->queue_tail] = t;
+        bus->queue_tail = (bus->queue_tail + 1) % I2C_QUEUE_LEN;
+        start_next(bus);
+        interrupts();
+        return true;
+    }
+
+    // A device that holds the bus forever would stop every transaction behind it.
+    // resetBus() clocks SCL by hand with delays, so it runs with interrupts on (the control timer
+    // keeps running). The transaction is detached first and the bus isn't re-armed until the reset
+    // is done, so a late callback from the stuck transfer can't finish the next transaction
+    void check_timeout(bus_state* bus)
+    {
+        noInterrupts();
+        transaction* t = bus->active;
+        if (t == NULL || micros() - t->start_time_us <= I2C_TRANSACTION_TIMEOUT_US) {
+            interrupts();
+            return;
+        }
+        bus->timeouts++;
+        bus->is_resetting = true;
+        detach_active(bus, TRANSACTION_FAILED, I2C_TIMEOUT);
+        interrupts();
+
+        bus->wire->resetBus();
+
+        noInterrupts();
+        bus->is_resetting = false;
+        start_next(bus);
+        interrupts();
+    }
+
+    // Call every loop. Runs the callbacks of finished transactions
+    void update()
+    {
+        for (size_t index = 0; index < NUM_BUSES; index++) {
+            bus_state* bus = &buses[index];
+            check_timeout(bus);
+            while (true) {
+                noInterrupts();
+                if (bus->finished_head == bus->finished_tail) {
+                    interrupts();
+                    break;
+                }
+                transaction* t = bus->finished[bus->finished_head];
+                bus->finished_head = (bus->finished_head + 1) % I2C_QUEUE_LEN;
+                interrupts();
+
+                bus->pending--;
+                bool ok = t->state == TRANSACTION_DONE;
+                if (!ok) {
+                    bus->errors++;
+                }
+                t->state = TRANSACTION_IDLE;  // the callback can submit it again
+                if (t->callback != NULL) {
+                    t->callback(t, ok);
+                }
+            }
+        }
+    }
+
+    // Holds the queue and waits for the transaction in progress, so blocking i2c_t3 calls can use the bus
+    void lock_bus(BUSES bus_index)
+    {
+        bus_state* bus = &buses[bus_index];
+        noInterrupts();
+        bus->lock_count++;
+        interrupts();
+        while (bus->active != NULL) {
+            check_timeout(bus);
+        }
+    }
+
+    void unlock_bus(BUSES bus_index)
+    {
+        bus_state* bus = &buses[bus_index];
+        noInterrupts();
+        if (bus->lock_count > 0) {
+            bus->lock_count--;
+        }
+        start_next(bus);
+        interrupts();
     }
 };  // rover6_i2c
 #endif // ROVER6_I2C
@@ -7,16 +7,27 @@
 #include "rover6_i2c.h"
 #include "rover6_serial.h"
 #include "rover6_general.h"
+#include "rover6_streams.h"
 
 
 #define INA_SAMPLERATE_DELAY_MS 1000
 #define INA_VOLTAGE_THRESHOLD 6.0
 
+// Adafruit_INA219::setCalibration_32V_2A, which begin() sets. The library keeps these private
+#define INA_CALIBRATION_VALUE 4096
+#define INA_CURRENT_DIVIDER_MA 10.0f
+#define INA_POWER_MULTIPLIER_MW 2.0f
+
 /*
  * Adafruit High-side current and voltage meter
  * INA219
+ * The library is only used for setup. Samples are queued I2C reads (see rover6_i2c.h), one per
+ * register since the INA219 doesn't auto increment. A sharp load can reset the chip, so the
+ * calibration is written before every sample like the library does.
  */
 
+#define INA_NUM_READS 4
+
 namespace rover6_ina
 {
     Adafruit_INA219 ina219;
@@ -27,46 +38,93 @@ namespace rover6_ina
     float ina219_power_mW = 0.0;
     uint32_t ina_report_timer = 0;
 
+    const uint8_t INA_READ_REGISTERS[INA_NUM_READS] = {
+        INA219_REG_SHUNTVOLTAGE, INA219_REG_BUSVOLTAGE, INA219_REG_POWER, INA219_REG_CURRENT
+    };
+    rover6_i2c::transaction ina_calibration_write;
+    rover6_i2c::transaction ina_reads[INA_NUM_READS];
+    uint8_t ina_calibration_data[2] = {INA_CALIBRATION_VALUE >> 8, INA_CALIBRATION_VALUE & 0xff};
+    uint8_t ina_read_data[INA_NUM_READS][2];
+    size_t ina_reads_left = 0;
+    bool ina_read_failed = false;
+    bool ina_has_sample = false;
+
+    int16_t ina_register_value(size_t index) {
+        return (int16_t)((ina_read_data[index][0] << 8) | ina_read_data[index][1]);
+    }
+
+    void ina_read_done(rover6_i2c::transaction* t, bool ok)
+    {
+        if (!ok) {
+            ina_read_failed = true;
+        }
+        if (--ina_reads_left > 0) {
+            return;
+        }
+        if (ina_read_failed) {
+            LOG_ERROR("INA219 read failed: %d", t->error);
+            return;
+        }
+        ina219_shuntvoltage = ina_register_value(0) * 0.01f;
+        ina219_busvoltage = (((uint16_t)ina_register_value(1) >> 3) * 4) * 0.001f;
+        ina219_power_mW = ina_register_value(2) * INA_POWER_MULTIPLIER_MW;
+        ina219_current_mA = ina_register_value(3) / INA_CURRENT_DIVIDER_MA;
+        ina219_loadvoltage = ina219_busvoltage + (ina219_shuntvoltage / 1000);
+        ina_has_sample = true;
+    }
+
 
     void setup_INA219()
     {
         ina219.begin(&I2C_BUS_1);
-        rover6_serial::println_info("INA219 initialized.");
+        rover6_i2c::init_write(&ina_calibration_write, INA219_ADDRESS, INA219_REG_CALIBRATION, ina_calibration_data, 2, NULL);
+        for (size_t index = 0; index < INA_NUM_READS; index++) {
+            rover6_i2c::init_read(&ina_reads[index], INA219_ADDRESS, INA_READ_REGISTERS[index], ina_read_data[index], 2, ina_read_done);
+        }
+        LOG_INFO("INA219 initialized.");
     }
 
     void check_voltage()
     {
         bool status = ina219_loadvoltage > INA_VOLTAGE_THRESHOLD;
         if (rover6::safety_struct.voltage_ok != status && !status) {
-            rover6_serial::println_error("INA reports battery is critically low!");
+            LOG_ERROR("INA reports battery is critically low!");
         }
         rover6::safety_struct.voltage_ok = status;
     }
 
+    // Starts a sample when it's time. Returns true once a sample has arrived
     bool read_INA219()
     {
-        if (CURRENT_TIME - ina_report_timer < INA_SAMPLERATE_DELAY_MS) {
+        if (ina_has_sample) {
+            ina_has_sample = false;
+            check_voltage();
+            return true;
+        }
+        if (ina_reads_left > 0 || CURRENT_TIME - ina_report_timer < rover6_streams::get_sample_delay_ms(rover6_streams::STREAM_INA, INA_SAMPLERATE_DELAY_MS)) {
             return false;
         }
+        if (rover6_i2c::queue_space(rover6_i2c::BUS_1) < INA_NUM_READS + 1) {
+            return false;  // try again next time
+        }
         ina_report_timer = CURRENT_TIME;
-        ina219_shuntvoltage = ina219.getShuntVoltage_mV();
-        ina219_busvoltage = ina219.getBusVoltage_V();
-        ina219_current_mA = ina219.getCurrent_mA();
-        ina219_power_mW = ina219.getPower_mW();
-        ina219_loadvoltage = ina219_busvoltage + (ina219_shuntvoltage / 1000);
-
-        check_voltage();
-
-        return true;
+        ina_read_failed = false;
+        ina_reads_left = INA_NUM_READS;
+        rover6_i2c::submit(rover6_i2c::BUS_1, &ina_calibration_write);
+        for (size_t index = 0; index < INA_NUM_READS; index++) {
+            rover6_i2c::submit(rover6_i2c::BUS_1, &ina_reads[index]);
+        }
+        return false;
     }
     void report_INA219()
     {
-        if (!rover6::rover_state.is_reporting_enabled) {
+        if (!rover6_streams::should_report(rover6_streams::STREAM_INA)) {
             return;
         }
         // rover6_serial::data->write("ina", "ufff", CURRENT_TIME, ina219_current_mA, ina219_power_mW, ina219_loadvoltage);
         // rover6_serial::info->write(rover6_serial::data->get_written_packet());
-        ROVER6_SERIAL_WRITE_BOTH("ina", "ufff", CURRENT_TIME, ina219_current_mA, ina219_power_mW, ina219_loadvoltage);
+        // default calibration: 0.1 mA current and 2 mW power LSBs. Bus voltage LSB is 4 mV
+        ROVER6_SERIAL_WRITE_BOTH("ina", "uf1f0f3", CURRENT_TIME, ina219_current_mA, ina219_power_mW, ina219_loadvoltage);
     }
 };  // namespace rover6_i2c
 
@@ -6,6 +6,7 @@
 
 #include "rover6_serial.h"
 #include "rover6_general.h"
+#include "rover6_streams.h"
 
 /*
  * IR remote receiver
@@ -38,7 +39,7 @@ namespace rover6_ir_remote
             prev_ir_value = ir_value;
             ir_value = irresults.value;
             irrecv.resume(); // Receive the next value
-            rover6_serial::println_info("IR: %d", ir_value);
+            LOG_INFO("IR: %d", ir_value);
             return true;
         }
         else {
@@ -47,7 +48,7 @@ namespace rover6_ir_remote
     }
     void report_IR()
     {
-        if (!rover6::rover_state.is_reporting_enabled) {
+        if (!rover6_streams::should_report(rover6_streams::STREAM_IR)) {
             return;
         }
         ROVER6_SERIAL_WRITE_BOTH("ir", "udd", CURRENT_TIME, ir_type, ir_value);
@@ -15,11 +15,10 @@
 
 using namespace rover6_tft;
 
-#define MENU_UPDATE_DELAY_MS 300
+#define MENU_UPDATE_DELAY_MS 300  // the menus task in main.cpp redraws at this period
 
 namespace rover6_menus
 {
-    uint32_t menu_display_timer = 0;
 
     unsigned int ROW_SIZE = 10;
     unsigned int BORDER_OFFSET_W = 3;
@@ -271,14 +270,12 @@ namespace rover6_menus
 
     void drive_rover_forward(double speed_tps)
     {
-        rover6_pid::update_setpointA(speed_tps);  // ticks per s
-        rover6_pid::update_setpointB(speed_tps);  // ticks per s
+        rover6_pid::update_setpoints(speed_tps, speed_tps);  // ticks per s
     }
 
     void rotate_rover(double speed_tps)
     {
-        rover6_pid::update_setpointA(speed_tps);  // ticks per s
-        rover6_pid::update_setpointB(-speed_tps);  // ticks per s
+        rover6_pid::update_setpoints(speed_tps, -speed_tps);  // ticks per s
     }
 
     void draw_motors_menu()
@@ -749,7 +746,7 @@ namespace rover6_menus
     void shutdown_menu_enter_event()
     {
         if (SHUTDOWN_MENU_SELECT_INDEX == 0) {
-            rover6_serial::info->write("shutdown", "s", "rover6");
+            rover6_serial::info->write_high_priority("shutdown", "s", "rover6");
         }
         DISPLAYED_MENU = MAIN_MENU;
     }
@@ -833,11 +830,6 @@ namespace rover6_menus
 
     void draw_menus()
     {
-        if (CURRENT_TIME - menu_display_timer < MENU_UPDATE_DELAY_MS) {
-            return;
-        }
-        menu_display_timer = CURRENT_TIME;
-
         if (PREV_DISPLAYED_MENU != DISPLAYED_MENU) {
             tft.fillScreen(ST7735_BLACK);
             screen_change_event();
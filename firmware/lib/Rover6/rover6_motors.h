@@ -7,6 +7,7 @@
 
 #include "rover6_general.h"
 #include "rover6_serial.h"
+#include "rover6_quadrature.h"
 
 /*
  * Adafruit dual motor driver breakout
@@ -18,15 +19,30 @@
 #define MOTORA_DR2 28
 #define MOTORB_DR1 31
 #define MOTORB_DR2 32
+#if ENCODER_BACKEND == ENCODER_BACKEND_FTM
+#define MOTORA_PWM 22  // 29 and 30 are FTM2's quadrature inputs. See rover6_quadrature.h
+#define MOTORB_PWM 23
+#else
 #define MOTORA_PWM 29
 #define MOTORB_PWM 30
+#endif
 
 #define MOTOR_COMMAND_TIMEOUT_MS 1000
 
+#define MOTOR_STOP_A 0x01
+#define MOTOR_STOP_B 0x02
+
+/*
+ * The control timer (rover6_control.h) owns the motor outputs. The main loop doesn't write them,
+ * it requests a stop and the next control sample applies it before the speed PIDs run.
+ * A stop takes effect within one control period.
+ */
+
 namespace rover6_motors
 {
-    uint32_t prev_commandA_time = 0;
-    uint32_t prev_commandB_time = 0;
+    volatile uint32_t prev_commandA_time = 0;  // written by the control timer
+    volatile uint32_t prev_commandB_time = 0;
+    volatile uint8_t stop_requests = 0;  // MOTOR_STOP_* bits
 
 
     TB6612 motorA(MOTORA_PWM, MOTORA_DR1, MOTORA_DR2);
@@ -52,7 +68,7 @@ namespace rover6_motors
         pinMode(MOTOR_STBY, OUTPUT);
         motorA.begin();
         motorB.begin();
-        rover6_serial::println_info("Motors initialized.");
+        LOG_INFO("Motors initialized.");
         set_motors_active(false);
     }
 
@@ -88,9 +104,29 @@ namespace rover6_motors
         return (speedA + speedB) >> 1 >= 0;
     }
 
+    void request_stop(uint8_t motors) {
+        stop_requests |= motors;
+    }
+
     void stop_motors() {
-        motorA.setSpeed(0);
-        motorB.setSpeed(0);
+        request_stop(MOTOR_STOP_A | MOTOR_STOP_B);
+    }
+
+    // Control timer context. Returns true if a stop was applied
+    bool apply_stop_requests()
+    {
+        uint8_t requests = stop_requests;
+        if (requests == 0) {
+            return false;
+        }
+        stop_requests = 0;
+        if (requests & MOTOR_STOP_A) {
+            motorA.setSpeed(0);
+        }
+        if (requests & MOTOR_STOP_B) {
+            motorB.setSpeed(0);
+        }
+        return true;
     }
 
 
@@ -112,12 +148,16 @@ namespace rover6_motors
     bool check_motor_timeout()
     {
         bool timedout = false;
-        if (CURRENT_TIME - prev_commandA_time > MOTOR_COMMAND_TIMEOUT_MS) {
-            motorA.setSpeed(0);
+        // read the command times first so a newer one can't end up after now
+        uint32_t commandA_time = prev_commandA_time;
+        uint32_t commandB_time = prev_commandB_time;
+        uint32_t now = CURRENT_TIME;
+        if (now - commandA_time > MOTOR_COMMAND_TIMEOUT_MS) {
+            request_stop(MOTOR_STOP_A);
             timedout = true;
         }
-        if (CURRENT_TIME - prev_commandB_time > MOTOR_COMMAND_TIMEOUT_MS) {
-            motorB.setSpeed(0);
+        if (now - commandB_time > MOTOR_COMMAND_TIMEOUT_MS) {
+            request_stop(MOTOR_STOP_B);
             timedout = true;
         }
 
@@ -8,6 +8,9 @@
 
 /*
  * Motor speed controller
+ * compute() runs in the control timer interrupt (rover6_control.h). Setpoints are handed to it
+ * through a double buffer: the main loop fills the buffer the interrupt isn't reading, then flips
+ * setpoint_index. The interrupt can't be preempted by the main loop, so it never sees half a setpoint.
  */
 //
 
@@ -30,8 +33,7 @@ namespace rover6_pid
     double* pid_Ks = new double[NUM_PID_KS];
 
     #define PID_COMMAND_TIMEOUT_MS 1000
-    #define PID_UPDATE_DELAY_MS 33  // ~30 Hz
-    uint32_t prev_pid_time = 0;
+    #define PID_GAINS_PERIOD_MS 33  // Ki and Kd are per update at this period (~30 Hz), whatever the control rate
 
     class PID {
     private:
@@ -41,6 +43,7 @@ namespace rover6_pid
         double error_sum, prev_error;
         double feedforward;
         uint32_t prev_setpoint_time;
+        double period_scale;  // control period / PID_GAINS_PERIOD_MS
 
     public:
         double Kp, Ki, Kd;
@@ -52,6 +55,7 @@ namespace rover6_pid
             error_sum(0.0), prev_error(0.0),
             feedforward(0.0),
             prev_setpoint_time(0),
+            period_scale(1.0),
             Kp(0.01), Ki(0.0), Kd(0.0)
         {
 
@@ -62,6 +66,12 @@ namespace rover6_pid
             target = _target;
             prev_setpoint_time = CURRENT_TIME;
         }
+        double get_target() {
+            return target;
+        }
+        void set_period(uint32_t period_us) {
+            period_scale = period_us / (PID_GAINS_PERIOD_MS * 1000.0);
+        }
         int limit(double value) {
             if (value > 255.0) {
                 return 255;
@@ -75,7 +85,7 @@ namespace rover6_pid
         {
             // if (target != 0.0) {
             //     if (CURRENT_TIME - prev_setpoint_time > PID_COMMAND_TIMEOUT_MS) {
-            //         rover6_serial::println_info("PID setpoint timed out");
+            //         LOG_INFO("PID setpoint timed out");
             //         set_target(0.0);
             //     }
             // }
@@ -89,12 +99,12 @@ namespace rover6_pid
                 out += Kp * error;
             }
             if (Kd != 0.0) {
-                out += Kd * (error - prev_error);
+                out += Kd * (error - prev_error) / period_scale;
                 prev_error = error;
             }
             if (Ki != 0.0) {
                 out += Ki * error_sum;
-                error_sum += error;
+                error_sum += error * period_scale;
             }
             out += feedforward;
 
@@ -105,8 +115,26 @@ namespace rover6_pid
     PID motorA_pid(min_tps, tps_to_cmd);
     PID motorB_pid(min_tps, tps_to_cmd);
 
+    struct speed_setpoints {
+        double targetA;  // ticks per s
+        double targetB;
+    };
+    speed_setpoints setpoint_buffers[2];
+    volatile uint8_t setpoint_index = 0;  // the buffer the interrupt reads
+    speed_setpoints pending_setpoints;  // main loop only
+
+    void publish_setpoints()
+    {
+        uint8_t next_index = setpoint_index ^ 1;
+        setpoint_buffers[next_index] = pending_setpoints;
+        COMPILER_BARRIER();
+        setpoint_index = next_index;
+    }
+
+    // gains are changed rarely, so they're just written with the control timer held off
     void set_Ks()
     {
+        noInterrupts();
         motorA_pid.Kp = pid_Ks[0];
         motorA_pid.Ki = pid_Ks[1];
         motorA_pid.Kd = pid_Ks[2];
@@ -115,6 +143,16 @@ namespace rover6_pid
         motorB_pid.Kd = pid_Ks[5];
         rover6_encoders::speed_smooth_kA = pid_Ks[6];  // defined in rover6_encoders.h
         rover6_encoders::speed_smooth_kB = pid_Ks[7];  // defined in rover6_encoders.h
+        rover6_encoders::update_smoothing();
+        interrupts();
+    }
+
+    void set_period(uint32_t period_us)
+    {
+        noInterrupts();
+        motorA_pid.set_period(period_us);
+        motorB_pid.set_period(period_us);
+        interrupts();
     }
 
     void setup_pid()
@@ -130,31 +168,37 @@ namespace rover6_pid
         pid_Ks[5] = motorB_pid.Kd;
     }
 
-    void update_setpointA(double new_setpoint) {
-        motorA_pid.set_target(new_setpoint);
-    }
-
-    void update_setpointB(double new_setpoint) {
-        motorB_pid.set_target(new_setpoint);
+    // Both sides go out in one publish, so the interrupt never runs a new A with an old B
+    void update_setpoints(double setpointA, double setpointB) {
+        pending_setpoints.targetA = setpointA;
+        pending_setpoints.targetB = setpointB;
+        publish_setpoints();
     }
 
+    // Control timer context. Call after rover6_encoders::sample_encoders
     void update_speed_pid()
     {
+        if (rover6_motors::apply_stop_requests()) {
+            return;  // the stop holds for this sample
+        }
         if (!rover6::rover_state.is_speed_pid_enabled) {
             return;
         }
 
-        if (CURRENT_TIME - prev_pid_time < PID_UPDATE_DELAY_MS) {
-            return;
+        speed_setpoints* setpoints = &setpoint_buffers[setpoint_index];
+        if (setpoints->targetA != motorA_pid.get_target()) {
+            motorA_pid.set_target(setpoints->targetA);
+        }
+        if (setpoints->targetB != motorB_pid.get_target()) {
+            motorB_pid.set_target(setpoints->targetB);
         }
-        prev_pid_time = CURRENT_TIME;
 
         // inputs: ff_speed (measured - setpoint), ff_setpoint (always 0)
         // output: pid_command (-255..255)
 
         rover6_motors::set_motors(
-            motorA_pid.compute(rover6_encoders::enc_speedA),
-            motorB_pid.compute(rover6_encoders::enc_speedB)
+            motorA_pid.compute(rover6_encoders::latest_sample.speedA),
+            motorB_pid.compute(rover6_encoders::latest_sample.speedB)
         );
     }
 
@@ -0,0 +1,155 @@
+#ifndef ROVER6_PROFILER
+#define ROVER6_PROFILER
+
+#include <Arduino.h>
+#include "rover6_serial.h"
+
+/*
+ * Execution time profiler
+ * Times code with the cycle counter (DWT CYCCNT, one count per CPU clock) and keeps a histogram
+ * per profile point. Bucket n counts runs of 2^n to 2^(n+1) - 1 cycles. Bucket 0 also counts 0
+ * cycles and the last bucket counts everything longer.
+ * The prof command sends one packet per point:
+ *     index | number of points | name | CPU Hz | runs | mean cycles | max cycles | bucket counts...
+ * scripts/profile-rover sends it over USB and prints the histograms.
+ *
+ * measure_interrupt_load spins on the cycle counter for a while. Any jump between two reads is
+ * time an interrupt took, so it measures how much of the CPU interrupts use (the encoder
+ * backends in rover6_quadrature.h, serial, I2C, the control timer) without instrumenting them.
+ */
+
+#define PROFILE_NUM_BUCKETS 24  // up to 2^24 cycles, 93 ms at 180 MHz
+#define PROFILE_MAX_POINTS 24
+#define LOAD_GAP_THRESHOLD_CYCLES 24  // longer than a pass of the measuring loop. Entering and leaving an interrupt alone takes about 24
+#define LOAD_MAX_DURATION_MS 500  // the main loop is stopped while measuring
+#define PROFILE_PACKET_FORMAT "uusuuuuvvvvvvvvvvvvvvvvvvvvvvvv"  // one v per bucket
+
+#define PROFILE_CYCLES()  ARM_DWT_CYCCNT
+#define CYCLES_TO_US(__CYCLES__)  ((__CYCLES__) / (F_CPU / 1000000))
+
+// Times __STATEMENT__ and records it under the point __ID__ from add_point
+#define PROFILE(__ID__, __STATEMENT__)  { uint32_t __profile_start = PROFILE_CYCLES();  __STATEMENT__;  rover6_profiler::record(__ID__, PROFILE_CYCLES() - __profile_start); }
+
+static_assert(PROFILE_NUM_BUCKETS == 24, "report_points and PROFILE_PACKET_FORMAT send 24 buckets");
+
+namespace rover6_profiler
+{
+    struct profile_point {
+        const char* name;
+        uint32_t count;
+        uint64_t total_cycles;
+        uint32_t max_cycles;
+        uint32_t buckets[PROFILE_NUM_BUCKETS];
+    };
+
+    profile_point points[PROFILE_MAX_POINTS];
+    int num_points = 0;
+
+    void setup_profiler()
+    {
+        ARM_DEMCR |= ARM_DEMCR_TRCENA;
+        ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+    }
+
+    void reset_point(profile_point* p)
+    {
+        p->count = 0;
+        p->total_cycles = 0;
+        p->max_cycles = 0;
+        for (size_t bucket = 0; bucket < PROFILE_NUM_BUCKETS; bucket++) {
+            p->buckets[bucket] = 0;
+        }
+    }
+
+    // Call at startup. Returns the ID to record under, or -1 if the table is full
+    int add_point(const char* name)
+    {
+        if (num_points >= PROFILE_MAX_POINTS) {
+            LOG_ERROR("Too many profile points. %s isn't profiled", name);
+            return -1;
+        }
+        points[num_points].name = name;
+        reset_point(&points[num_points]);
+        return num_points++;
+    }
+
+    // Safe to call from interrupts, as long as each point is only recorded from one context
+    void record(int id, uint32_t cycles)
+    {
+        if (id < 0) {
+            return;
+        }
+        profile_point* p = &points[id];
+        p->count++;
+        p->total_cycles += cycles;
+        if (cycles > p->max_cycles) {
+            p->max_cycles = cycles;
+        }
+        int bucket = cycles < 2 ? 0 : 31 - __builtin_clz(cycles);
+        if (bucket >= PROFILE_NUM_BUCKETS) {
+            bucket = PROFILE_NUM_BUCKETS - 1;
+        }
+        p->buckets[bucket]++;
+    }
+
+    void reset_points()
+    {
+        for (int index = 0; index < num_points; index++) {
+            noInterrupts();  // some points are recorded from interrupts
+            reset_point(&points[index]);
+            interrupts();
+        }
+    }
+
+    struct interrupt_load {
+        uint32_t total_cycles;
+        uint32_t stolen_cycles;
+        uint32_t interruptions;
+    };
+
+    // Blocks the main loop for duration_ms. Interrupts keep running
+    void measure_interrupt_load(uint32_t duration_ms, interrupt_load* load)
+    {
+        if (duration_ms > LOAD_MAX_DURATION_MS) {
+            duration_ms = LOAD_MAX_DURATION_MS;
+        }
+        uint32_t duration_cycles = duration_ms * (F_CPU / 1000);
+        load->stolen_cycles = 0;
+        load->interruptions = 0;
+
+        uint32_t start = PROFILE_CYCLES();
+        uint32_t prev = start;
+        uint32_t now = start;
+        while (now - start < duration_cycles) {
+            now = PROFILE_CYCLES();
+            uint32_t gap = now - prev;
+            if (gap > LOAD_GAP_THRESHOLD_CYCLES) {
+                load->stolen_cycles += gap;
+                load->interruptions++;
+            }
+            prev = now;
+        }
+        load->total_cycles = now - start;
+    }
+
+    void report_points(rover6_serial::Rover6Serial* serial_obj)
+    {
+        for (int index = 0; index < num_points; index++) {
+            profile_point p;
+            noInterrupts();
+            p = points[index];
+            interrupts();
+
+            uint32_t mean_cycles = p.count > 0 ? (uint32_t)(p.total_cycles / p.count) : 0;
+            serial_obj->write_high_priority("prof", PROFILE_PACKET_FORMAT,
+                index, num_points, p.name, F_CPU, p.count, mean_cycles, p.max_cycles,
+                p.buckets[0], p.buckets[1], p.buckets[2], p.buckets[3], p.buckets[4], p.buckets[5],
+                p.buckets[6], p.buckets[7], p.buckets[8], p.buckets[9], p.buckets[10], p.buckets[11],
+                p.buckets[12], p.buckets[13], p.buckets[14], p.buckets[15], p.buckets[16], p.buckets[17],
+                p.buckets[18], p.buckets[19], p.buckets[20], p.buckets[21], p.buckets[22], p.buckets[23]
+            );
+        }
+    }
+};  // namespace rover6_profiler
+
+#endif  // ROVER6_PROFILER
@@ -0,0 +1,106 @@
+#ifndef ROVER6_QUADRATURE
+#define ROVER6_QUADRATURE
+
+#include <Arduino.h>
+
+/*
+ * Encoder backends
+ * interrupt: the PJRC Encoder library on pins 20-23. Every edge is an interrupt, which is tens of
+ *     thousands a second at full speed
+ * ftm: the FTM1 and FTM2 timers decode the quadrature signals in hardware. No interrupts at all.
+ *     Only pins 3/4 (FTM1) and 29/30 (FTM2) can do this, so it needs rewiring:
+ *         motor A encoder A/B -> pins 3/4
+ *         motor B encoder A/B -> pins 29/30
+ *         motor A/B PWM -> pins 22/23 (FTM0, was 29/30)
+ * Build with -D ENCODER_BACKEND=ENCODER_BACKEND_FTM (pio run -e teensy36_ftm) to use the timers.
+ * Both count every edge (4 counts per encoder cycle), so positions and speeds are the same.
+ */
+
+#define ENCODER_BACKEND_INTERRUPT 0
+#define ENCODER_BACKEND_FTM 1
+
+#ifndef ENCODER_BACKEND
+#define ENCODER_BACKEND ENCODER_BACKEND_INTERRUPT
+#endif
+
+#if ENCODER_BACKEND == ENCODER_BACKEND_FTM
+#define ENCODER_BACKEND_NAME "ftm"
+#else
+#define ENCODER_BACKEND_NAME "interrupt"
+#endif
+
+#if ENCODER_BACKEND == ENCODER_BACKEND_FTM
+
+#define FTM_ENCODER_FILTER 4  // ignore pulses shorter than 4 * 4 bus clocks (0.27 us)
+
+// Quadrature decoder mode with a free running 16 bit count. The core already clocks the FTMs for PWM
+#define SETUP_FTM_QUADRATURE(__N__)  { \
+    FTM##__N__##_MODE = FTM_MODE_WPDIS; \
+    FTM##__N__##_MODE |= FTM_MODE_FTMEN; \
+    FTM##__N__##_SC = 0; \
+    FTM##__N__##_C0SC = 0; \
+    FTM##__N__##_C1SC = 0; \
+    FTM##__N__##_CNTIN = 0; \
+    FTM##__N__##_MOD = 0xffff; \
+    FTM##__N__##_CNT = 0; \
+    FTM##__N__##_FILTER = FTM_FILTER_CH0FVAL(FTM_ENCODER_FILTER) | FTM_FILTER_CH1FVAL(FTM_ENCODER_FILTER); \
+    FTM##__N__##_QDCTRL = FTM_QDCTRL_PHAFLTREN | FTM_QDCTRL_PHBFLTREN | FTM_QDCTRL_QUADEN; \
+    FTM##__N__##_SC = FTM_SC_CLKS(1); \
+}
+
+namespace rover6_quadrature
+{
+    // Same interface as the Encoder library. The hardware count is 16 bits. read() extends it
+    // to 64 bits, so it has to be called before the count moves 32768 (4.8 s at 6800 ticks/s).
+    // The control timer reads both encoders every sample. Call from one context only
+    class FtmEncoder
+    {
+    public:
+        FtmEncoder(volatile uint32_t* counter, bool reversed)
+        {
+            this->counter = counter;
+            this->reversed = reversed;
+            prev_count = 0;
+            position = 0;
+        }
+
+        int64_t read64()
+        {
+            uint16_t count = (uint16_t)*counter;
+            int16_t delta = (int16_t)(count - prev_count);
+            prev_count = count;
+            position += reversed ? -delta : delta;
+            return position;
+        }
+
+        int32_t read() {
+            return (int32_t)read64();
+        }
+
+        void write(int32_t new_position)
+        {
+            prev_count = (uint16_t)*counter;
+            position = new_position;
+        }
+
+    private:
+        volatile uint32_t* counter;
+        bool reversed;
+        uint16_t prev_count;
+        int64_t position;
+    };
+
+    void setup_ftm_encoders()
+    {
+        CORE_PIN3_CONFIG = PORT_PCR_MUX(7) | PORT_PCR_PE | PORT_PCR_PS;  // FTM1_QD_PHA
+        CORE_PIN4_CONFIG = PORT_PCR_MUX(7) | PORT_PCR_PE | PORT_PCR_PS;  // FTM1_QD_PHB
+        CORE_PIN29_CONFIG = PORT_PCR_MUX(6) | PORT_PCR_PE | PORT_PCR_PS;  // FTM2_QD_PHA
+        CORE_PIN30_CONFIG = PORT_PCR_MUX(6) | PORT_PCR_PE | PORT_PCR_PS;  // FTM2_QD_PHB
+        SETUP_FTM_QUADRATURE(1);
+        SETUP_FTM_QUADRATURE(2);
+    }
+};  // namespace rover6_quadrature
+
+#endif  // ENCODER_BACKEND == ENCODER_BACKEND_FTM
+
+#endif  // ROVER6_QUADRATURE
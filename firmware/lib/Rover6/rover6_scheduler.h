@@ -0,0 +1,190 @@
+#ifndef ROVER6_SCHEDULER
+#define ROVER6_SCHEDULER
+
+#include <Arduino.h>
+#include "rover6_serial.h"
+#include "rover6_profiler.h"
+
+/*
+ * Cooperative earliest deadline first scheduler
+ * Each task is released every period_us and has to finish before its next release.
+ * run_next() runs the released task with the earliest deadline, one task per loop() pass.
+ * Tasks can't be preempted, so a task below TASK_PRIORITY_SAFETY only starts if its expected
+ * run time fits in the time left before the next control or safety release. Control and
+ * safety tasks keep their rate and the display and telemetry tasks get the time that's left
+ * over. The expected run time is measured: the longest recent run, or the budget if that's
+ * longer. A task that never fits (a full TFT redraw is longer than most gaps between control
+ * releases) would starve, so once a task reaches its deadline it starts regardless of the
+ * slack. That delays the next control or safety release by one run, and guarantees every task
+ * at least one run per period.
+ *
+ * Run times are measured with the cycle counter and every task is a profile point (rover6_profiler.h).
+ * A run that takes longer than the task's budget is an overrun. A release that starts after
+ * its deadline is a miss. Missed releases aren't made up. The task is released again one
+ * period after it runs.
+ *
+ * A task with a period of 0 is suspended. It's never released until set_task_period gives it one.
+ */
+
+#define TASK_EXPECTED_DECAY 8  // expected run times above the budget lose 1/8 of the excess per run
+
+namespace rover6_scheduler
+{
+    enum TASK_PRIORITIES {
+        TASK_PRIORITY_CONTROL,  // motor commands and actuator updates
+        TASK_PRIORITY_SAFETY,  // sensors the obstacle, bumper and voltage checks depend on
+        TASK_PRIORITY_TELEMETRY,  // sensors and reports nothing on the rover waits on
+        TASK_PRIORITY_DISPLAY
+    };
+
+    struct task {
+        const char* name;
+        void (*function)();
+        uint32_t period_us;
+        TASK_PRIORITIES priority;
+        uint32_t budget_us;  // expected worst case run time
+
+        uint32_t release_time;  // micros() of the pending release
+        uint32_t expected_us;  // longest recent run, decays toward the budget
+        int profile_id;
+        uint32_t runs;
+        uint32_t overruns;
+        uint32_t misses;
+        uint32_t max_run_us;
+    };
+
+    task* tasks = NULL;
+    size_t num_tasks = 0;
+
+    void reset_task_stats()
+    {
+        for (size_t index = 0; index < num_tasks; index++) {
+            tasks[index].runs = 0;
+            tasks[index].overruns = 0;
+            tasks[index].misses = 0;
+            tasks[index].max_run_us = 0;
+        }
+    }
+
+    void setup_scheduler(task* task_table, size_t length)
+    {
+        tasks = task_table;
+        num_tasks = length;
+        uint32_t now = micros();
+        for (size_t index = 0; index < num_tasks; index++) {
+            tasks[index].release_time = now;
+            tasks[index].expected_us = tasks[index].budget_us;
+            tasks[index].profile_id = rover6_profiler::add_point(tasks[index].name);
+        }
+        reset_task_stats();
+    }
+
+    bool is_critical(task* t) {
+        return t->priority <= TASK_PRIORITY_SAFETY;
+    }
+
+    bool is_suspended(task* t) {
+        return t->period_us == 0;
+    }
+
+    task* find_task(const char* name)
+    {
+        for (size_t index = 0; index < num_tasks; index++) {
+            if (strcmp(tasks[index].name, name) == 0) {
+                return &tasks[index];
+            }
+        }
+        return NULL;
+    }
+
+    // 0 suspends the task. A task that was suspended is released right away
+    void set_task_period(task* t, uint32_t period_us)
+    {
+        if (is_suspended(t)) {
+            t->release_time = micros();
+        }
+        t->period_us = period_us;
+    }
+
+    // Runs at most one task. Call every loop
+    void run_next()
+    {
+        uint32_t now = micros();
+
+        // the time until the next control or safety task is released. 0 if one is waiting
+        uint32_t slack_us = UINT32_MAX;
+        for (size_t index = 0; index < num_tasks; index++) {
+            if (!is_critical(&tasks[index]) || is_suspended(&tasks[index])) {
+                continue;
+            }
+            int32_t until_release = (int32_t)(tasks[index].release_time - now);
+            uint32_t wait_us = until_release > 0 ? (uint32_t)until_release : 0;
+            if (wait_us < slack_us) {
+                slack_us = wait_us;
+            }
+        }
+
+        task* next = NULL;
+        int32_t next_deadline = 0;
+        for (size_t index = 0; index < num_tasks; index++) {
+            task* t = &tasks[index];
+            if (is_suspended(t) || (int32_t)(t->release_time - now) > 0) {
+                continue;
+            }
+            int32_t deadline = (int32_t)(t->release_time + t->period_us - now);
+            if (!is_critical(t) && t->expected_us > slack_us && deadline > 0) {
+                continue;  // waits for a gap unless it's at its deadline
+            }
+            if (next == NULL || deadline < next_deadline || (deadline == next_deadline && t->priority < next->priority)) {
+                next = t;
+                next_deadline = deadline;
+            }
+        }
+        if (next == NULL) {
+            return;
+        }
+
+        if (next_deadline < 0) {
+            next->misses++;
+        }
+        uint32_t start_time = micros();
+        uint32_t start_cycles = PROFILE_CYCLES();
+        next->function();
+        uint32_t run_cycles = PROFILE_CYCLES() - start_cycles;
+        rover6_profiler::record(next->profile_id, run_cycles);
+        uint32_t run_us = CYCLES_TO_US(run_cycles);
+
+        next->runs++;
+        if (run_us > next->budget_us) {
+            next->overruns++;
+        }
+        if (run_us > next->max_run_us) {
+            next->max_run_us = run_us;
+        }
+        // a one off long run (e.g. a blocking sensor reset) stops counting after a few dozen runs
+        next->expected_us -= (next->expected_us - next->budget_us) / TASK_EXPECTED_DECAY;
+        if (run_us > next->expected_us) {
+            next->expected_us = run_us;
+        }
+        if (next_deadline < 0) {
+            next->release_time = start_time + next->period_us;  // resync instead of running back to back
+        }
+        else {
+            next->release_time += next->period_us;
+        }
+    }
+
+    // One sched packet per task: name, priority, period, budget, runs, overruns, misses, max run time
+    void report_task_stats(rover6_serial::Rover6Serial* serial_obj)
+    {
+        for (size_t index = 0; index < num_tasks; index++) {
+            task* t = &tasks[index];
+            serial_obj->write_high_priority("sched", "suuuuuuu",
+                t->name, (uint32_t)t->priority, t->period_us, t->budget_us,
+                t->runs, t->overruns, t->misses, t->max_run_us
+            );
+        }
+    }
+};  // namespace rover6_scheduler
+
+#endif  // ROVER6_SCHEDULER
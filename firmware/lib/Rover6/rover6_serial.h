@@ -2,30 +2,58 @@
 #define ROVER6_SERIAL
 
 #include <Arduino.h>
+#include "rover6_codec.h"
 
 #define DATA_SERIAL  Serial5
 #define INFO_SERIAL  Serial
+#define DATA_BAUD_DEFAULT 115200  // the host can negotiate a faster rate. See rover6_baud.h
 #define SERIAL_MSG_BUFFER_SIZE 0xff
 char SERIAL_MSG_BUFFER[SERIAL_MSG_BUFFER_SIZE];
-#define PACKET_START_0 '\x12'
-#define PACKET_START_1 '\x34'
-#define PACKET_STOP '\n'
 
-#define CHECK_SEGMENT(__SERIAL_OBJ__)  if (!__SERIAL_OBJ__->next_segment()) {  println_error("Not enough segments supplied for #%d: %s", __SERIAL_OBJ__->get_segment_num(), packet.c_str());  return;  }
+// transmit queues are drained without blocking as the UART/USB buffers free up
+#define DATA_TX_QUEUE_SIZE 0x1000
+// The core's Serial5 buffer is only 40 bytes and the queue is only drained from loop(), so the UART
+// would go idle whenever loop() is held up. This gives the UART's interrupt enough to keep sending
+// through a menu redraw (~16 ms) at 2 Mbaud
+#define DATA_TX_UART_BUFFER_SIZE DATA_TX_QUEUE_SIZE
+uint8_t DATA_TX_UART_BUFFER[DATA_TX_UART_BUFFER_SIZE];
+#define INFO_TX_QUEUE_SIZE 0x800
+#define TX_QUEUE_HIGH_PRIORITY_RESERVE 0x200
+#define TX_DROP_REPORT_DELAY_MS 1000
+
+// received packets are acknowledged together instead of one txrx per packet
+#define ACK_PERIOD_MS 100
+
+#define CHECK_SEGMENT(__SERIAL_OBJ__)  if (!__SERIAL_OBJ__->next_segment()) {  LOG_ERROR("Not enough segments supplied for #%d: %s", __SERIAL_OBJ__->get_segment_num(), __SERIAL_OBJ__->get_category());  return COMMAND_MISSING_FIELDS;  }
+#define CATEGORY_ID(__CATEGORY__)  rover6_packet::category_id(__CATEGORY__)
 #define ROVER6_SERIAL_WRITE_BOTH(...)  rover6_serial::data->write(__VA_ARGS__);  rover6_serial::info->write(__VA_ARGS__);
 
+using namespace rover6_codec;
+
 namespace rover6_serial
 {
-    enum PRINT_BUFFER_TYPES {
-        PRINT_INFO,
-        PRINT_ERROR
+    // What a command handler did with a command. Reliable commands send it back in rack
+    enum COMMAND_STATUS {
+        COMMAND_APPLIED,
+        COMMAND_MISSING_FIELDS,  // CHECK_SEGMENT ran out of segments
+        COMMAND_UNKNOWN,
+        COMMAND_REJECTED  // a field was out of range
     };
-    class Rover6Serial {
+
+    // Packet framing and parsing live in Rover6Codec. This adds the device and the transmit queue
+    class Rover6Serial : public Rover6Codec {
     public:
 
-        Rover6Serial(void (*read_callback)(String, String)) {
-            this->read_callback = read_callback;
-            init_variables();
+        Rover6Serial(void (*read_callback)(uint32_t), size_t tx_queue_size) :
+            Rover6Codec(read_callback),
+            tx_queue(tx_queue_size, TX_QUEUE_HIGH_PRIORITY_RESERVE)
+        {
+            reported_tx_drops = 0;
+            prev_tx_drop_report = 0;
+            ack_timer = 0;
+            prev_ready_state = false;
+            tx_held = false;
+            tx_hold_bytes = 0;
         }
         virtual bool ready() {  // override
             return false;
@@ -34,284 +62,101 @@ namespace rover6_serial
             return 0;
         }
 
-        void write(String name, const char *formats, ...) {
-            va_list args;
-            va_start(args, formats);
-            if (ready()) {
-                make_packet(name, formats, args);
-                device()->print(write_packet);
-                write_packet_num++;
-            }
-            va_end(args);
-        }
-        void write(String packet) {
+        // Call every loop. Moves queued bytes to the device as its buffer frees up
+        void update() {
             if (!ready()) {
                 return;
             }
-            device()->print(packet);
+            flush_tx_queue();
+
+            if (get_tx_drops() != reported_tx_drops && millis() - prev_tx_drop_report > TX_DROP_REPORT_DELAY_MS) {
+                prev_tx_drop_report = millis();
+                write_high_priority("txq", "uuuu", millis(), tx_queue.get_dropped_low(), tx_queue.get_dropped_high(), tx_queue.get_high_water());
+                // if the report didn't fit either, don't report its own drop next time
+                reported_tx_drops = get_tx_drops();
+            }
+
+            if (millis() - ack_timer >= ACK_PERIOD_MS) {
+                ack_timer = millis();
+                send_ack();
+            }
         }
+        // Consumes only the bytes that have already arrived and returns
         void read() {
             if (!ready()) {
                 return;
             }
-            // 2 start chars
-            // at least 1 char for packet num
-            // \t + at least 1 category char
-            // 2 chars for checksum
-            // 1 new line
-            if (device()->available() > 2) {
-                char c;
-                bool start_found = false;
-                c = device()->read();
-                if (c == PACKET_START_0) {
-                    if (device()->available()) {
-                        c = device()->read();
-                        if (c == PACKET_START_1) {
-                            start_found = true;
-                        }
-                    }
-                }
-                if (start_found) {
-                    while (true) {
-                        if (device()->available()) {
-                            c = device()->read();
-                            if (c == PACKET_STOP) {
-                                break;
-                            }
-                            recv_char_buffer[recv_char_index] = c;
-                            recv_char_index++;
-                        }
-                    }
-                    recv_char_buffer[recv_char_index] = '\0';
-                    recv_char_index = 0;
-                    read_packet = String(recv_char_buffer);
-                    parse_packet();
-                }
-            }
-        }
-        bool next_segment()
-        {
-            if (read_packet_index >= read_packet.length()) {
-                current_segment_num = -1;
-                return false;
-            }
-            int separator = read_packet.indexOf('\t', read_packet_index);
-            current_segment_num++;
-            if (separator < 0) {
-                segment = read_packet.substring(read_packet_index);
-                read_packet_index = read_packet.length();
-                return true;
+            int num_available = device()->available();
+            while (num_available-- > 0) {
+                read_char(device()->read());
             }
-            else {
-                segment = read_packet.substring(read_packet_index, separator);
-                read_packet_index = separator + 1;
-                return true;
-            }
-        }
-        String get_segment() {
-            return segment;
-        }
-        int get_segment_num() {
-            return current_segment_num;
         }
 
-        void print_buffer(PRINT_BUFFER_TYPES type, bool newline, const char* message) {
-            if (!ready()) {
-                return;
-            }
-            switch (type) {
-                case PRINT_INFO:  device()->print("msg\tINFO\t"); break;
-                case PRINT_ERROR:  device()->print("msg\tERROR\t"); break;
-                default: return;
-            }
-            device()->print(message);
-            if (newline) {
-                device()->print('\n');
-            }
+        TxQueue* get_tx_queue() {
+            return &tx_queue;
+        }
+        uint32_t get_tx_drops() {
+            return tx_queue.get_dropped_low() + tx_queue.get_dropped_high();
         }
 
-        String get_written_packet() {
-            return write_packet;
+        // Sends what's queued now and holds anything queued after it, e.g. until a baud rate change
+        void hold_tx() {
+            tx_held = true;
+            tx_hold_bytes = tx_queue.get_used();
         }
 
     protected:
-        String write_packet;
-        String read_packet;
-        String read_buffer;
-        String segment;
-        unsigned int read_packet_num;
-        unsigned int write_packet_num;
-        unsigned int buffer_index;
-        unsigned int read_packet_index;
-        int current_segment_num;
+        TxQueue tx_queue;
+        uint32_t reported_tx_drops;
+        uint32_t prev_tx_drop_report;
+        uint32_t ack_timer;
         bool prev_ready_state;
-        char *recv_char_buffer;
-        size_t recv_char_index;
-
-        void init_variables() {
-            write_packet = "";
-            read_packet = "";
-            read_buffer = "";
-            segment = "";
-
-            read_packet_num = 0;
-            write_packet_num = 0;
-            buffer_index = 0;
-            read_packet_index = 0;
-            current_segment_num = -1;
-            prev_ready_state = false;
+        bool tx_held;
+        size_t tx_hold_bytes;  // left to send before holding
 
-            recv_char_buffer = new char[0x800];
-            recv_char_index = 0;
+        void enqueue(const uint8_t* data, size_t length, TX_PRIORITIES priority)
+        {
+            tx_queue.push(data, length, priority);
+            flush_tx_queue();
         }
 
-        void (*read_callback)(String, String);
-        void make_packet(String name, const char *formats, va_list args)
+        void flush_tx_queue()
         {
-            write_packet = String(PACKET_START_0) + String(PACKET_START_1);
-            write_packet += String(write_packet_num) + "\t";
-            write_packet += name;
-            while (*formats != '\0') {
-                write_packet += "\t";
-                if (*formats == 'd') {
-                    int i = va_arg(args, int32_t);
-                    write_packet += String(i);
-                }
-                else if (*formats == 'u') {
-                    uint32_t u = va_arg(args, uint32_t);
-                    write_packet += String(u);
+            // only write what the device can take without blocking
+            while (!tx_queue.is_empty()) {
+                int space = device()->availableForWrite();
+                if (space <= 0) {
+                    return;
                 }
-                else if (*formats == 's') {
-                    char *s = va_arg(args, char*);
-                    write_packet += s;
+                const uint8_t* chunk;
+                size_t length = tx_queue.peek_contiguous(&chunk);
+                if (length > (size_t)space) {
+                    length = (size_t)space;
                 }
-                else if (*formats == 'f') {
-                    double f = va_arg(args, double);
-                    write_packet += String(f);
-                }
-                else {
-                    write("txrx", "dd", read_packet_num, 8);  // error 8: invalid format
+                if (tx_held) {
+                    if (tx_hold_bytes == 0) {
+                        return;
+                    }
+                    if (length > tx_hold_bytes) {
+                        length = tx_hold_bytes;
+                    }
+                    tx_hold_bytes -= length;
                 }
-                ++formats;
-            }
-            // println_info("*packet: %s", *packet.c_str());
-
-            uint8_t calc_checksum = 0;
-            unsigned int length = write_packet.length();
-            for (size_t index = 2; index < length; index++) {
-                calc_checksum += (uint16_t)write_packet.charAt(index);
-            }
-
-            if (calc_checksum < 0x10) {
-                write_packet += "0";
-            }
-            write_packet += String(calc_checksum, HEX);
-            write_packet += String(PACKET_STOP);
-        }
-
-        /*char get_char() {
-            char c = read_packet.charAt(read_packet_index);
-            read_packet_index++;
-            return c;
-        }
-
-        bool readline()
-        {
-            if (read_buffer.length() == 0) {
-                return false;
-            }
-            int stop_index = read_buffer.indexOf('\n');
-            if (stop_index == -1) {  // packet isn't ready. Come back later
-                return false;
-            }
-            read_packet = read_buffer.substring(0, stop_index);
-            read_packet_index = 0;
-            read_buffer.remove(0, stop_index + 1);
-            return true;
-        }*/
-
-        void parse_packet()
-        {
-            // read_packet assumes PACKET_START_0, PACKET_START_1, and PACKET_STOP have been removed
-
-            /*char c1 = get_char();
-            if (c1 != PACKET_START_0) {
-                write("txrx", "dd", read_packet_num, 1);  // error 1: c1 != \x12
-                return;
+                device()->write(chunk, length);
+                tx_queue.pop(length);
             }
-            char c2 = get_char();
-            if (c2 != PACKET_START_1) {
-                write("txrx", "dd", read_packet_num, 2);  // error 2: c2 != \x34
-                return;
-            }
-
-            read_packet.remove(0, 2);*/  // remove start characters
-
-            read_packet_index = 0;
-            // at least 1 char for packet num
-            // \t + at least 1 category char
-            // 2 chars for checksum
-            if (read_packet.length() < 5) {
-                write("txrx", "dd", read_packet_num, 3);  // error 3: packet is too short
-                read_packet_num++;
-                return;
-            }
-
-            // Calculate checksum
-            uint8_t calc_checksum = 0;
-            // compute checksum using all characters except the checksum itself
-            for (size_t index = 0; index < read_packet.length() - 2; index++) {
-                calc_checksum += (uint8_t)read_packet.charAt(index);
-            }
-
-            // extract checksum from packet
-            uint8_t recv_checksum = strtol(read_packet.substring(read_packet.length() - 2).c_str(), NULL, 16);
-
-            if (calc_checksum != recv_checksum) {
-                // checksum failed
-                write("txrx", "dd", read_packet_num, 4);  // error 4: checksums don't match
-                read_packet_num++;
-                return;
-            }
-
-            if (!next_segment()) {
-                // failed to find packet num segment
-                write("txrx", "dd", read_packet_num, 5);  // error 5: packet count segment not found
-                read_packet_num++;
-                return;
-            }
-
-            uint32_t recv_packet_num = segment.toInt();
-            if (recv_packet_num != read_packet_num) {
-                // this is considered a warning since it isn't critical for packet
-                // numbers to be in sync
-                write("txrx", "dd", read_packet_num, 6);  // error 6: packet counts not synchronized
-                read_packet_num = recv_packet_num;
-            }
-
-            // find category segment
-            if (!next_segment()) {
-                write("txrx", "dd", read_packet_num, 7);  // error 7: failed to find category segment
-                read_packet_num++;
-                return;
-            }
-            String category = String(segment);
-
-            // remove checksum
-            read_packet.remove(read_packet.length() - 2, 2);
-            (*read_callback)(category, read_packet);
-            write("txrx", "dd", read_packet_num, 0);  // 0: no error
-            read_packet_num++;
         }
     };
 
     class Rover6HWSerial : public Rover6Serial {
     private:
         HardwareSerial* __device;
+        int tx_buffer_space;  // availableForWrite with nothing in the UART's buffer
 
     public:
-        Rover6HWSerial (HardwareSerial* device, void (*read_callback)(String, String)) : Rover6Serial(read_callback) {
+        Rover6HWSerial (HardwareSerial* device, void (*read_callback)(uint32_t), size_t tx_queue_size) : Rover6Serial(read_callback, tx_queue_size) {
             __device = device;
+            tx_buffer_space = device->availableForWrite();  // construct after begin() and before writing
         }
         Stream* device() {
             return __device;
@@ -319,6 +164,22 @@ namespace rover6_serial
         bool ready() {
             return true;  // UART is always ready
         }
+
+        // True once everything queued before hold_tx has left the UART's buffer. update() sends it
+        bool is_tx_drained() {
+            return tx_held && tx_hold_bytes == 0 && __device->availableForWrite() >= tx_buffer_space;
+        }
+
+        // Call once is_tx_drained, so nothing queued for the old rate goes out at the new one.
+        // flush() only waits for the last character to shift out. Releases the held bytes
+        void set_baud(uint32_t baud)
+        {
+            __device->flush();
+            __device->begin(baud);
+            __device->clear();
+            reset_reader();
+            tx_held = false;
+        }
     };
 
     class Rover6USBSerial : public Rover6Serial {
@@ -326,7 +187,7 @@ namespace rover6_serial
         usb_serial_class* __device;
 
     public:
-        Rover6USBSerial (usb_serial_class* device, void (*read_callback)(String, String)) : Rover6Serial(read_callback) {
+        Rover6USBSerial (usb_serial_class* device, void (*read_callback)(uint32_t), size_t tx_queue_size) : Rover6Serial(read_callback, tx_queue_size) {
             __device = device;
         }
         Stream* device() {
@@ -345,9 +206,17 @@ namespace rover6_serial
     Rover6HWSerial* data;
     Rover6USBSerial* info;
 
-    void data_packet_callback(String category, String packet);
-    void info_packet_callback(String category, String packet);
+    void data_packet_callback(uint32_t category_id);
+    void info_packet_callback(uint32_t category_id);
+
+    void write_log(rover6_log::LOG_LEVELS level, uint32_t id, const uint8_t* args, size_t length)
+    {
+        data->write_log(level, id, args, length);
+        info->write_log(level, id, args, length);
+    }
 
+    // Formats the message on the device. Use LOG_INFO and LOG_ERROR instead unless
+    // the message is for a person reading the port directly
     void println_info(const char* message, ...)
     {
         va_list args;
@@ -390,18 +259,18 @@ namespace rover6_serial
 
     void setup_serial()
     {
-        DATA_SERIAL.begin(115200);
+        DATA_SERIAL.begin(DATA_BAUD_DEFAULT);  // see https://www.pjrc.com/teensy/td_uart.html for UART info
+        DATA_SERIAL.addMemoryForWrite(DATA_TX_UART_BUFFER, DATA_TX_UART_BUFFER_SIZE);  // before data captures the buffer size
         INFO_SERIAL.begin(115200);
-        // DATA_SERIAL.begin(500000);  // see https://www.pjrc.com/teensy/td_uart.html for UART info
         // while (!INFO_SERIAL) {
         //     delay(1);
         // }
 
-        data = new Rover6HWSerial(&DATA_SERIAL, data_packet_callback);
-        info = new Rover6USBSerial(&INFO_SERIAL, info_packet_callback);
+        data = new Rover6HWSerial(&DATA_SERIAL, data_packet_callback, DATA_TX_QUEUE_SIZE);
+        info = new Rover6USBSerial(&INFO_SERIAL, info_packet_callback, INFO_TX_QUEUE_SIZE);
 
-        println_info("Rover #6");
-        println_info("Serial buses initialized.");
+        LOG_INFO("Rover #6");
+        LOG_INFO("Serial buses initialized.");
     }
 };  // namespace rover6_serial
 
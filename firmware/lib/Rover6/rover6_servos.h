@@ -30,10 +30,9 @@ namespace rover6_servos
 
     double servo_cmd_to_angle_m = 0.0;
 
-    #define SERVO_UPDATE_DELAY_MS 100
+    #define SERVO_UPDATE_DELAY_MS 100  // servos task period. Velocities are stepped once per update()
     const float vel_duty_time_period = 1.0;
     const float servo_update_delay_s = 1E-3 * SERVO_UPDATE_DELAY_MS;
-    uint32_t prev_servo_time = 0;
 
     #define FRONT_TILTER_SERVO_NUM 0
     #define BACK_TILTER_SERVO_NUM 1
@@ -103,13 +102,13 @@ namespace rover6_servos
         set_servos_active(true);
 
         servo_cmd_to_angle_m = (360.0 - 270.0) / ((double)BACK_TILTER_UP - (double)BACK_TILTER_DOWN);
-        rover6_serial::println_info("PCA9685 Servos initialized.");
+        LOG_INFO("PCA9685 Servos initialized.");
     }
 
 
     void set_servos_default()
     {
-        // rover6_serial::println_info("set_servos_default");
+        // LOG_INFO("set_servos_default");
         for (size_t i = 0; i < NUM_SERVOS; i++) {
             set_servo(i, servo_default_positions[i]);
         }
@@ -117,7 +116,7 @@ namespace rover6_servos
 
     void set_servos_current()
     {
-        // rover6_serial::println_info("set_servos_current");
+        // LOG_INFO("set_servos_current");
         for (size_t i = 0; i < NUM_SERVOS; i++) {
             set_servo(i, servo_default_positions[i]);
         }
@@ -130,6 +129,7 @@ namespace rover6_servos
             return;
         }
         rover6::safety_struct.are_servos_active = active;
+        rover6_i2c::lock_bus(rover6_i2c::BUS_2);
         if (active) {  // bring servos out of active mode
             servos.wakeup();
             set_servos_current();
@@ -137,6 +137,7 @@ namespace rover6_servos
         else {  // set servos to low power
             servos.sleep();
         }
+        rover6_i2c::unlock_bus(rover6_i2c::BUS_2);
     }
 
 
@@ -159,8 +160,10 @@ namespace rover6_servos
         if (servo_positions[n] != angle) {
             servo_positions[n] = angle;
             uint16_t pulse = (uint16_t)map(angle, 0, 180, servo_pulse_mins[n], servo_pulse_maxs[n]);
-            // rover6_serial::println_info("Servo %d: %ddeg, %d", n, angle, pulse);
+            // LOG_INFO("Servo %d: %ddeg, %d", n, angle, pulse);
+            rover6_i2c::lock_bus(rover6_i2c::BUS_2);
             servos.setPWM(n, 0, pulse);
+            rover6_i2c::unlock_bus(rover6_i2c::BUS_2);
             report_servo_pos(n);
         }
 
@@ -185,7 +188,7 @@ namespace rover6_servos
 
     int get_servo(uint8_t n) {
         if (n >= NUM_SERVOS) {
-            rover6_serial::println_error("Requested servo num %d does not exist!", n);
+            LOG_ERROR("Requested servo num %d does not exist!", n);
             return -1;
         }
         return servo_positions[n];
@@ -197,10 +200,6 @@ namespace rover6_servos
 
     void update()
     {
-        if (CURRENT_TIME - prev_servo_time < SERVO_UPDATE_DELAY_MS) {
-            return;
-        }
-
         for (size_t n = 0; n < NUM_SERVOS; n++)
         {
             if (servo_velocities[n] == 0.0) {
@@ -215,12 +214,11 @@ namespace rover6_servos
             if (mod_cycle < frac_part) {
                 vel_command++;
             }
-            // rover6_serial::println_info("vel_command, %d: %d", n, vel_command);
+            // LOG_INFO("vel_command, %d: %d", n, vel_command);
             vel_command = (int)(copysign(vel_command, servo_velocities[n]) + servo_positions[n]);
 
             _set_servo(n, vel_command);
         }
-        prev_servo_time = CURRENT_TIME;
     }
 
     void set_front_tilter(int angle) {
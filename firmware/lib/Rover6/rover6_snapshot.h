@@ -0,0 +1,130 @@
+#ifndef ROVER6_SNAPSHOT
+#define ROVER6_SNAPSHOT
+
+#include <Arduino.h>
+#include "rover6_general.h"
+#include "rover6_serial.h"
+#include "rover6_encoders.h"
+#include "rover6_bno.h"
+#include "rover6_tof.h"
+#include "rover6_streams.h"
+
+/*
+ * State snapshot
+ * Packs the latest encoder, IMU, TOF, and safety values into one timestamped packet
+ * at the state stream rate instead of separate enc, bno, lox, and safe packets.
+ * A bitmask marks which sensors were updated since the previous snapshot.
+ */
+
+#define SNAPSHOT_SAFETY_REFRESH_MS 1000  // resend safety flags at least this often even if they didn't change
+
+#define SNAPSHOT_FRESH_ENC 0x01
+#define SNAPSHOT_FRESH_BNO 0x02
+#define SNAPSHOT_FRESH_LOX 0x04
+#define SNAPSHOT_FRESH_SAFETY 0x08
+
+namespace rover6_snapshot
+{
+    bool is_snapshot_enabled = false;
+    uint32_t fresh_mask = 0;
+    uint32_t prev_safety_bits = 0;
+    uint32_t safety_report_timer = 0;
+
+    void set_snapshot_enabled(bool enabled)
+    {
+        is_snapshot_enabled = enabled;
+        fresh_mask = 0;
+        safety_report_timer = 0;
+        LOG_INFO("Snapshot reporting %s", enabled ? "enabled" : "disabled");
+    }
+
+    void mark_fresh(uint32_t field) {
+        fresh_mask |= field;
+    }
+
+    // same order as the fields in the safe packet
+    uint32_t get_safety_bits()
+    {
+        uint32_t bits = 0;
+        bits |= (uint32_t)rover6::safety_struct.is_left_bumper_trig << 0;
+        bits |= (uint32_t)rover6::safety_struct.is_right_bumper_trig << 1;
+        bits |= (uint32_t)rover6::safety_struct.is_front_tof_trig << 2;
+        bits |= (uint32_t)rover6::safety_struct.is_back_tof_trig << 3;
+        bits |= (uint32_t)rover6::safety_struct.is_front_tof_ok << 4;
+        bits |= (uint32_t)rover6::safety_struct.is_back_tof_ok << 5;
+        bits |= (uint32_t)rover6::safety_struct.are_servos_active << 6;
+        bits |= (uint32_t)rover6::safety_struct.are_motors_active << 7;
+        bits |= (uint32_t)rover6::safety_struct.voltage_ok << 8;
+        bits |= (uint32_t)rover6::rover_state.is_active << 9;
+        bits |= (uint32_t)rover6::rover_state.is_reporting_enabled << 10;
+        bits |= (uint32_t)rover6::rover_state.is_speed_pid_enabled << 11;
+        return bits;
+    }
+
+    void report_snapshot()
+    {
+        if (!is_snapshot_enabled || !rover6_streams::should_report(rover6_streams::STREAM_STATE)) {
+            return;
+        }
+
+        uint32_t safety_bits = get_safety_bits();
+        if (safety_bits != prev_safety_bits || safety_report_timer == 0 || CURRENT_TIME - safety_report_timer > SNAPSHOT_SAFETY_REFRESH_MS) {
+            prev_safety_bits = safety_bits;
+            safety_report_timer = CURRENT_TIME;
+            mark_fresh(SNAPSHOT_FRESH_SAFETY);
+        }
+        if (fresh_mask == 0) {
+            return;
+        }
+
+        // stale sections are still sent so the layout is fixed
+        if (rover6_bno::is_quaternion_enabled) {
+            rover6_serial::data->write(
+                "stateq", "uu" "ddf1f1" "f5f5f5f5f4f4f4f2f2f2d" "dddddd" "u",
+                CURRENT_TIME, fresh_mask,
+                rover6_encoders::encA_pos, rover6_encoders::encB_pos,
+                rover6_encoders::enc_speedA, rover6_encoders::enc_speedB,
+                rover6_bno::bno_fusion.quat[0],
+                rover6_bno::bno_fusion.quat[1],
+                rover6_bno::bno_fusion.quat[2],
+                rover6_bno::bno_fusion.quat[3],
+                rover6_bno::angVelocityData.gyro.x,
+                rover6_bno::angVelocityData.gyro.y,
+                rover6_bno::angVelocityData.gyro.z,
+                rover6_bno::linearAccelData.acceleration.x,
+                rover6_bno::linearAccelData.acceleration.y,
+                rover6_bno::linearAccelData.acceleration.z,
+                rover6_bno::bno_temperature,
+                rover6_tof::measure1.RangeMilliMeter, rover6_tof::measure2.RangeMilliMeter,
+                rover6_tof::measure1.RangeStatus, rover6_tof::measure2.RangeStatus,
+                rover6_tof::lox1.Status, rover6_tof::lox2.Status,
+                safety_bits
+            );
+            fresh_mask = 0;
+            return;
+        }
+        rover6_serial::data->write(
+            "state", "uu" "ddf1f1" "f4f4f4f4f4f4f2f2f2d" "dddddd" "u",
+            CURRENT_TIME, fresh_mask,
+            rover6_encoders::encA_pos, rover6_encoders::encB_pos,
+            rover6_encoders::enc_speedA, rover6_encoders::enc_speedB,
+            rover6_bno::orientationData.orientation.x,
+            rover6_bno::orientationData.orientation.y,
+            rover6_bno::orientationData.orientation.z,
+            rover6_bno::angVelocityData.gyro.x,
+            rover6_bno::angVelocityData.gyro.y,
+            rover6_bno::angVelocityData.gyro.z,
+            rover6_bno::linearAccelData.acceleration.x,
+            rover6_bno::linearAccelData.acceleration.y,
+            rover6_bno::linearAccelData.acceleration.z,
+            rover6_bno::bno_temperature,
+            rover6_tof::measure1.RangeMilliMeter, rover6_tof::measure2.RangeMilliMeter,
+            rover6_tof::measure1.RangeStatus, rover6_tof::measure2.RangeStatus,
+            rover6_tof::lox1.Status, rover6_tof::lox2.Status,
+            safety_bits
+        );
+        fresh_mask = 0;
+    }
+};  // namespace rover6_snapshot
+
+#endif  // ROVER6_SNAPSHOT
@@ -0,0 +1,135 @@
+#ifndef ROVER6_STREAMS
+#define ROVER6_STREAMS
+
+#include <Arduino.h>
+#include "rover6_general.h"
+#include "rover6_serial.h"
+#include "rover6_baud.h"
+
+/*
+ * Telemetry stream rates
+ * The host subscribes to each stream at a rate in Hz (0 == off) with sub <name> <rate>.
+ * Sensors that feed the safety checks keep sampling at their default rate when a stream is off.
+ */
+
+#define LINK_BUDGET_PERCENT 70  // leave room for acknowledgements and messages
+
+namespace rover6_streams
+{
+    enum STREAM_IDS {
+        STREAM_ENC,
+        STREAM_BNO,
+        STREAM_INA,
+        STREAM_FSR,
+        STREAM_IR,
+        STREAM_LOX,
+        STREAM_STATE,
+        STREAM_CTL,
+        NUM_STREAMS
+    };
+
+    enum SUBSCRIBE_STATUS {
+        SUBSCRIBE_OK,
+        SUBSCRIBE_UNKNOWN_STREAM,
+        SUBSCRIBE_OVER_BUDGET
+    };
+
+    struct stream {
+        const char* name;
+        uint16_t rate_hz;
+        uint16_t max_rate_hz;
+        uint16_t packet_len;  // worst case ASCII packet length in bytes
+        uint32_t report_timer;
+    };
+
+    stream streams[NUM_STREAMS] = {
+        {"enc", 30, 200, 56, 0},
+        {"bno", 10, 100, 132, 0},
+        {"ina", 1, 50, 48, 0},
+        {"fsr", 0, 100, 32, 0},
+        {"ir", 10, 10, 32, 0},
+        {"lox", 0, 33, 48, 0},
+        {"state", 30, 200, 252, 0},
+        {"ctl", 1, 10, 96, 0},
+    };
+
+    int find_stream(const char* name)
+    {
+        for (int index = 0; index < NUM_STREAMS; index++) {
+            if (strcmp(streams[index].name, name) == 0) {
+                return index;
+            }
+        }
+        return -1;
+    }
+
+    // Call in a stream's report function. Limits reports to the subscribed rate
+    bool should_report(STREAM_IDS id)
+    {
+        stream* s = &streams[id];
+        if (!rover6::rover_state.is_reporting_enabled || s->rate_hz == 0) {
+            return false;
+        }
+        if (CURRENT_TIME - s->report_timer < 1000 / s->rate_hz) {
+            return false;
+        }
+        s->report_timer = CURRENT_TIME;
+        return true;
+    }
+
+    // Samples faster than default_delay_ms if the stream is subscribed above that rate
+    uint32_t get_sample_delay_ms(STREAM_IDS id, uint32_t default_delay_ms)
+    {
+        uint16_t rate_hz = streams[id].rate_hz;
+        if (rate_hz == 0 || 1000 / rate_hz >= default_delay_ms) {
+            return default_delay_ms;
+        }
+        return 1000 / rate_hz;
+    }
+
+    // Bytes per second used by the enabled streams. The snapshot replaces enc and bno
+    uint32_t get_link_load(bool snapshot_enabled)
+    {
+        uint32_t load = 0;
+        for (int index = 0; index < NUM_STREAMS; index++) {
+            if (snapshot_enabled && (index == STREAM_ENC || index == STREAM_BNO)) {
+                continue;
+            }
+            if (!snapshot_enabled && index == STREAM_STATE) {
+                continue;
+            }
+            load += (uint32_t)streams[index].rate_hz * streams[index].packet_len;
+        }
+        return load;
+    }
+
+    uint32_t get_link_budget() {
+        return rover6_baud::current_baud / 10 * LINK_BUDGET_PERCENT / 100;  // 10 bits per byte with start and stop bits
+    }
+
+    SUBSCRIBE_STATUS subscribe(const char* name, uint32_t rate_hz, bool snapshot_enabled)
+    {
+        int index = find_stream(name);
+        if (index < 0) {
+            return SUBSCRIBE_UNKNOWN_STREAM;
+        }
+        if (rate_hz > streams[index].max_rate_hz) {
+            rate_hz = streams[index].max_rate_hz;
+        }
+        uint16_t prev_rate_hz = streams[index].rate_hz;
+        streams[index].rate_hz = (uint16_t)rate_hz;
+        if (get_link_load(snapshot_enabled) > get_link_budget()) {
+            streams[index].rate_hz = prev_rate_hz;
+            return SUBSCRIBE_OVER_BUDGET;
+        }
+        return SUBSCRIBE_OK;
+    }
+
+    uint16_t get_rate(const char* name)
+    {
+        int index = find_stream(name);
+        return index < 0 ? 0 : streams[index].rate_hz;
+    }
+};  // namespace rover6_streams
+
+#endif  // ROVER6_STREAMS
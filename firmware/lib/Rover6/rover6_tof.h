@@ -6,6 +6,7 @@
 #include "rover6_i2c.h"
 #include "rover6_serial.h"
 #include "rover6_general.h"
+#include "rover6_streams.h"
 #include "rover6_motors.h"
 
 /*
@@ -57,21 +58,23 @@ namespace rover6_tof
     {
         if (Status == VL53L0X_ERROR_NONE) return;
         VL53L0X_get_pal_error_string(Status, tof_status_string);
-        rover6_serial::println_error("lox1 Error: %d, %s", Status, tof_status_string);
+        LOG_ERROR("lox1 Error: %d, %s", Status, tof_status_string);
     }
 
     void print_lox2_error(VL53L0X_Error Status)
     {
         if (Status == VL53L0X_ERROR_NONE) return;
         VL53L0X_get_pal_error_string(Status, tof_status_string);
-        rover6_serial::println_error("lox2 Error: %d, %s", Status, tof_status_string);
+        LOG_ERROR("lox2 Error: %d, %s", Status, tof_status_string);
     }
 
     bool read_front_VL53L0X() {
         // lox1.rangingTest(&measure1, false); // pass in 'true' to get debug data printout!
         // return true;
 
+        rover6_i2c::lock_bus(rover6_i2c::BUS_1);
         lox1.getContinuousRangingMeasurement(&measure1, &lox1_measurement_ready);
+        rover6_i2c::unlock_bus(rover6_i2c::BUS_1);
         return lox1_measurement_ready > 0;
     }
 
@@ -79,7 +82,9 @@ namespace rover6_tof
         // lox2.rangingTest(&measure2, false);
         // return true;
 
+        rover6_i2c::lock_bus(rover6_i2c::BUS_1);
         lox2.getContinuousRangingMeasurement(&measure2, &lox2_measurement_ready);
+        rover6_i2c::unlock_bus(rover6_i2c::BUS_1);
         return lox2_measurement_ready > 0;
     }
 
@@ -101,6 +106,7 @@ namespace rover6_tof
         }
 
         is_lox_active = active;
+        rover6_i2c::lock_bus(rover6_i2c::BUS_1);
         if (active) {
             lox1.startContinuousMeasurement();
             lox2.startContinuousMeasurement();
@@ -109,6 +115,7 @@ namespace rover6_tof
             lox1.stopContinuousMeasurement();
             lox2.stopContinuousMeasurement();
         }
+        rover6_i2c::unlock_bus(rover6_i2c::BUS_1);
     }
 
     void setup_VL53L0X()
@@ -116,14 +123,14 @@ namespace rover6_tof
         pinMode(SHT_LOX1, OUTPUT);
         pinMode(SHT_LOX2, OUTPUT);
 
-        rover6_serial::println_info("Shutdown pins inited...");
+        LOG_INFO("Shutdown pins inited...");
 
         // all reset
         digitalWrite(SHT_LOX1, LOW);
         digitalWrite(SHT_LOX2, LOW);
-        rover6_serial::println_info("Both in reset mode...(pins are low)");
+        LOG_INFO("Both in reset mode...(pins are low)");
         delay(10);
-        rover6_serial::println_info("Starting...");
+        LOG_INFO("Starting...");
 
         // all unreset
         digitalWrite(SHT_LOX1, HIGH);
@@ -136,7 +143,7 @@ namespace rover6_tof
 
         // initing LOX1
         if (!lox1.begin(LOX1_ADDRESS, false, &I2C_BUS_1)) {
-            rover6_serial::println_error("Failed to boot first VL53L0X");
+            LOG_ERROR("Failed to boot first VL53L0X");
         }
         delay(10);
 
@@ -146,9 +153,9 @@ namespace rover6_tof
 
         //initing LOX2
         if (!lox2.begin(LOX2_ADDRESS, false, &I2C_BUS_1)) {
-            rover6_serial::println_error("Failed to boot second VL53L0X");
+            LOG_ERROR("Failed to boot second VL53L0X");
         }
-        rover6_serial::println_info("VL53L0X's initialized.");
+        LOG_INFO("VL53L0X's initialized.");
 
         set_lox_active(true);
 
@@ -160,7 +167,7 @@ namespace rover6_tof
 
     void report_VL53L0X()
     {
-        if (!rover6::rover_state.is_reporting_enabled) {
+        if (!rover6_streams::should_report(rover6_streams::STREAM_LOX)) {
             return;
         }
         rover6_serial::data->write("lox", "udddddd", CURRENT_TIME,
@@ -0,0 +1,88 @@
+#ifndef ROVER6_COBS
+#define ROVER6_COBS
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Binary packet framing
+ * Consistent Overhead Byte Stuffing (COBS) + CRC-16/CCITT-FALSE
+ */
+
+#define COBS_DELIMITER 0x00
+
+// worst case encoded size of a COBS frame, not including the delimiter
+#define COBS_ENCODED_MAX_LEN(__LEN__)  ((__LEN__) + (__LEN__) / 254 + 1)
+
+namespace rover6_cobs
+{
+    // Encodes length bytes from src into dst. dst must hold COBS_ENCODED_MAX_LEN(length) bytes.
+    // Returns the encoded length. The delimiter is not appended.
+    size_t cobs_encode(const uint8_t* src, size_t length, uint8_t* dst)
+    {
+        size_t read_index = 0;
+        size_t write_index = 1;
+        size_t code_index = 0;
+        uint8_t code = 1;
+
+        while (read_index < length) {
+            if (src[read_index] == COBS_DELIMITER) {
+                dst[code_index] = code;
+                code = 1;
+                code_index = write_index++;
+                read_index++;
+            }
+            else {
+                dst[write_index++] = src[read_index++];
+                code++;
+                if (code == 0xff) {
+                    dst[code_index] = code;
+                    code = 1;
+                    code_index = write_index++;
+                }
+            }
+        }
+        dst[code_index] = code;
+        return write_index;
+    }
+
+    // Decodes length bytes (delimiter removed) from src into dst. dst must hold length bytes.
+    // Returns the decoded length or 0 if the frame is malformed.
+    size_t cobs_decode(const uint8_t* src, size_t length, uint8_t* dst)
+    {
+        size_t read_index = 0;
+        size_t write_index = 0;
+
+        while (read_index < length) {
+            uint8_t code = src[read_index];
+            if (code == COBS_DELIMITER || read_index + code > length) {
+                return 0;
+            }
+            read_index++;
+            for (uint8_t index = 1; index < code; index++) {
+                if (src[read_index] == COBS_DELIMITER) {
+                    return 0;
+                }
+                dst[write_index++] = src[read_index++];
+            }
+            if (code != 0xff && read_index != length) {
+                dst[write_index++] = COBS_DELIMITER;
+            }
+        }
+        return write_index;
+    }
+
+    // CRC-16/CCITT-FALSE (poly 0x1021, init 0xffff), computed without a lookup table
+    uint16_t crc16(const uint8_t* data, size_t length)
+    {
+        uint16_t crc = 0xffff;
+        for (size_t index = 0; index < length; index++) {
+            uint8_t x = (crc >> 8) ^ data[index];
+            x ^= x >> 4;
+            crc = (crc << 8) ^ ((uint16_t)x << 12) ^ ((uint16_t)x << 5) ^ (uint16_t)x;
+        }
+        return crc;
+    }
+};  // namespace rover6_cobs
+
+#endif  // ROVER6_COBS
@@ -0,0 +1,527 @@
+#ifndef ROVER6_CODEC
+#define ROVER6_CODEC
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rover6_cobs.h"
+#include "rover6_packet.h"
+#include "rover6_tx_queue.h"
+#include "rover6_log.h"
+
+/*
+ * Packet codec without the serial device
+ * Receive framing, checksums and in-place segment parsing, plus ASCII and binary packet
+ * formatting, acknowledgements and reliable command state. Rover6Serial (rover6_serial.h)
+ * feeds it bytes from a Stream and drains its output through a TxQueue. Nothing here
+ * depends on Arduino, so the native PlatformIO env builds it for benchmark/packet_benchmark.cpp
+ */
+
+#define WRITE_PACKET_MAX_LEN 0x200
+#define READ_PACKET_MAX_LEN 0x800
+
+// binary packet layout before COBS encoding:
+// packet num (u32) | name length (u8) | name | payload (little-endian) | CRC16 (u16)
+#define BINARY_PACKET_MAX_LEN 0x180
+#define BINARY_COBS_MAX_LEN (COBS_ENCODED_MAX_LEN(BINARY_PACKET_MAX_LEN) + 1)
+
+using namespace rover6_tx_queue;
+
+namespace rover6_codec
+{
+    enum PRINT_BUFFER_TYPES {
+        PRINT_INFO,
+        PRINT_ERROR
+    };
+    enum READ_STATES {
+        READ_WAIT_START_0,
+        READ_WAIT_START_1,
+        READ_PACKET_BODY
+    };
+    class Rover6Codec {
+    public:
+
+        Rover6Codec(void (*read_callback)(uint32_t)) :
+            writer(write_packet, WRITE_PACKET_MAX_LEN - 1)
+        {
+            this->read_callback = read_callback;
+            init_variables();
+        }
+        virtual ~Rover6Codec() {}
+        virtual bool ready() {  // override
+            return true;
+        }
+
+        // Periodic telemetry. Dropped first if the transmit queue fills up
+        void write(const char* name, const char *formats, ...) {
+            va_list args;
+            va_start(args, formats);
+            vwrite(TX_PRIORITY_LOW, name, formats, args);
+            va_end(args);
+        }
+        // Acknowledgements, messages, and replies to commands
+        void write_high_priority(const char* name, const char *formats, ...) {
+            va_list args;
+            va_start(args, formats);
+            vwrite(TX_PRIORITY_HIGH, name, formats, args);
+            va_end(args);
+        }
+        // Tokenized log message. args are already encoded by rover6_log::LogArgs
+        void write_log(rover6_log::LOG_LEVELS level, uint32_t id, const uint8_t* args, size_t length)
+        {
+            if (!ready()) {
+                return;
+            }
+            bool success;
+            uint8_t level_byte = (uint8_t)level;
+            if (binary_mode) {
+                binary_packet_len = 0;
+                uint32_t packet_num = write_packet_num;
+                success = append_binary(&packet_num, 4) && append_binary_string("log") &&
+                    append_binary(&level_byte, 1) && append_binary(&id, 4) && append_binary(args, length);
+                if (success) {
+                    finish_binary_packet();
+                    enqueue(cobs_packet, cobs_packet_len, TX_PRIORITY_HIGH);
+                }
+            }
+            else {
+                // arguments are sent as one hex field so the host decodes both modes the same way
+                writer.begin_packet(write_packet_num, "log");
+                writer.append_char('\t');
+                writer.append_uint(level_byte);
+                writer.append_char('\t');
+                writer.append_uint(id);
+                writer.append_char('\t');
+                for (size_t index = 0; index < length; index++) {
+                    writer.append_hex_byte(args[index]);
+                }
+                success = writer.finish_packet();
+                if (success) {
+                    enqueue((const uint8_t*)write_packet, writer.get_length(), TX_PRIORITY_HIGH);
+                }
+            }
+            write_packet_num++;
+        }
+        void write(const char* packet) {
+            if (!ready()) {
+                return;
+            }
+            enqueue((const uint8_t*)packet, strlen(packet), TX_PRIORITY_HIGH);
+        }
+        // Cumulative acknowledgement of the packets received since the last one:
+        // first packet num, last packet num, packets processed, packets with errors.
+        // Packet numbers in the range that aren't counted never arrived.
+        // Errors are also sent right away as txrx packets with the packet num and error code
+        void send_ack()
+        {
+            if (ack_ok_count == 0 && ack_error_count == 0) {
+                return;
+            }
+            write_high_priority("ack", "uuuu", ack_first_num, ack_last_num, ack_ok_count, ack_error_count);
+            ack_ok_count = 0;
+            ack_error_count = 0;
+        }
+        // Feed received bytes one at a time. read_callback is called from here for each complete packet.
+        // Partial packets are kept in recv_char_buffer until the next call.
+        void read_char(char c)
+        {
+            switch (read_state) {
+                case READ_WAIT_START_0:
+                    if (c == PACKET_START_0) {
+                        read_state = READ_WAIT_START_1;
+                    }
+                    break;
+                case READ_WAIT_START_1:
+                    if (c == PACKET_START_1) {
+                        recv_char_index = 0;
+                        read_state = READ_PACKET_BODY;
+                    }
+                    else if (c != PACKET_START_0) {
+                        read_state = READ_WAIT_START_0;
+                    }
+                    break;
+                case READ_PACKET_BODY:
+                    if (c == PACKET_STOP) {
+                        recv_char_buffer[recv_char_index] = '\0';
+                        read_state = READ_WAIT_START_0;
+                        parse_packet(recv_char_index);
+                        recv_char_index = 0;
+                    }
+                    else if (recv_char_index >= READ_PACKET_MAX_LEN - 1) {
+                        // leave room for the null terminator. Drop the packet and resync on the next start chars
+                        recv_char_index = 0;
+                        read_state = READ_WAIT_START_0;
+                        report_rx_error(9);  // error 9: packet exceeds receive buffer
+                        rx_error_count++;
+                        read_packet_num++;
+                    }
+                    else {
+                        recv_char_buffer[recv_char_index++] = c;
+                    }
+                    break;
+            }
+        }
+        // Drops any partial packet and waits for the next start chars
+        void reset_reader() {
+            read_state = READ_WAIT_START_0;
+            recv_char_index = 0;
+        }
+        // Segments are split in place in recv_char_buffer. Separators are replaced with null
+        // terminators so the segment can be decoded without copying it
+        bool next_segment()
+        {
+            if (read_packet_index >= read_packet_len) {
+                current_segment_num = -1;
+                return false;
+            }
+            segment = recv_char_buffer + read_packet_index;
+            char* separator = strchr(segment, '\t');
+            current_segment_num++;
+            if (separator == NULL) {
+                read_packet_index = read_packet_len;
+            }
+            else {
+                *separator = '\0';
+                read_packet_index = separator - recv_char_buffer + 1;
+            }
+            return true;
+        }
+        // Only valid until the callback for the current packet returns
+        const char* get_segment() {
+            return segment;
+        }
+        int32_t get_segment_int() {
+            return strtol(segment, NULL, 10);
+        }
+        float get_segment_float() {
+            return strtof(segment, NULL);
+        }
+        int get_segment_num() {
+            return current_segment_num;
+        }
+        const char* get_category() {
+            return category;
+        }
+
+        void print_buffer(PRINT_BUFFER_TYPES type, bool newline, const char* message) {
+            if (!ready()) {
+                return;
+            }
+            if (binary_mode) {
+                // raw text would corrupt the COBS stream. Send the message as its own packet
+                write_high_priority("msg", "ss", type == PRINT_ERROR ? "ERROR" : "INFO", message);
+                return;
+            }
+            writer.reset();
+            switch (type) {
+                case PRINT_INFO:  writer.append_str("msg\tINFO\t"); break;
+                case PRINT_ERROR:  writer.append_str("msg\tERROR\t"); break;
+                default: return;
+            }
+            writer.append_str(message);
+            if (newline) {
+                writer.append_char('\n');
+            }
+            enqueue((const uint8_t*)write_packet, writer.get_length(), TX_PRIORITY_HIGH);
+        }
+
+        const char* get_written_packet() {
+            return write_packet;
+        }
+
+        void set_binary_mode(bool enabled) {
+            binary_mode = enabled;
+        }
+        bool is_binary_mode() {
+            return binary_mode;
+        }
+
+        // Last reliable command (rel) received on this port. See reliable_command in main.cpp
+        bool is_retransmission(uint32_t seq) {
+            return has_reliable_seq && seq == last_reliable_seq;
+        }
+        void set_reliable_status(uint32_t seq, int status) {
+            has_reliable_seq = true;
+            last_reliable_seq = seq;
+            last_reliable_status = status;
+        }
+        int get_reliable_status() {
+            return last_reliable_status;
+        }
+        void reset_reliable() {
+            has_reliable_seq = false;
+        }
+
+        // received packets and packets that failed framing or checksum checks
+        uint32_t get_rx_packet_count() {
+            return rx_packet_count;
+        }
+        uint32_t get_rx_error_count() {
+            return rx_error_count;
+        }
+
+    protected:
+        char write_packet[WRITE_PACKET_MAX_LEN];
+        rover6_packet::PacketWriter writer;
+        char* segment;
+        const char* category;
+        size_t read_packet_len;
+        unsigned int read_packet_num;
+        unsigned int write_packet_num;
+        unsigned int read_packet_index;
+        int current_segment_num;
+        READ_STATES read_state;
+        char recv_char_buffer[READ_PACKET_MAX_LEN];
+        size_t recv_char_index;
+
+        bool binary_mode;
+        uint8_t binary_packet[BINARY_PACKET_MAX_LEN];
+        size_t binary_packet_len;
+        uint8_t cobs_packet[BINARY_COBS_MAX_LEN];
+        size_t cobs_packet_len;
+
+        uint32_t rx_packet_count;
+        uint32_t rx_error_count;
+
+        uint32_t ack_first_num;
+        uint32_t ack_last_num;
+        uint32_t ack_ok_count;
+        uint32_t ack_error_count;
+
+        bool has_reliable_seq;
+        uint32_t last_reliable_seq;
+        int last_reliable_status;
+
+        // Every complete packet goes out through here, whole. Rover6Serial queues it for the device
+        virtual void enqueue(const uint8_t* data, size_t length, TX_PRIORITIES priority) = 0;
+
+        void init_variables() {
+            write_packet[0] = '\0';
+            segment = recv_char_buffer;
+            category = recv_char_buffer;
+            read_packet_len = 0;
+
+            read_packet_num = 0;
+            write_packet_num = 0;
+            read_packet_index = 0;
+            current_segment_num = -1;
+
+            read_state = READ_WAIT_START_0;
+            recv_char_index = 0;
+
+            binary_mode = false;
+            binary_packet_len = 0;
+            cobs_packet_len = 0;
+
+            rx_packet_count = 0;
+            rx_error_count = 0;
+
+            ack_first_num = 0;
+            ack_last_num = 0;
+            ack_ok_count = 0;
+            ack_error_count = 0;
+
+            has_reliable_seq = false;
+            last_reliable_seq = 0;
+            last_reliable_status = 0;
+        }
+
+        void acknowledge(uint32_t packet_num, bool is_error)
+        {
+            if (ack_ok_count == 0 && ack_error_count == 0) {
+                ack_first_num = packet_num;
+            }
+            ack_last_num = packet_num;
+            if (is_error) {
+                ack_error_count++;
+            }
+            else {
+                ack_ok_count++;
+            }
+        }
+
+        void report_rx_error(int error_code)
+        {
+            write_high_priority("txrx", "dd", read_packet_num, error_code);
+            acknowledge(read_packet_num, true);
+        }
+
+        void vwrite(TX_PRIORITIES priority, const char* name, const char *formats, va_list args)
+        {
+            if (!ready()) {
+                return;
+            }
+            bool success;
+            if (binary_mode) {
+                success = make_binary_packet(name, formats, args);
+                if (success) {
+                    enqueue(cobs_packet, cobs_packet_len, priority);
+                }
+            }
+            else {
+                success = writer.make_packet(write_packet_num, name, formats, args);
+                if (success) {
+                    write_packet[writer.get_length()] = '\0';
+                    enqueue((const uint8_t*)write_packet, writer.get_length(), priority);
+                }
+            }
+
+            // dropped packets still use up a packet number so the receiver can count them
+            write_packet_num++;
+            if (!success) {
+                write_high_priority("txrx", "dd", read_packet_num, 8);  // error 8: invalid format
+            }
+        }
+
+        void (*read_callback)(uint32_t);
+        bool append_binary(const void* data, size_t length)
+        {
+            // reserve 2 bytes for the CRC
+            if (binary_packet_len + length > BINARY_PACKET_MAX_LEN - 2) {
+                return false;
+            }
+            memcpy(binary_packet + binary_packet_len, data, length);  // Teensy is little-endian
+            binary_packet_len += length;
+            return true;
+        }
+
+        bool append_binary_string(const char* s)
+        {
+            size_t length = strlen(s);
+            if (length > 0xff) {
+                length = 0xff;
+            }
+            uint8_t length_byte = (uint8_t)length;
+            return append_binary(&length_byte, 1) && append_binary(s, length);
+        }
+
+        bool make_binary_packet(const char* name, const char *formats, va_list args)
+        {
+            binary_packet_len = 0;
+            uint32_t packet_num = write_packet_num;
+            bool ok = append_binary(&packet_num, 4) && append_binary_string(name);
+            while (ok && *formats != '\0') {
+                if (*formats == 'd') {
+                    int32_t i = va_arg(args, int32_t);
+                    ok = append_binary(&i, 4);
+                }
+                else if (*formats == 'u' || *formats == 'l') {
+                    uint32_t u = va_arg(args, uint32_t);
+                    ok = append_binary(&u, 4);
+                }
+                else if (*formats == 's') {
+                    char *s = va_arg(args, char*);
+                    ok = append_binary_string(s);
+                }
+                else if (*formats == 'f') {
+                    float f = (float)va_arg(args, double);
+                    char next = *(formats + 1);
+                    if (next >= '0' && next <= '9') {
+                        // fixed point with the given decimal places, as a zigzag varint
+                        uint8_t varint[VARINT_MAX_LEN];
+                        uint8_t decimals = rover6_packet::parse_decimals(&formats);
+                        size_t length = rover6_packet::varint_encode(rover6_packet::zigzag_encode(rover6_packet::to_fixed_point(f, decimals)), varint);
+                        ok = append_binary(varint, length);
+                    }
+                    else {
+                        ok = append_binary(&f, 4);
+                    }
+                }
+                else if (*formats == 'v') {
+                    // zigzag varint. Small deltas take 1 or 2 bytes
+                    uint8_t varint[VARINT_MAX_LEN];
+                    size_t length = rover6_packet::varint_encode(rover6_packet::zigzag_encode(va_arg(args, int32_t)), varint);
+                    ok = append_binary(varint, length);
+                }
+                else {
+                    return false;
+                }
+                ++formats;
+            }
+            if (!ok) {
+                return false;
+            }
+            finish_binary_packet();
+            return true;
+        }
+
+        // Appends the CRC (append_binary leaves room for it) and COBS encodes binary_packet into cobs_packet
+        void finish_binary_packet()
+        {
+            uint16_t crc = rover6_cobs::crc16(binary_packet, binary_packet_len);
+            binary_packet[binary_packet_len++] = crc & 0xff;
+            binary_packet[binary_packet_len++] = crc >> 8;
+
+            cobs_packet_len = rover6_cobs::cobs_encode(binary_packet, binary_packet_len, cobs_packet);
+            cobs_packet[cobs_packet_len++] = COBS_DELIMITER;
+        }
+
+        void parse_packet(size_t length)
+        {
+            // recv_char_buffer holds length chars with PACKET_START_0, PACKET_START_1, and PACKET_STOP removed
+
+            read_packet_index = 0;
+            read_packet_len = 0;
+            current_segment_num = -1;
+            rx_packet_count++;
+            // at least 1 char for packet num
+            // \t + at least 1 category char
+            // 2 chars for checksum
+            if (length < 5) {
+                report_rx_error(3);  // error 3: packet is too short
+                rx_error_count++;
+                read_packet_num++;
+                return;
+            }
+
+            // compute checksum using all characters except the checksum itself
+            uint8_t calc_checksum = rover6_packet::checksum(recv_char_buffer, length - 2);
+
+            // extract checksum from packet and remove it
+            uint8_t recv_checksum = strtol(recv_char_buffer + length - 2, NULL, 16);
+            read_packet_len = length - 2;
+            recv_char_buffer[read_packet_len] = '\0';
+
+            if (calc_checksum != recv_checksum) {
+                // checksum failed
+                report_rx_error(4);  // error 4: checksums don't match
+                rx_error_count++;
+                read_packet_num++;
+                return;
+            }
+
+            if (!next_segment()) {
+                // failed to find packet num segment
+                report_rx_error(5);  // error 5: packet count segment not found
+                rx_error_count++;
+                read_packet_num++;
+                return;
+            }
+
+            uint32_t recv_packet_num = strtoul(segment, NULL, 10);
+            if (recv_packet_num != read_packet_num) {
+                // this is considered a warning since it isn't critical for packet
+                // numbers to be in sync
+                write_high_priority("txrx", "dd", read_packet_num, 6);  // error 6: packet counts not synchronized
+                read_packet_num = recv_packet_num;
+            }
+
+            // find category segment
+            if (!next_segment()) {
+                report_rx_error(7);  // error 7: failed to find category segment
+                rx_error_count++;
+                read_packet_num++;
+                return;
+            }
+            category = segment;
+
+            (*read_callback)(rover6_packet::category_id(category));
+            acknowledge(read_packet_num, false);
+            read_packet_num++;
+        }
+    };
+};  // namespace rover6_codec
+
+#endif  // ROVER6_CODEC
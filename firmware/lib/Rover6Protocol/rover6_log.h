@@ -0,0 +1,138 @@
+#ifndef ROVER6_LOG
+#define ROVER6_LOG
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "rover6_packet.h"
+
+/*
+ * Tokenized logging
+ * LOG_INFO and LOG_ERROR take a printf style format string literal. The format string is
+ * hashed at compile time and never sent. Only its ID and the raw arguments are, in a log packet:
+ *     level (u8) | ID (u32) | arguments
+ * Integers (including bools, chars, and enums) are zigzag varints, floats are float32,
+ * strings are a u8 length followed by the characters.
+ *
+ * scripts/generate_log_table.py collects the format strings into the bridge's string table
+ * (rover6_log_table.h) and fails on ID collisions. It runs before every PlatformIO build.
+ *
+ * Build with -D ROVER6_LOG_TEXT to get the old vsnprintf text messages back, e.g. to watch the
+ * USB port with a plain serial monitor.
+ */
+
+#define LOG_ARGS_MAX_LEN 0x40
+
+namespace rover6_log
+{
+    enum LOG_LEVELS {
+        LOG_LEVEL_INFO,
+        LOG_LEVEL_ERROR
+    };
+
+    // Same FNV-1a hash as packet categories
+    constexpr uint32_t log_id(const char* format) {
+        return rover6_packet::category_id(format);
+    }
+
+    // Forces log_id to be evaluated at compile time so the format string isn't linked in
+    template <uint32_t ID>
+    struct LogId {
+        static const uint32_t value = ID;
+    };
+
+    class LogArgs {
+    public:
+        LogArgs() {
+            length = 0;
+        }
+
+        template <typename T>
+        void append(T value) {  // integer types and enums
+            append_int((int64_t)value);
+        }
+        void append(float value) {
+            append_bytes(&value, 4);
+        }
+        void append(double value) {
+            float f = (float)value;
+            append_bytes(&f, 4);
+        }
+        void append(const char* value)
+        {
+            size_t str_len = strlen(value);
+            // truncate instead of dropping the whole message
+            size_t space = length < LOG_ARGS_MAX_LEN ? LOG_ARGS_MAX_LEN - length - 1 : 0;
+            if (str_len > space) {
+                str_len = space;
+            }
+            uint8_t length_byte = (uint8_t)str_len;
+            append_bytes(&length_byte, 1);
+            append_bytes(value, str_len);
+        }
+        void append(char* value) {
+            append((const char*)value);
+        }
+
+        void append_all() {}
+
+        template <typename T, typename... Rest>
+        void append_all(T first, Rest... rest) {
+            append(first);
+            append_all(rest...);
+        }
+
+        const uint8_t* get_buffer() {
+            return buffer;
+        }
+        size_t get_length() {
+            return length;
+        }
+
+    private:
+        uint8_t buffer[LOG_ARGS_MAX_LEN];
+        size_t length;
+
+        void append_bytes(const void* data, size_t size)
+        {
+            if (length + size > LOG_ARGS_MAX_LEN) {
+                length = LOG_ARGS_MAX_LEN;  // the host reports truncated arguments
+                return;
+            }
+            memcpy(buffer + length, data, size);
+            length += size;
+        }
+
+        void append_int(int64_t value)
+        {
+            uint8_t varint[VARINT64_MAX_LEN];
+            append_bytes(varint, rover6_packet::varint_encode64(rover6_packet::zigzag_encode64(value), varint));
+        }
+    };
+};  // namespace rover6_log
+
+namespace rover6_serial
+{
+    void write_log(rover6_log::LOG_LEVELS level, uint32_t id, const uint8_t* args, size_t length);
+};
+
+namespace rover6_log
+{
+    template <typename... Args>
+    void log(LOG_LEVELS level, uint32_t id, Args... args)
+    {
+        LogArgs log_args;
+        log_args.append_all(args...);
+        rover6_serial::write_log(level, id, log_args.get_buffer(), log_args.get_length());
+    }
+};  // namespace rover6_log
+
+#ifdef ROVER6_LOG_TEXT
+#define LOG_INFO(...)  rover6_serial::println_info(__VA_ARGS__)
+#define LOG_ERROR(...)  rover6_serial::println_error(__VA_ARGS__)
+#else
+#define LOG_INFO(__FORMAT__, ...)  rover6_log::log(rover6_log::LOG_LEVEL_INFO, rover6_log::LogId<rover6_log::log_id(__FORMAT__)>::value, ##__VA_ARGS__)
+#define LOG_ERROR(__FORMAT__, ...)  rover6_log::log(rover6_log::LOG_LEVEL_ERROR, rover6_log::LogId<rover6_log::log_id(__FORMAT__)>::value, ##__VA_ARGS__)
+#endif
+
+#endif  // ROVER6_LOG
@@ -0,0 +1,263 @@
+#ifndef ROVER6_PACKET
+#define ROVER6_PACKET
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <math.h>
+
+/*
+ * ASCII packet formatting into a fixed buffer
+ * No heap allocations. Doesn't depend on Arduino so it can be benchmarked on a host machine.
+ */
+
+#define PACKET_START_0 '\x12'
+#define PACKET_START_1 '\x34'
+#define PACKET_STOP '\n'
+
+#define PACKET_FLOAT_DECIMALS 2  // for f fields without a decimal places digit. Matches Arduino's String(double)
+#define FIXED_POINT_MAX_DECIMALS 9
+#define FIXED_POINT_NAN INT32_MIN  // sent in place of NaN. Out of range values saturate to +/-INT32_MAX
+
+#define VARINT_MAX_LEN 5  // 7 bits per byte for a 32 bit value
+#define VARINT64_MAX_LEN 10
+
+namespace rover6_packet
+{
+    // FNV-1a hash of a packet category. constexpr so categories can be used as switch labels.
+    // Duplicate case values are a compile error, so hash collisions are caught at build time
+    constexpr uint32_t category_id(const char* category, uint32_t hash = 2166136261UL) {
+        return *category == '\0' ? hash : category_id(category + 1, (hash ^ (uint8_t)*category) * 16777619UL);
+    }
+
+    // Maps small signed values to small unsigned values: 0, -1, 1, -2, 2 -> 0, 1, 2, 3, 4
+    uint32_t zigzag_encode(int32_t value) {
+        return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+    }
+
+    // LEB128 varint. dst must hold VARINT_MAX_LEN bytes. Returns the encoded length
+    size_t varint_encode(uint32_t value, uint8_t* dst)
+    {
+        size_t length = 0;
+        while (value >= 0x80) {
+            dst[length++] = (uint8_t)(value | 0x80);
+            value >>= 7;
+        }
+        dst[length++] = (uint8_t)value;
+        return length;
+    }
+
+    // 64 bit versions for log arguments, which can be any integer type
+    uint64_t zigzag_encode64(int64_t value) {
+        return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+    }
+
+    size_t varint_encode64(uint64_t value, uint8_t* dst)
+    {
+        size_t length = 0;
+        while (value >= 0x80) {
+            dst[length++] = (uint8_t)(value | 0x80);
+            value >>= 7;
+        }
+        dst[length++] = (uint8_t)value;
+        return length;
+    }
+
+    // Sum of the chars between the start chars and the checksum, mod 256
+    uint8_t checksum(const char* data, size_t length)
+    {
+        uint8_t sum = 0;
+        for (size_t index = 0; index < length; index++) {
+            sum += (uint8_t)data[index];
+        }
+        return sum;
+    }
+
+    const float FIXED_POINT_SCALES[FIXED_POINT_MAX_DECIMALS + 1] = {
+        1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f
+    };
+
+    // Scales f by 10^decimals and rounds it to an integer. Single precision, since the Teensy's FPU
+    // doesn't do doubles. Exact for sensor values with up to 24 significant bits
+    int32_t to_fixed_point(float f, uint8_t decimals)
+    {
+        if (isnan(f)) {
+            return FIXED_POINT_NAN;
+        }
+        float scaled = f * FIXED_POINT_SCALES[decimals];
+        if (scaled >= 2147483647.0f) {
+            return INT32_MAX;
+        }
+        if (scaled <= -2147483647.0f) {
+            return -INT32_MAX;
+        }
+        return (int32_t)lroundf(scaled);
+    }
+
+    // f fields can be followed by a digit giving the decimal places to keep, e.g. f4 for 0.0001 resolution.
+    // Advances formats past the digit if there is one
+    uint8_t parse_decimals(const char** formats)
+    {
+        char next = *(*formats + 1);
+        if (next >= '0' && next <= '9') {
+            ++*formats;
+            return next - '0';
+        }
+        return PACKET_FLOAT_DECIMALS;
+    }
+
+    class PacketWriter {
+    public:
+        PacketWriter(char* buffer, size_t size) {
+            this->buffer = buffer;
+            this->size = size;
+            reset();
+        }
+
+        void reset() {
+            length = 0;
+            overflow = false;
+        }
+
+        size_t get_length() {
+            return length;
+        }
+
+        bool is_overflowed() {
+            return overflow;
+        }
+
+        void append_char(char c) {
+            if (length >= size) {
+                overflow = true;
+                return;
+            }
+            buffer[length++] = c;
+        }
+
+        void append_str(const char* s) {
+            while (*s != '\0') {
+                append_char(*s++);
+            }
+        }
+
+        void append_uint(uint32_t u) {
+            char digits[10];
+            uint8_t num_digits = 0;
+            do {
+                digits[num_digits++] = '0' + (u % 10);
+                u /= 10;
+            } while (u > 0);
+            while (num_digits > 0) {
+                append_char(digits[--num_digits]);
+            }
+        }
+
+        void append_int(int32_t i) {
+            if (i < 0) {
+                append_char('-');
+                append_uint((uint32_t)(-(int64_t)i));
+            }
+            else {
+                append_uint((uint32_t)i);
+            }
+        }
+
+        // Prints a value from to_fixed_point with the decimal point put back in
+        void append_fixed_point(int32_t value, uint8_t decimals)
+        {
+            if (value == FIXED_POINT_NAN) {
+                append_str("nan");
+                return;
+            }
+            uint32_t magnitude = (uint32_t)value;
+            if (value < 0) {
+                append_char('-');
+                magnitude = (uint32_t)(-(int64_t)value);
+            }
+            uint32_t scale = (uint32_t)FIXED_POINT_SCALES[decimals];
+            append_uint(magnitude / scale);
+            if (decimals > 0) {
+                append_char('.');
+                uint32_t frac = magnitude % scale;
+                for (uint32_t place = scale / 10; place > 0; place /= 10) {
+                    append_char('0' + (frac / place) % 10);
+                }
+            }
+        }
+
+        void append_hex_byte(uint8_t b) {
+            const char* hex_chars = "0123456789abcdef";
+            append_char(hex_chars[b >> 4]);
+            append_char(hex_chars[b & 0xf]);
+        }
+
+        // Appends one tab separated field per format character.
+        // Returns false if a format character isn't recognized
+        bool append_fields(const char* formats, va_list args)
+        {
+            while (*formats != '\0') {
+                append_char('\t');
+                if (*formats == 'd' || *formats == 'v') {
+                    // varints are only compact in binary mode. In ASCII they're plain integers
+                    append_int(va_arg(args, int32_t));
+                }
+                else if (*formats == 'u' || *formats == 'l') {
+                    append_uint(va_arg(args, uint32_t));
+                }
+                else if (*formats == 's') {
+                    append_str(va_arg(args, char*));
+                }
+                else if (*formats == 'f') {
+                    float f = (float)va_arg(args, double);
+                    uint8_t decimals = parse_decimals(&formats);
+                    append_fixed_point(to_fixed_point(f, decimals), decimals);
+                }
+                else {
+                    return false;
+                }
+                ++formats;
+            }
+            return true;
+        }
+
+        // Builds a complete packet: start chars, packet num, name, fields, checksum, stop char.
+        // Returns false on an invalid format or if the packet doesn't fit in the buffer
+        bool make_packet(uint32_t packet_num, const char* name, const char* formats, va_list args)
+        {
+            begin_packet(packet_num, name);
+            if (!append_fields(formats, args)) {
+                return false;
+            }
+            return finish_packet();
+        }
+
+        // For packets with fields that don't fit a format string. Append the fields in between
+        void begin_packet(uint32_t packet_num, const char* name)
+        {
+            reset();
+            append_char(PACKET_START_0);
+            append_char(PACKET_START_1);
+            append_uint(packet_num);
+            append_char('\t');
+            append_str(name);
+        }
+
+        bool finish_packet()
+        {
+            // checksum doesn't include the start characters
+            uint8_t calc_checksum = length > 2 ? checksum(buffer + 2, length - 2) : 0;
+            append_hex_byte(calc_checksum);
+            append_char(PACKET_STOP);
+            return !overflow;
+        }
+
+    private:
+        char* buffer;
+        size_t size;
+        size_t length;
+        bool overflow;
+    };
+};  // namespace rover6_packet
+
+#endif  // ROVER6_PACKET
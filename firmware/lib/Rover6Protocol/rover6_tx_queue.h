@@ -0,0 +1,115 @@
+#ifndef ROVER6_TX_QUEUE
+#define ROVER6_TX_QUEUE
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * Transmit ring buffer
+ * Packets are queued whole or not at all. Low priority packets can't use the
+ * last high_priority_reserve bytes, so periodic telemetry is dropped before
+ * acknowledgements and messages are.
+ */
+
+namespace rover6_tx_queue
+{
+    enum TX_PRIORITIES {
+        TX_PRIORITY_LOW,
+        TX_PRIORITY_HIGH
+    };
+
+    class TxQueue {
+    public:
+        TxQueue(size_t size, size_t high_priority_reserve) {
+            this->size = size;
+            this->high_priority_reserve = high_priority_reserve < size ? high_priority_reserve : 0;
+            buffer = new uint8_t[size];
+            head = 0;
+            tail = 0;
+            used = 0;
+            dropped_low = 0;
+            dropped_high = 0;
+            high_water = 0;
+        }
+
+        bool push(const uint8_t* data, size_t length, TX_PRIORITIES priority)
+        {
+            size_t limit = size;
+            if (priority == TX_PRIORITY_LOW) {
+                limit -= high_priority_reserve;
+            }
+            if (used + length > limit) {
+                if (priority == TX_PRIORITY_LOW) {
+                    dropped_low++;
+                }
+                else {
+                    dropped_high++;
+                }
+                return false;
+            }
+
+            size_t first_len = size - tail;
+            if (first_len > length) {
+                first_len = length;
+            }
+            memcpy(buffer + tail, data, first_len);
+            memcpy(buffer, data + first_len, length - first_len);
+            tail = (tail + length) % size;
+            used += length;
+            if (used > high_water) {
+                high_water = used;
+            }
+            return true;
+        }
+
+        // Points data at the oldest queued byte and returns how many bytes follow it without wrapping
+        size_t peek_contiguous(const uint8_t** data)
+        {
+            *data = buffer + head;
+            size_t length = size - head;
+            return length < used ? length : used;
+        }
+
+        void pop(size_t length)
+        {
+            if (length > used) {
+                length = used;
+            }
+            head = (head + length) % size;
+            used -= length;
+        }
+
+        bool is_empty() {
+            return used == 0;
+        }
+        size_t get_used() {
+            return used;
+        }
+        size_t get_size() {
+            return size;
+        }
+        uint32_t get_dropped_low() {
+            return dropped_low;
+        }
+        uint32_t get_dropped_high() {
+            return dropped_high;
+        }
+        size_t get_high_water() {
+            return high_water;
+        }
+
+    private:
+        uint8_t* buffer;
+        size_t size;
+        size_t high_priority_reserve;
+        size_t head;
+        size_t tail;
+        size_t used;
+        uint32_t dropped_low;
+        uint32_t dropped_high;
+        size_t high_water;
+    };
+};  // namespace rover6_tx_queue
+
+#endif  // ROVER6_TX_QUEUE
@@ -0,0 +1,125 @@
+"""
+Collects LOG_INFO and LOG_ERROR format strings from the firmware and writes the
+serial bridge's string table. The IDs are the same FNV-1a hash rover6_log.h computes
+at compile time, so the firmware itself doesn't need a generated file.
+
+Runs before every PlatformIO build (extra_scripts in platformio.ini). Can also be run directly:
+    python3 scripts/generate_log_table.py
+"""
+import os
+import re
+import sys
+
+try:
+    Import("env")  # noqa: F821, defined when run by PlatformIO
+    FIRMWARE_DIR = env.subst("$PROJECT_DIR")  # noqa: F821
+    IS_PLATFORMIO = True
+except NameError:
+    IS_PLATFORMIO = False
+    FIRMWARE_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..")
+
+SOURCE_DIRS = ["src", "lib/Rover6", "lib/Rover6Protocol"]
+TABLE_PATH = os.path.join(
+    FIRMWARE_DIR, "..", "rover6_ros", "rover6_ros", "rover6_serial_bridge",
+    "include", "rover6_serial_bridge", "rover6_log_table.h"
+)
+
+# a LOG_ macro call followed by one or more adjacent string literals
+LOG_CALL_PATTERN = re.compile(r'\bLOG_(?:INFO|ERROR)\(\s*((?:"(?:[^"\\]|\\.)*"\s*)+)')
+STRING_LITERAL_PATTERN = re.compile(r'"((?:[^"\\]|\\.)*)"')
+
+
+def fnv1a(data: bytes):
+    hash_value = 2166136261
+    for b in data:
+        hash_value = ((hash_value ^ b) * 16777619) & 0xffffffff
+    return hash_value
+
+
+def unescape(literal: str):
+    return literal.encode("latin-1").decode("unicode_escape").encode("latin-1")
+
+
+def escape(data: bytes):
+    escaped = ""
+    for b in data:
+        c = chr(b)
+        if c == "\\" or c == "\"":
+            escaped += "\\" + c
+        elif 0x20 <= b < 0x7f:
+            escaped += c
+        else:
+            escaped += "\\x%02x\"\"" % b  # break the literal so following hex digits aren't consumed
+    return escaped
+
+
+def find_formats():
+    formats = {}
+    for source_dir in SOURCE_DIRS:
+        source_dir = os.path.join(FIRMWARE_DIR, source_dir)
+        for name in sorted(os.listdir(source_dir)):
+            if not name.endswith((".h", ".cpp")):
+                continue
+            path = os.path.join(source_dir, name)
+            with open(path, encoding="latin-1") as file:
+                contents = file.read()
+            for match in LOG_CALL_PATTERN.finditer(contents):
+                literals = STRING_LITERAL_PATTERN.findall(match.group(1))
+                format_bytes = b"".join(unescape(literal) for literal in literals)
+                line_num = contents.count("\n", 0, match.start()) + 1
+                formats.setdefault(format_bytes, []).append("%s:%d" % (os.path.relpath(path, FIRMWARE_DIR), line_num))
+    return formats
+
+
+def generate():
+    formats = find_formats()
+    ids = {}
+    for format_bytes, locations in formats.items():
+        log_id = fnv1a(format_bytes)
+        if log_id in ids and ids[log_id] != format_bytes:
+            print("Log ID collision (0x%08x) between %r and %r. Reword one of them. %s" % (
+                log_id, ids[log_id], format_bytes, ", ".join(locations)
+            ))
+            return False
+        ids[log_id] = format_bytes
+
+    lines = [
+        "// Generated by firmware/scripts/generate_log_table.py. Don't edit",
+        "#ifndef ROVER6_LOG_TABLE_H",
+        "#define ROVER6_LOG_TABLE_H",
+        "",
+        "#include <stdint.h>",
+        "",
+        "struct Rover6LogTableEntry {",
+        "    uint32_t id;",
+        "    const char* format;",
+        "};",
+        "",
+        "const Rover6LogTableEntry ROVER6_LOG_TABLE[] = {",
+    ]
+    for log_id in sorted(ids.keys()):
+        lines.append("    {0x%08x, \"%s\"}," % (log_id, escape(ids[log_id])))
+    lines += [
+        "};",
+        "",
+        "#endif  // ROVER6_LOG_TABLE_H",
+        "",
+    ]
+    table = "\n".join(lines)
+
+    table_path = os.path.normpath(TABLE_PATH)
+    if os.path.isfile(table_path):
+        with open(table_path) as file:
+            if file.read() == table:
+                return True
+    with open(table_path, "w") as file:
+        file.write(table)
+    print("Wrote %d log strings to %s" % (len(ids), table_path))
+    return True
+
+
+if not generate():
+    if IS_PLATFORMIO:
+        env.Exit(1)  # noqa: F821
+    else:
+        sys.exit(1)
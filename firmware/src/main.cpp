@@ -12,6 +12,12 @@
 #include <rover6_tof.h>
 #include <rover6_menus.h>
 #include <rover6_pid.h>
+#include <rover6_snapshot.h>
+#include <rover6_baud.h>
+#include <rover6_streams.h>
+#include <rover6_scheduler.h>
+#include <rover6_control.h>
+#include <rover6_profiler.h>
 
 
 
@@ -20,7 +26,7 @@ void set_active(bool active)
     if (rover6::rover_state.is_active == active) {
         return;
     }
-    rover6_serial::println_info("Setting active to: %d", active);
+    LOG_INFO("Setting active to: %d", active);
 
     rover6::rover_state.is_active = active;
     rover6_motors::set_motors_active(active);
@@ -54,54 +60,54 @@ void rover6_ir_remote::callback_ir()
     }
 
     switch (ir_value) {
-        case 0x00ff: rover6_serial::println_info("IR: VOL-"); break;  // VOL-
+        case 0x00ff: LOG_INFO("IR: VOL-"); break;  // VOL-
         case 0x807f:
-            rover6_serial::println_info("IR: Play/Pause");
+            LOG_INFO("IR: Play/Pause");
             set_active(!rover6::rover_state.is_active);
             break;  // Play/Pause
-        case 0x40bf: rover6_serial::println_info("IR: VOL+"); break;  // VOL+
+        case 0x40bf: LOG_INFO("IR: VOL+"); break;  // VOL+
         case 0x20df:
-            rover6_serial::println_info("IR: SETUP");
+            LOG_INFO("IR: SETUP");
             rover6::soft_restart();
             break;  // SETUP
         case 0xa05f:
-            rover6_serial::println_info("IR: ^");
+            LOG_INFO("IR: ^");
             rover6_menus::up_menu_event();
             break;  // ^
-        case 0x609f: rover6_serial::println_info("IR: MODE"); break;  // MODE
+        case 0x609f: LOG_INFO("IR: MODE"); break;  // MODE
         case 0x10ef:
-            rover6_serial::println_info("IR: <");
+            LOG_INFO("IR: <");
             rover6_menus::left_menu_event();
             break;  // <
         case 0x906f:
-            rover6_serial::println_info("IR: ENTER");
+            LOG_INFO("IR: ENTER");
             rover6_menus::enter_menu_event();
             break;  // ENTER
         case 0x50af:
-            rover6_serial::println_info("IR: >");
+            LOG_INFO("IR: >");
             rover6_menus::right_menu_event();
             break;  // >
         case 0x30cf:
-            rover6_serial::println_info("IR: 0 10+");
+            LOG_INFO("IR: 0 10+");
             rover6::rover_state.is_reporting_enabled = !rover6::rover_state.is_reporting_enabled;
             break;  // 0 10+
         case 0xb04f:
-            rover6_serial::println_info("IR: v");
+            LOG_INFO("IR: v");
             rover6_menus::down_menu_event();
             break;  // v
         case 0x708f:
-            rover6_serial::println_info("IR: Del");
+            LOG_INFO("IR: Del");
             rover6_menus::back_menu_event();
             break;  // Del
-        case 0x08f7: rover6_serial::println_info("IR: 1"); break;  // 1
-        case 0x8877: rover6_serial::println_info("IR: 2"); break;  // 2
-        case 0x48B7: rover6_serial::println_info("IR: 3"); break;  // 3
-        case 0x28D7: rover6_serial::println_info("IR: 4"); break;  // 4
-        case 0xA857: rover6_serial::println_info("IR: 5"); break;  // 5
-        case 0x6897: rover6_serial::println_info("IR: 6"); break;  // 6
-        case 0x18E7: rover6_serial::println_info("IR: 7"); break;  // 7
-        case 0x9867: rover6_serial::println_info("IR: 8"); break;  // 8
-        case 0x58A7: rover6_serial::println_info("IR: 9"); break;  // 9
+        case 0x08f7: LOG_INFO("IR: 1"); break;  // 1
+        case 0x8877: LOG_INFO("IR: 2"); break;  // 2
+        case 0x48B7: LOG_INFO("IR: 3"); break;  // 3
+        case 0x28D7: LOG_INFO("IR: 4"); break;  // 4
+        case 0xA857: LOG_INFO("IR: 5"); break;  // 5
+        case 0x6897: LOG_INFO("IR: 6"); break;  // 6
+        case 0x18E7: LOG_INFO("IR: 7"); break;  // 7
+        case 0x9867: LOG_INFO("IR: 8"); break;  // 8
+        case 0x58A7: LOG_INFO("IR: 9"); break;  // 9
 
     }
     // String decode_type;
@@ -123,126 +129,354 @@ void rover6_ir_remote::callback_ir()
 }
 
 namespace rover6_serial {
-    void packet_callback(Rover6Serial* serial_obj, String category, String packet);
+    COMMAND_STATUS packet_callback(Rover6Serial* serial_obj, uint32_t category_id);
 
     // method header defined in rover6_serial.h
-    void info_packet_callback(String category, String packet) {
-        packet_callback(info, category, packet);
+    void info_packet_callback(uint32_t category_id) {
+        packet_callback(info, category_id);
     }
 
-    void data_packet_callback(String category, String packet) {
-        packet_callback(data, category, packet);
+    void data_packet_callback(uint32_t category_id) {
+        packet_callback(data, category_id);
     }
-}
 
-void rover6_serial::packet_callback(Rover6Serial* serial_obj, String category, String packet)
-{
-    // rover6_serial::println_info("category: %s, packet: '%s'", category.c_str(), packet.c_str());
-    // toggle_active
-    if (category.equals("<>")) {
+    // Command handlers. Arguments are decoded in place from the receive buffer. Each returns what
+    // it did with the command, which reliable commands send back to the host
+
+    #define CHECK_SERVO_NUM(__N__)  if ((__N__) < 0 || (__N__) >= NUM_SERVOS) {  LOG_ERROR("Invalid servo number: %d", (__N__));  return COMMAND_REJECTED;  }
+
+    COMMAND_STATUS toggle_active_command(Rover6Serial* serial_obj)
+    {
         CHECK_SEGMENT(serial_obj);
-        int active_state = serial_obj->get_segment().toInt();
-        rover6_serial::println_info("toggle_active %d", active_state);
+        int active_state = serial_obj->get_segment_int();
+        LOG_INFO("toggle_active %d", active_state);
         switch (active_state)
         {
             case 0: set_active(false); break;
             case 1: set_active(true); break;
             case 2: rover6::soft_restart(); break;
             default:
-                break;
+                LOG_ERROR("Invalid active state received: %d", active_state);
+                return COMMAND_REJECTED;
         }
+        return COMMAND_APPLIED;
     }
 
-    // get_ready
-    else if (category.equals("?")) {
+    COMMAND_STATUS get_ready_command(Rover6Serial* serial_obj)
+    {
         CHECK_SEGMENT(serial_obj);
-        if (serial_obj->get_segment().equals("rover6")) {
-            rover6_serial::println_info("Received ready signal!");
-            ROVER6_SERIAL_WRITE_BOTH("ready", "us", CURRENT_TIME, "dul");
+        if (strcmp(serial_obj->get_segment(), "rover6") == 0) {
+            serial_obj->set_binary_mode(false);  // the host always starts in ASCII mode
+            serial_obj->reset_reliable();  // a restarted host starts its sequence numbers over
+            LOG_INFO("Received ready signal!");
+            // the last field is the fastest data baud the host may negotiate
+            rover6_serial::data->write_high_priority("ready", "usu", CURRENT_TIME, "dul", rover6_baud::get_max_baud());
+            rover6_serial::info->write_high_priority("ready", "usu", CURRENT_TIME, "dul", rover6_baud::get_max_baud());
         }
         else {
-            rover6_serial::println_error("Invalid ready segment supplied: %s", serial_obj->get_segment().c_str());
+            LOG_ERROR("Invalid ready segment supplied: %s", serial_obj->get_segment());
+            return COMMAND_REJECTED;
         }
+        return COMMAND_APPLIED;
     }
 
-    // toggle_reporting
-    else if (category.equals("[]")) {
+    COMMAND_STATUS set_binary_mode_command(Rover6Serial* serial_obj)
+    {
         CHECK_SEGMENT(serial_obj);
-        int reporting_state = serial_obj->get_segment().toInt();
-        rover6_serial::println_info("toggle_reporting %d", reporting_state);
+        int binary_state = serial_obj->get_segment_int();
+        // confirm using the current encoding so the host knows when to switch
+        serial_obj->write_high_priority("bin", "d", binary_state);
+        serial_obj->set_binary_mode(binary_state == 1);
+        return COMMAND_APPLIED;
+    }
+
+    COMMAND_STATUS toggle_reporting_command(Rover6Serial* serial_obj)
+    {
+        CHECK_SEGMENT(serial_obj);
+        int reporting_state = serial_obj->get_segment_int();
+        LOG_INFO("toggle_reporting %d", reporting_state);
         switch (reporting_state)
         {
             case 0: rover6::rover_state.is_reporting_enabled = false; break;
             case 1: rover6::rover_state.is_reporting_enabled = true; break;
             case 2: reset(); break;
             default:
-                rover6_serial::println_error("Invalid reporting flag received: %d", reporting_state);
-                break;
+                LOG_ERROR("Invalid reporting flag received: %d", reporting_state);
+                return COMMAND_REJECTED;
         }
+        return COMMAND_APPLIED;
     }
 
-    // rpi_state
-    else if (category.equals("rpi")) {
+    COMMAND_STATUS rpi_state_command(Rover6Serial* serial_obj)
+    {
         CHECK_SEGMENT(serial_obj); rover6::rover_rpi_state.ip_address = serial_obj->get_segment();
         CHECK_SEGMENT(serial_obj); rover6::rover_rpi_state.hostname = serial_obj->get_segment();
         CHECK_SEGMENT(serial_obj); rover6::rover_rpi_state.date_str = serial_obj->get_segment();
         rover6::rover_rpi_state.prev_date_str_update = CURRENT_TIME;
-        CHECK_SEGMENT(serial_obj); rover6::rover_rpi_state.power_button_state = (bool)serial_obj->get_segment().toInt();
-        CHECK_SEGMENT(serial_obj); rover6::rover_rpi_state.broadcasting_hotspot = serial_obj->get_segment().toInt();
+        CHECK_SEGMENT(serial_obj); rover6::rover_rpi_state.power_button_state = (bool)serial_obj->get_segment_int();
+        CHECK_SEGMENT(serial_obj); rover6::rover_rpi_state.broadcasting_hotspot = serial_obj->get_segment_int();
+        return COMMAND_APPLIED;
     }
 
-    // set_motors
-    else if (category.equals("m")) {
-        CHECK_SEGMENT(serial_obj); float setpointA = serial_obj->get_segment().toFloat();
-        CHECK_SEGMENT(serial_obj); float setpointB = serial_obj->get_segment().toFloat();
-        rover6_pid::update_setpointA(setpointA);
-        rover6_pid::update_setpointB(setpointB);
+    COMMAND_STATUS set_motors_command(Rover6Serial* serial_obj)
+    {
+        CHECK_SEGMENT(serial_obj); float setpointA = serial_obj->get_segment_float();
+        CHECK_SEGMENT(serial_obj); float setpointB = serial_obj->get_segment_float();
+        rover6_pid::update_setpoints(setpointA, setpointB);
+        return COMMAND_APPLIED;
     }
 
-    // set_pid_ks
-    else if (category.equals("ks")) {
-        CHECK_SEGMENT(serial_obj); int index = serial_obj->get_segment().toInt();
-        CHECK_SEGMENT(serial_obj); float k_value = serial_obj->get_segment().toFloat();
-        if (0 <= index && index < NUM_PID_KS) {
-            rover6_pid::pid_Ks[index] = k_value;
-            rover6_pid::set_Ks();  // sets pid constants based on pid_Ks array
+    COMMAND_STATUS set_control_rate_command(Rover6Serial* serial_obj)
+    {
+        CHECK_SEGMENT(serial_obj); int rate_hz = serial_obj->get_segment_int();
+        if (rate_hz < 0) {
+            rate_hz = 0;
         }
-        else {
-            rover6_serial::println_error("Invalid K value index supplied: %d", index);
+        uint32_t actual_rate_hz = rover6_control::set_control_rate((uint32_t)rate_hz);
+        LOG_INFO("Control loop rate set to %d Hz", actual_rate_hz);
+        return COMMAND_APPLIED;
+    }
+
+    COMMAND_STATUS set_encoder_estimator_command(Rover6Serial* serial_obj)
+    {
+        CHECK_SEGMENT(serial_obj); int estimator = serial_obj->get_segment_int();
+        if (estimator < 0 || estimator >= NUM_ENCODER_ESTIMATORS) {
+            LOG_ERROR("Invalid encoder speed estimator: %d", estimator);
+            return COMMAND_REJECTED;
+        }
+        rover6_encoders::set_estimator((ENCODER_ESTIMATORS)estimator);
+        LOG_INFO("Encoder speed estimator set to %d", estimator);
+        return COMMAND_APPLIED;
+    }
+
+    COMMAND_STATUS set_pid_ks_command(Rover6Serial* serial_obj)
+    {
+        CHECK_SEGMENT(serial_obj); int index = serial_obj->get_segment_int();
+        CHECK_SEGMENT(serial_obj); float k_value = serial_obj->get_segment_float();
+        if (index < 0 || index >= NUM_PID_KS) {
+            LOG_ERROR("Invalid K value index supplied: %d", index);
+            return COMMAND_REJECTED;
         }
+        rover6_pid::pid_Ks[index] = k_value;
+        rover6_pid::set_Ks();  // sets pid constants based on pid_Ks array
+        return COMMAND_APPLIED;
     }
 
-    // set_servo
-    else if (category.equals("s")) {
-        CHECK_SEGMENT(serial_obj); int n = serial_obj->get_segment().toInt();
-        CHECK_SEGMENT(serial_obj); int command = serial_obj->get_segment().toInt();
+    COMMAND_STATUS set_servo_command(Rover6Serial* serial_obj)
+    {
+        CHECK_SEGMENT(serial_obj); int n = serial_obj->get_segment_int();
+        CHECK_SEGMENT(serial_obj); int command = serial_obj->get_segment_int();
+        CHECK_SERVO_NUM(n);
         rover6_servos::set_servo(n, command);
+        return COMMAND_APPLIED;
     }
 
-    // set_servo_default
-    else if (category.equals("sd")) {
-        CHECK_SEGMENT(serial_obj); int n = serial_obj->get_segment().toInt();
+    COMMAND_STATUS set_servo_default_command(Rover6Serial* serial_obj)
+    {
+        CHECK_SEGMENT(serial_obj); int n = serial_obj->get_segment_int();
+        CHECK_SERVO_NUM(n);
         rover6_servos::set_servo(n);
+        return COMMAND_APPLIED;
     }
 
-    // set_servo_velocity
-    else if (category.equals("sv")) {
-        CHECK_SEGMENT(serial_obj); int n = serial_obj->get_segment().toInt();
-        CHECK_SEGMENT(serial_obj); float command = serial_obj->get_segment().toFloat();
+    COMMAND_STATUS set_servo_velocity_command(Rover6Serial* serial_obj)
+    {
+        CHECK_SEGMENT(serial_obj); int n = serial_obj->get_segment_int();
+        CHECK_SEGMENT(serial_obj); float command = serial_obj->get_segment_float();
+        CHECK_SERVO_NUM(n);
         rover6_servos::set_velocity(n, command);
+        return COMMAND_APPLIED;
     }
 
-    // set_safety_thresholds
-    else if (category.equals("safe")) {
+    COMMAND_STATUS set_safety_thresholds_command(Rover6Serial* serial_obj)
+    {
         for (size_t index = 0; index < 4; index++) {
-            CHECK_SEGMENT(serial_obj); rover6_tof::LOX_THRESHOLDS[index] = serial_obj->get_segment().toInt();
+            CHECK_SEGMENT(serial_obj); rover6_tof::LOX_THRESHOLDS[index] = serial_obj->get_segment_int();
         }
         rover6_tof::set_lox_thresholds();  // sets thresholds based on LOX_THRESHOLDS array
+        return COMMAND_APPLIED;
+    }
+
+    COMMAND_STATUS set_snapshot_command(Rover6Serial* serial_obj)
+    {
+        CHECK_SEGMENT(serial_obj);
+        rover6_snapshot::set_snapshot_enabled(serial_obj->get_segment_int() == 1);
+        return COMMAND_APPLIED;
+    }
+
+    COMMAND_STATUS set_compression_command(Rover6Serial* serial_obj)
+    {
+        CHECK_SEGMENT(serial_obj);
+        bool enabled = serial_obj->get_segment_int() == 1;
+        LOG_INFO("Stream compression %s", enabled ? "enabled" : "disabled");
+        rover6_encoders::set_compression(enabled);
+        rover6_bno::set_compression(enabled);
+        return COMMAND_APPLIED;
+    }
+
+    COMMAND_STATUS set_quaternion_command(Rover6Serial* serial_obj)
+    {
+        CHECK_SEGMENT(serial_obj);
+        bool enabled = serial_obj->get_segment_int() == 1;
+        LOG_INFO("IMU quaternion reports %s", enabled ? "enabled" : "disabled");
+        rover6_bno::set_quaternion_mode(enabled);
+        return COMMAND_APPLIED;
+    }
+
+    COMMAND_STATUS set_bno_interrupt_command(Rover6Serial* serial_obj)
+    {
+        CHECK_SEGMENT(serial_obj);
+        bool enabled = serial_obj->get_segment_int() == 1;
+        LOG_INFO("IMU data ready interrupt %s", enabled ? "enabled" : "disabled");
+        rover6_bno::set_interrupt_mode(enabled);
+        return COMMAND_APPLIED;
+    }
+
+    // braw <Hz>: raw accel and gyro batches instead of fusion output. 0 goes back to fusion
+    COMMAND_STATUS set_bno_raw_command(Rover6Serial* serial_obj)
+    {
+        CHECK_SEGMENT(serial_obj); int rate_hz = serial_obj->get_segment_int();
+        if (rate_hz < 0) {
+            LOG_ERROR("Invalid IMU raw rate: %d", rate_hz);
+            return COMMAND_REJECTED;
+        }
+        uint16_t rate_in_effect = rover6_bno::set_raw_rate((uint16_t)rate_hz);
+        rover6_scheduler::set_task_period(rover6_scheduler::find_task("bno_raw"), rate_in_effect > 0 ? rover6_bno::raw_period_us : 0);
+        LOG_INFO("IMU raw rate set to %d Hz", rate_in_effect);
+        return COMMAND_APPLIED;
+    }
+
+    // bcal <0|1|2>: report the calibration status, save the offsets now, or clear the saved offsets
+    COMMAND_STATUS bno_calibration_command(Rover6Serial* serial_obj)
+    {
+        CHECK_SEGMENT(serial_obj); int action = serial_obj->get_segment_int();
+        COMMAND_STATUS status = COMMAND_APPLIED;
+        switch (action) {
+            case 0: break;
+            case 1:
+                if (!rover6_bno::save_calibration()) {
+                    status = COMMAND_REJECTED;
+                }
+                break;
+            case 2: rover6_bno::clear_calibration(); break;
+            default:
+                LOG_ERROR("Invalid IMU calibration action: %d", action);
+                return COMMAND_REJECTED;
+        }
+        rover6_bno::report_calibration();
+        return status;
+    }
+
+    COMMAND_STATUS set_baud_command(Rover6Serial* serial_obj)
+    {
+        if (serial_obj != rover6_serial::data) {
+            LOG_ERROR("Baud negotiation is only available on the data serial port");
+            return COMMAND_REJECTED;
+        }
+        CHECK_SEGMENT(serial_obj); uint32_t baud = (uint32_t)serial_obj->get_segment_int();
+        CHECK_SEGMENT(serial_obj); int confirm = serial_obj->get_segment_int();
+        if (confirm == 1) {
+            rover6_baud::confirm_baud(baud);
+        }
+        else {
+            rover6_baud::request_baud(baud);
+        }
+        return COMMAND_APPLIED;  // the baud reply says whether the rate is supported
+    }
+
+    COMMAND_STATUS baud_probe_command(Rover6Serial* serial_obj)
+    {
+        if (serial_obj != rover6_serial::data) {
+            return COMMAND_REJECTED;
+        }
+        CHECK_SEGMENT(serial_obj);
+        rover6_baud::send_probe((uint32_t)serial_obj->get_segment_int());  // prb 0 is a heartbeat
+        return COMMAND_APPLIED;
+    }
+
+    COMMAND_STATUS subscribe_command(Rover6Serial* serial_obj)
+    {
+        CHECK_SEGMENT(serial_obj); const char* name = serial_obj->get_segment();
+        CHECK_SEGMENT(serial_obj); int rate_hz = serial_obj->get_segment_int();
+        if (rate_hz < 0) {
+            rate_hz = 0;
+        }
+        int status = rover6_streams::subscribe(name, (uint32_t)rate_hz, rover6_snapshot::is_snapshot_enabled);
+        // reply with the rate in effect, which may be clamped or unchanged
+        serial_obj->write_high_priority("sub", "sdduu",
+            name, rover6_streams::get_rate(name), status,
+            rover6_streams::get_link_load(rover6_snapshot::is_snapshot_enabled), rover6_streams::get_link_budget()
+        );
+        return status == rover6_streams::SUBSCRIBE_OK ? COMMAND_APPLIED : COMMAND_REJECTED;
+    }
+
+    // prof: execution time histograms, one packet per profile point. prof 1 also resets them
+    COMMAND_STATUS profile_command(Rover6Serial* serial_obj)
+    {
+        bool reset_points = serial_obj->next_segment() && serial_obj->get_segment_int() == 1;
+        rover6_profiler::report_points(serial_obj);
+        if (reset_points) {
+            rover6_profiler::reset_points();
+        }
+        return COMMAND_APPLIED;
     }
 
-    // menu_key
-    else if (category.equals("menu")) {
-        CHECK_SEGMENT(serial_obj); char key = serial_obj->get_segment().charAt(0);
+    // load <ms>: measures how much of the CPU interrupts take. Run it once per encoder backend
+    // with the wheels at the same speed to compare them
+    COMMAND_STATUS interrupt_load_command(Rover6Serial* serial_obj)
+    {
+        CHECK_SEGMENT(serial_obj); int duration_ms = serial_obj->get_segment_int();
+        if (duration_ms <= 0) {
+            duration_ms = 100;
+        }
+        rover6_profiler::interrupt_load load;
+        rover6_profiler::measure_interrupt_load((uint32_t)duration_ms, &load);
+        rover6_encoders::encoder_sample sample;
+        rover6_encoders::get_encoder_sample(&sample);
+        serial_obj->write_high_priority("load", "suuuf2f1f1", ENCODER_BACKEND_NAME,
+            load.total_cycles / (F_CPU / 1000000), load.interruptions, load.stolen_cycles / (F_CPU / 1000000),
+            100.0 * load.stolen_cycles / load.total_cycles, sample.speedA, sample.speedB
+        );
+        return COMMAND_APPLIED;
+    }
+
+    // Configuration commands the host needs confirmed: rel <seq> <category> <command fields>.
+    // Replies rack <seq> <status>, where status is the handler's COMMAND_STATUS. The host
+    // retransmits until it gets a rack, so a repeated seq is acknowledged again without
+    // applying the command twice
+    COMMAND_STATUS reliable_command(Rover6Serial* serial_obj)
+    {
+        CHECK_SEGMENT(serial_obj); uint32_t seq = strtoul(serial_obj->get_segment(), NULL, 10);
+        CHECK_SEGMENT(serial_obj); uint32_t category_id = rover6_packet::category_id(serial_obj->get_segment());
+
+        if (serial_obj->is_retransmission(seq)) {
+            serial_obj->write_high_priority("rack", "ud", seq, serial_obj->get_reliable_status());
+            return COMMAND_APPLIED;
+        }
+
+        COMMAND_STATUS status = COMMAND_UNKNOWN;
+        if (category_id != CATEGORY_ID("rel")) {
+            status = packet_callback(serial_obj, category_id);
+        }
+        serial_obj->set_reliable_status(seq, status);
+        serial_obj->write_high_priority("rack", "ud", seq, status);
+        return status;
+    }
+
+    // sched: per task run time stats since the last sched 1. sched 1 reports and resets them
+    COMMAND_STATUS scheduler_stats_command(Rover6Serial* serial_obj)
+    {
+        bool reset_stats = serial_obj->next_segment() && serial_obj->get_segment_int() == 1;
+        rover6_scheduler::report_task_stats(serial_obj);
+        if (reset_stats) {
+            rover6_scheduler::reset_task_stats();
+        }
+        return COMMAND_APPLIED;
+    }
+
+    COMMAND_STATUS menu_key_command(Rover6Serial* serial_obj)
+    {
+        CHECK_SEGMENT(serial_obj); char key = serial_obj->get_segment()[0];
         switch (key) {
             case '^':  rover6_menus::up_menu_event(); break;
             case '<':  rover6_menus::left_menu_event(); break;
@@ -250,64 +484,163 @@ void rover6_serial::packet_callback(Rover6Serial* serial_obj, String category, S
             case 'v':  rover6_menus::down_menu_event(); break;
             case 'e':  rover6_menus::enter_menu_event(); break;
             case 'b':  rover6_menus::back_menu_event(); break;
+            default:
+                LOG_ERROR("Invalid menu key: %c", key);
+                return COMMAND_REJECTED;
+        }
+        return COMMAND_APPLIED;
+    }
+}
+
+rover6_serial::COMMAND_STATUS rover6_serial::packet_callback(Rover6Serial* serial_obj, uint32_t category_id)
+{
+    // LOG_INFO("category: %s", serial_obj->get_category());
+    // category names are hashed at compile time so every command is dispatched in the same time
+    switch (category_id) {
+        case CATEGORY_ID("<>"):  return toggle_active_command(serial_obj);
+        case CATEGORY_ID("?"):  return get_ready_command(serial_obj);
+        case CATEGORY_ID("bin"):  return set_binary_mode_command(serial_obj);
+        case CATEGORY_ID("[]"):  return toggle_reporting_command(serial_obj);
+        case CATEGORY_ID("rpi"):  return rpi_state_command(serial_obj);
+        case CATEGORY_ID("m"):  return set_motors_command(serial_obj);
+        case CATEGORY_ID("ks"):  return set_pid_ks_command(serial_obj);
+        case CATEGORY_ID("ctl"):  return set_control_rate_command(serial_obj);
+        case CATEGORY_ID("est"):  return set_encoder_estimator_command(serial_obj);
+        case CATEGORY_ID("s"):  return set_servo_command(serial_obj);
+        case CATEGORY_ID("sd"):  return set_servo_default_command(serial_obj);
+        case CATEGORY_ID("sv"):  return set_servo_velocity_command(serial_obj);
+        case CATEGORY_ID("safe"):  return set_safety_thresholds_command(serial_obj);
+        case CATEGORY_ID("menu"):  return menu_key_command(serial_obj);
+        case CATEGORY_ID("snap"):  return set_snapshot_command(serial_obj);
+        case CATEGORY_ID("zip"):  return set_compression_command(serial_obj);
+        case CATEGORY_ID("quat"):  return set_quaternion_command(serial_obj);
+        case CATEGORY_ID("bint"):  return set_bno_interrupt_command(serial_obj);
+        case CATEGORY_ID("braw"):  return set_bno_raw_command(serial_obj);
+        case CATEGORY_ID("bcal"):  return bno_calibration_command(serial_obj);
+        case CATEGORY_ID("baud"):  return set_baud_command(serial_obj);
+        case CATEGORY_ID("prb"):  return baud_probe_command(serial_obj);
+        case CATEGORY_ID("sub"):  return subscribe_command(serial_obj);
+        case CATEGORY_ID("rel"):  return reliable_command(serial_obj);
+        case CATEGORY_ID("sched"):  return scheduler_stats_command(serial_obj);
+        case CATEGORY_ID("prof"):  return profile_command(serial_obj);
+        case CATEGORY_ID("load"):  return interrupt_load_command(serial_obj);
+        default:
+            LOG_ERROR("Unknown packet category: %s", serial_obj->get_category());
+            return COMMAND_UNKNOWN;
+    }
+}
+
+// Scheduler tasks. See rover6_scheduler.h
+
+void bno_task()
+{
+    if (rover6_bno::read_BNO055()) {
+        rover6_snapshot::mark_fresh(SNAPSHOT_FRESH_BNO);
+        if (!rover6_snapshot::is_snapshot_enabled) {
+            rover6_bno::report_BNO055();
+        }
+    }
+}
+
+void bno_raw_task()
+{
+    if (rover6_bno::read_BNO055_raw()) {
+        rover6_bno::report_BNO055_raw();
+    }
+}
+
+void bno_calibration_task()
+{
+    if (rover6_bno::read_calibration()) {
+        rover6_bno::report_calibration();
+        rover6_bno::check_calibration();
+    }
+}
+
+void lox_task()
+{
+    if (rover6_tof::read_VL53L0X()) {
+        rover6_snapshot::mark_fresh(SNAPSHOT_FRESH_LOX);
+        if (!rover6_snapshot::is_snapshot_enabled) {
+            rover6_tof::report_VL53L0X();  // off unless the host subscribes to lox
         }
     }
 }
 
-int cycler_index = 0;
-void cycle_update()
+void ina_task()
 {
-    switch (cycler_index) {
-        case 0:
-            if (rover6_bno::read_BNO055()) {
-                rover6_bno::report_BNO055();
-            }
-            break;
-        case 1:
-            if (rover6_tof::read_VL53L0X()) {
-                // rover6_tof::report_VL53L0X();
-            }
-            break;
-        case 2:
-            if (rover6_ina::read_INA219()) {
-                rover6_ina::report_INA219();
-            }
-            break;
-        case 3:
-            if (rover6_encoders::read_encoders()) {
-                rover6_encoders::report_encoders();
-            }
-            break;
-        case 4:
-            if (rover6_fsr::read_fsrs()) {
-                // rover6_fsr::report_fsrs();
-            }
-            break;
-        case 5:
-            if (rover6_ir_remote::read_IR()) {
-                rover6_ir_remote::report_IR();
-                rover6_ir_remote::callback_ir();
-            }
-            break;
-        case 6: rover6_menus::draw_menus(); break;
-        case 7: rover6_pid::update_speed_pid(); break;
-        case 8: rover6_motors::check_motor_timeout(); break;
-        case 9: rover6_servos::update(); break;
-    }
-    cycler_index++;
-    if (cycler_index > 9) {
-        cycler_index = 0;
+    if (rover6_ina::read_INA219()) {
+        rover6_ina::report_INA219();
     }
 }
 
+void encoders_task()
+{
+    if (rover6_encoders::read_encoders()) {
+        rover6_snapshot::mark_fresh(SNAPSHOT_FRESH_ENC);
+        if (!rover6_snapshot::is_snapshot_enabled) {
+            rover6_encoders::report_encoders();
+        }
+    }
+}
+
+void fsr_task()
+{
+    if (rover6_fsr::read_fsrs()) {
+        rover6_fsr::report_fsrs();  // off unless the host subscribes to fsr
+    }
+}
+
+void ir_task()
+{
+    if (rover6_ir_remote::read_IR()) {
+        rover6_ir_remote::report_IR();
+        rover6_ir_remote::callback_ir();
+    }
+}
+
+void motor_timeout_task() {
+    rover6_motors::check_motor_timeout();
+}
+
+// Sensors with a stream rate are polled at the fastest rate they can be subscribed at.
+// Their read functions skip the samples the current rate doesn't need.
+// The speed PIDs aren't in here. They run from the control timer, see rover6_control.h
+rover6_scheduler::task tasks[] = {
+    // name, function, period (us), priority, budget (us)
+    {"motors", motor_timeout_task, 10000, rover6_scheduler::TASK_PRIORITY_CONTROL, 200},
+    {"enc", encoders_task, ENCODER_COMPRESSED_SAMPLERATE_DELAY_MS * 1000, rover6_scheduler::TASK_PRIORITY_CONTROL, 300},
+    {"servos", rover6_servos::update, SERVO_UPDATE_DELAY_MS * 1000, rover6_scheduler::TASK_PRIORITY_CONTROL, 1000},
+    {"lox", lox_task, LOX_SAMPLERATE_FAST_DELAY_MS * 1000, rover6_scheduler::TASK_PRIORITY_SAFETY, 2000},
+    {"fsr", fsr_task, 10000, rover6_scheduler::TASK_PRIORITY_SAFETY, 300},
+    {"ina", ina_task, 20000, rover6_scheduler::TASK_PRIORITY_SAFETY, 1000},
+    {"bno", bno_task, 5000, rover6_scheduler::TASK_PRIORITY_TELEMETRY, 2000},  // twice the BNO055's 100 Hz output
+    {"bno_raw", bno_raw_task, 0, rover6_scheduler::TASK_PRIORITY_TELEMETRY, 500},  // runs at the raw rate while raw mode is on. See braw
+    {"bno_cal", bno_calibration_task, 100000, rover6_scheduler::TASK_PRIORITY_TELEMETRY, 300},  // saving the offsets overruns once
+    {"state", rover6_snapshot::report_snapshot, 5000, rover6_scheduler::TASK_PRIORITY_TELEMETRY, 500},
+    {"ctl", rover6_control::report_control, 100000, rover6_scheduler::TASK_PRIORITY_TELEMETRY, 300},
+    {"ir", ir_task, 20000, rover6_scheduler::TASK_PRIORITY_TELEMETRY, 300},
+    {"menus", rover6_menus::draw_menus, MENU_UPDATE_DELAY_MS * 1000, rover6_scheduler::TASK_PRIORITY_DISPLAY, 16000},  // a menu change clears the screen, 40 KB over SPI
+};
+
+
+// profile points for the work loop() does outside the scheduler
+int data_read_profile = -1;
+int info_read_profile = -1;
+int data_update_profile = -1;
+int info_update_profile = -1;
+int baud_update_profile = -1;
+int i2c_update_profile = -1;
 
 void setup()
 {
     rover6::init_structs();
+    rover6_profiler::setup_profiler();
 
     rover6_tft::initialize_display();
     rover6_serial::setup_serial();  tft.print("Serial ready!\n");
     rover6_i2c::setup_i2c();  tft.print("I2C ready!\n");
+    rover6_encoders::setup_encoders();
     rover6_encoders::reset_encoders();  tft.print("Encoders ready!\n");
     rover6_fsr::setup_fsrs();  tft.print("FSRs ready!\n");
     rover6_ir_remote::setup_IR();   tft.print("IR ready!\n");
@@ -317,6 +650,7 @@ void setup()
     rover6_servos::setup_servos();   tft.print("Servos ready!\n");
     rover6_tof::setup_VL53L0X();   tft.print("VL53L0Xs ready!\n");
     rover6_pid::setup_pid();
+    rover6_control::setup_control();
 
     set_active(true);
     // set_servos_default();
@@ -326,11 +660,23 @@ void setup()
     rover6_servos::center_camera();
     rover6_tft::black_display();
     rover6_menus::init_menus();
+    rover6_scheduler::setup_scheduler(tasks, sizeof(tasks) / sizeof(tasks[0]));
+
+    data_read_profile = rover6_profiler::add_point("data_read");
+    info_read_profile = rover6_profiler::add_point("info_read");
+    data_update_profile = rover6_profiler::add_point("data_update");
+    info_update_profile = rover6_profiler::add_point("info_update");
+    baud_update_profile = rover6_profiler::add_point("baud");
+    i2c_update_profile = rover6_profiler::add_point("i2c");
 }
 
 void loop()
 {
-    rover6_serial::data->read();
-    rover6_serial::info->read();
-    cycle_update();
+    PROFILE(data_read_profile, rover6_serial::data->read());
+    PROFILE(info_read_profile, rover6_serial::info->read());
+    rover6_scheduler::run_next();  // profiles each task
+    PROFILE(data_update_profile, rover6_serial::data->update());
+    PROFILE(info_update_profile, rover6_serial::info->update());
+    PROFILE(baud_update_profile, rover6_baud::update());
+    PROFILE(i2c_update_profile, rover6_i2c::update());
 }
@@ -0,0 +1,107 @@
+// Generated by firmware/scripts/generate_log_table.py. Don't edit
+#ifndef ROVER6_LOG_TABLE_H
+#define ROVER6_LOG_TABLE_H
+
+#include <stdint.h>
+
+struct Rover6LogTableEntry {
+    uint32_t id;
+    const char* format;
+};
+
+const Rover6LogTableEntry ROVER6_LOG_TABLE[] = {
+    {0x043e97a5, "Serial buses initialized."},
+    {0x04885345, "IR: SETUP"},
+    {0x0e0d3601, "Invalid servo number: %d"},
+    {0x0f357460, "set_servos_current"},
+    {0x13c947d4, "Rover #6"},
+    {0x184aa94a, "IMU raw rate set to %d Hz"},
+    {0x2b338da1, "No BNO055 data ready interrupt. Check pin %d. Using the timer"},
+    {0x3227e121, "Stream compression %s"},
+    {0x34b28258, "Encoder speed estimator set to %d"},
+    {0x3730af58, "set_servos_default"},
+    {0x3fc5ead6, "Both in reset mode...(pins are low)"},
+    {0x431ff39b, "BNO055 isn't fully calibrated. Not saving"},
+    {0x4377886a, "Invalid IMU calibration action: %d"},
+    {0x43fede9d, "VL53L0X's initialized."},
+    {0x4abcc53e, "BNO055 mag self test - %s"},
+    {0x4d5bc325, "toggle_reporting %d"},
+    {0x4fbcd127, "Failed to boot first VL53L0X"},
+    {0x5195fa92, "Shutdown pins inited..."},
+    {0x548049e6, "IR: VOL+"},
+    {0x55e5b593, "category: %s"},
+    {0x560b652f, "IR: Play/Pause"},
+    {0x56804d0c, "IR: VOL-"},
+    {0x58f603b8, "BNO055 calibration saved to EEPROM"},
+    {0x5a9a1678, "Baud negotiation is only available on the data serial port"},
+    {0x5ce49b4f, "PID setpoint timed out"},
+    {0x5e4dbc79, "Snapshot reporting %s"},
+    {0x62944599, "toggle_active %d"},
+    {0x670401f9, "PCA9685 Servos initialized."},
+    {0x697495c9, "Control loop running at %d Hz"},
+    {0x69fa35b1, "No BNO055 calibration in EEPROM. Move the rover around to calibrate"},
+    {0x6cac833d, "Starting..."},
+    {0x6da25902, "BNO055 mcu self test - %s"},
+    {0x6fdee2ea, "Control loop rate set to %d Hz"},
+    {0x70d3db7d, "Servo %d: %ddeg, %d"},
+    {0x7519601b, "BNO055 read %d samples late, %d fusion outputs lost"},
+    {0x77c6495d, "Invalid K value index supplied: %d"},
+    {0x7a379ff2, "BNO055 calibration read failed: %d"},
+    {0x7b3911e0, "IR: 8"},
+    {0x7c391373, "IR: 9"},
+    {0x7f16df7e, "BNO055 gyro self test - %s"},
+    {0x7f39182c, "IR: <"},
+    {0x7f7745f9, "INA219 initialized."},
+    {0x81391b52, "IR: >"},
+    {0x8439200b, "IR: 1"},
+    {0x84db28a4, "vel_command, %d: %d"},
+    {0x851f9259, "IR: %d"},
+    {0x8539219e, "IR: 2"},
+    {0x8594ed55, "Invalid active state received: %d"},
+    {0x86392331, "IR: 3"},
+    {0x864f3fe1, "BNO055 system error - %d, %s"},
+    {0x873924c4, "IR: 4"},
+    {0x88392657, "IR: 5"},
+    {0x893927ea, "IR: 6"},
+    {0x89fcc306, "lox1 Error: %d, %s"},
+    {0x8a39297d, "IR: 7"},
+    {0x8c052031, "Requested servo num %d does not exist!"},
+    {0x8e9414db, "BNO055 system status - %d, %s"},
+    {0x8efb04fe, "Invalid menu key: %c"},
+    {0x8f144a0e, "IR: 0 10+"},
+    {0x976be9c8, "BNO055 raw read failed: %d"},
+    {0x9795a4bf, "lox2 Error: %d, %s"},
+    {0x982872e6, "INA reports battery is critically low!"},
+    {0x9b3948db, "No BNO055 detected!! Check your wiring or I2C address"},
+    {0x9b50b79a, "IMU data ready interrupt %s"},
+    {0xa1394db2, "IR: ^"},
+    {0xa2c4569e, "BNO055 read failed: %d"},
+    {0xa3f95993, "Setting active to: %d"},
+    {0xa7180b04, "Invalid IMU raw rate: %d"},
+    {0xa830c686, "BNO055 calibration restored from EEPROM"},
+    {0xac14ebd2, "BNO055 calibration can only be saved in fusion mode"},
+    {0xb02a5ddd, "I2C initialized."},
+    {0xb344d4fc, "Invalid reporting flag received: %d"},
+    {0xb6da44fa, "Invalid ready segment supplied: %s"},
+    {0xb8f12a14, "BNO055 calibration cleared from EEPROM"},
+    {0xbe36a79d, "Motors initialized."},
+    {0xc9398caa, "IR: v"},
+    {0xca3e0c61, "INA219 read failed: %d"},
+    {0xcff94c36, "Data baud fell back to %lu: %s"},
+    {0xd019b33e, "IR: ENTER"},
+    {0xd4165272, "Received ready signal!"},
+    {0xd4e56a9b, "Failed to boot second VL53L0X"},
+    {0xd6187aeb, "IR: MODE"},
+    {0xd868a35d, "IR: Del"},
+    {0xdcbe9d4c, "BNO055 initialized."},
+    {0xe98f50aa, "Too many profile points. %s isn't profiled"},
+    {0xeaf5d52b, "BNO055 accel self test - %s"},
+    {0xee4f2279, "Encoder backend: %s"},
+    {0xf0c181e7, "FSRs initialized."},
+    {0xf564b173, "IMU quaternion reports %s"},
+    {0xf59dda77, "Not enough segments supplied for #%d: %s"},
+    {0xfd529b0a, "Invalid encoder speed estimator: %d"},
+    {0xfd7d7743, "Unknown packet category: %s"},
+};
+
+#endif  // ROVER6_LOG_TABLE_H
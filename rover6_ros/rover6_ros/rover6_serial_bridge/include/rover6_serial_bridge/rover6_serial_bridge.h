@@ -3,6 +3,10 @@
 #include <exception>
 #include <iostream>
 #include <ctime>
+#include <cstring>
+#include <stdexcept>
+#include <map>
+#include <vector>
 
 #include "ros/ros.h"
 #include "ros/console.h"
@@ -23,6 +27,9 @@
 #include "rover6_serial_bridge/Rover6PidSrv.h"
 #include "rover6_serial_bridge/Rover6SafetySrv.h"
 #include "rover6_serial_bridge/Rover6MenuSrv.h"
+#include "rover6_serial_bridge/Rover6StreamRateSrv.h"
+
+#include "rover6_serial_bridge/rover6_log_table.h"
 
 
 using namespace std;
@@ -33,6 +40,54 @@ char PACKET_START_0 = '\x12';
 char PACKET_START_1 = '\x34';
 char PACKET_STOP = '\n';
 
+// binary packet layout before COBS encoding:
+// packet num (u32) | name length (u8) | name | payload (little-endian) | CRC16 (u16)
+uint8_t COBS_DELIMITER = 0x00;
+#define BINARY_PACKET_BUFFER_SIZE 0x400
+
+// data UART rates the device accepts, fastest first. Matches rover6_baud.h
+uint32_t BAUD_RATES[] = {2000000, 1000000, 500000, 460800, 230400, 115200};
+#define NUM_BAUD_RATES (sizeof(BAUD_RATES) / sizeof(BAUD_RATES[0]))
+#define BAUD_PROBE_PACKETS 32
+#define BAUD_PROBE_TIMEOUT_S 0.5
+#define BAUD_FALLBACK_WAIT_S 3.5  // longer than the device's trial and silence timeouts
+#define BAUD_HEARTBEAT_S 1.0
+#define BAUD_ERROR_WINDOW_S 1.0
+#define BAUD_MIN_ERRORS 3
+#define BAUD_MAX_ERROR_PERCENT 10
+#define BAUD_SILENCE_TIMEOUT_S 3.0
+
+// configuration commands are sent with writeReliable and retransmitted until the device acknowledges them
+#define RELIABLE_TIMEOUT_S 0.3  // longer than the device's reset() with the motors running
+#define RELIABLE_MAX_ATTEMPTS 4
+
+// freshness bits of the state snapshot packet
+#define SNAPSHOT_FRESH_ENC 0x01
+#define SNAPSHOT_FRESH_BNO 0x02
+#define SNAPSHOT_FRESH_LOX 0x04
+#define SNAPSHOT_FRESH_SAFETY 0x08
+
+// compressed streams send a keyframe followed by deltas against it
+enum StreamFrameType {
+    FULL_FRAME,
+    KEY_FRAME,
+    DELTA_FRAME
+};
+#define BNO_NUM_VECTOR_VALUES 9
+// fixed point scales of the compressed IMU values. Matches rover6_bno.h
+const double BNO_COMPRESSED_SCALES[BNO_NUM_VECTOR_VALUES] = {16.0, 16.0, 16.0, 16.0, 16.0, 16.0, 100.0, 100.0, 100.0};
+// quaternion mode replaces the euler angles with the BNO055's fused quaternion (w, x, y, z)
+#define BNO_NUM_QUAT_VECTOR_VALUES 10
+const double BNO_QUAT_COMPRESSED_SCALES[BNO_NUM_QUAT_VECTOR_VALUES] = {16384.0, 16384.0, 16384.0, 16384.0, 16.0, 16.0, 16.0, 100.0, 100.0, 100.0};
+// raw mode batches. Matches rover6_bno.h
+#define BNO_RAW_BATCH_LEN 4
+#define BNO_RAW_GYRO_SCALE 16.0
+#define BNO_RAW_ACCEL_SCALE 100.0
+
+// tokenized log packets. Format strings come from rover6_log_table.h
+#define LOG_LEVEL_INFO 0
+#define LOG_LEVEL_ERROR 1
+
 struct StructReadyState {
     uint32_t time_ms;
     string rover_name;
@@ -49,6 +104,24 @@ private:
 
     string _serialPort;
     int _serialBaud;
+    int _serialMaxBaud;
+    uint32_t _currentBaud;
+    uint32_t _deviceMaxBaud;
+    bool _baudReplyReceived;
+    uint32_t _baudReplyRate;
+    int _baudReplyStatus;
+    uint32_t _probeCount;
+    uint32_t _probeErrors;
+    bool _ackReceived;
+    uint32_t _lastAckedPacketNum;
+    unsigned long long _lostCommandCount;
+    unsigned long long _rxPacketCount;
+    unsigned long long _rxErrorCount;
+    unsigned long long _windowStartPackets;
+    unsigned long long _windowStartErrors;
+    ros::Time _linkWindowTime;
+    ros::Time _lastRxTime;
+    ros::Time _heartbeatTime;
     string _serialBuffer;
     int _serialBufferIndex;
     string _currentBufferSegment;
@@ -62,9 +135,35 @@ private:
     size_t _recvCharIndex;
     char* _recvCharBuffer;
 
+    bool _useBinaryProtocol;
+    bool _binaryMode;
+    uint8_t* _cobsBuffer;
+    size_t _cobsBufferIndex;
+    uint8_t* _binaryPacket;
+    size_t _binaryPacketLen;
+    size_t _binaryPacketIndex;
+
+    bool _useStateSnapshot;
+
+    bool _useCompressedStreams;
+    bool _useQuaternionImu;
+    bool _useImuInterrupt;
+    int _imuRawRateHz;
+    int _controlRateHz;
+    string _encoderEstimator;
+    int _encKeyframeId;
+    uint32_t _encKeyTimeMs;
+    int64_t _encKeyLeft, _encKeyRight;
+    int _bnoKeyframeId;
+    uint32_t _bnoKeyTimeMs;
+    bool _bnoKeyIsQuaternion;
+    int32_t _bnoKeyValues[BNO_NUM_QUAT_VECTOR_VALUES];
+
     string _imuFrameID;
     ros::Publisher imu_pub;
     sensor_msgs::Imu imu_msg;
+    ros::Publisher imu_raw_pub;
+    sensor_msgs::Imu imu_raw_msg;
 
     string _encFrameID;
     double _wheelRadiusCm, _ticksPerRotation, _maxRPM, _cmPerTick, _cpsToCmd;
@@ -101,6 +200,21 @@ private:
     ros::ServiceServer pid_service;
     ros::ServiceServer safety_service;
     ros::ServiceServer menu_service;
+    ros::ServiceServer stream_rate_service;
+
+    uint32_t _reliableSeq;
+    bool _rackReceived;
+    uint32_t _rackSeq;
+    int _rackStatus;
+
+    bool _subReplyReceived;
+    string _subReplyStream;
+    int _subReplyRate;
+    int _subReplyStatus;
+    uint32_t _subReplyLoad;
+    uint32_t _subReplyBudget;
+
+    map<uint32_t, string> _logTable;
 
     StructReadyState* readyState;
 
@@ -117,8 +231,30 @@ private:
     bool waitForPacketStart();
     void processSerialPacket(string category);
 
+    int32_t segmentAsInt();
+    uint32_t segmentAsUInt();
+    int32_t segmentAsVarInt();
+    double segmentAsFloat();
+    double segmentAsFixed(int decimals);
+    string segmentAsString();
+
+    void negotiateBinaryMode();
+    void negotiateBaud();
+    bool tryBaud(uint32_t baud);
+    bool waitForBaudReply(double timeout_s);
+    void setPortBaud(uint32_t baud);
+    void checkLinkHealth();
+    void fallBackBaud();
+    bool readBinaryPacket();
+    const uint8_t* consumeBinary(size_t length);
+    size_t cobsDecode(const uint8_t* src, size_t length, uint8_t* dst);
+    uint16_t crc16(const uint8_t* data, size_t length);
+
     bool readSerial();
     void writeSerial(string name, const char *formats, ...);
+    bool writeReliable(string name, const char *formats, ...);
+    string formatFields(const char *formats, va_list args);
+    void writePacket(string name, string fields);
 
     void setup();
     void loop();
@@ -127,21 +263,31 @@ private:
     bool set_pid(rover6_serial_bridge::Rover6PidSrv::Request &req, rover6_serial_bridge::Rover6PidSrv::Response &res);
     bool set_safety_thresholds(rover6_serial_bridge::Rover6SafetySrv::Request &req, rover6_serial_bridge::Rover6SafetySrv::Response &res);
     bool send_menu_event(rover6_serial_bridge::Rover6MenuSrv::Request &req, rover6_serial_bridge::Rover6MenuSrv::Response &res);
+    bool set_stream_rate(rover6_serial_bridge::Rover6StreamRateSrv::Request &req, rover6_serial_bridge::Rover6StreamRateSrv::Response &res);
 
-    void setActive(bool state);
+    bool setActive(bool state);
     void softRestart();
-    void setReporting(bool state);
-    void resetSensors();
+    bool setReporting(bool state);
+    bool setSnapshotMode(bool state);
+    bool setCompression(bool state);
+    bool setQuaternionMode(bool state);
+    bool setImuInterrupt(bool state);
+    bool setImuRawRate(int rate_hz);
+    bool setControlRate(int rate_hz);
+    bool setEncoderEstimator(string estimator);
+    bool subscribeStream(string stream, int rate_hz, string* message);
+    bool resetSensors();
     // void writeCurrentState();
     void writeSpeed(float speedA, float speedB);
-    void writeK(float kp_A, float ki_A, float kd_A, float kp_B, float ki_B, float kd_B, float speed_kA, float speed_kB);
-    void writeObstacleThresholds(int back_lower, int back_upper, int front_lower, int front_upper);
+    bool writeK(float kp_A, float ki_A, float kd_A, float kp_B, float ki_B, float kd_B, float speed_kA, float speed_kB);
+    bool writeObstacleThresholds(int back_lower, int back_upper, int front_lower, int front_upper);
     void logPacketErrorCode(int error_code, unsigned long long packet_num);
 
-    void parseImu();
+    void parseImu(StreamFrameType frame_type = FULL_FRAME, bool is_quaternion = false);
     void eulerToQuat(double roll, double pitch, double yaw);
+    void parseImuRaw();
 
-    void parseEncoder();
+    void parseEncoder(StreamFrameType frame_type = FULL_FRAME);
     double convertTicksToCm(long ticks);
 
     void parseFSR();
@@ -150,6 +296,10 @@ private:
     void parseIR();
     void parseServo();
     void parseTOF();
+    void parseState(bool is_quaternion = false);
+    void parseLog();
+    string formatLog(const string& format, const vector<uint8_t>& args);
+    const uint8_t* consumeLogArg(const vector<uint8_t>& args, size_t* index, size_t length);
 public:
     Rover6SerialBridge(ros::NodeHandle* nodehandle);
     int run();
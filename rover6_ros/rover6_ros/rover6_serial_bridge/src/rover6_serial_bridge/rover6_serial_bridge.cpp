@@ -6,6 +6,15 @@ Rover6SerialBridge::Rover6SerialBridge(ros::NodeHandle* nodehandle):nh(*nodehand
     _roverNamespace = "rover6";
     nh.param<string>("/" + _roverNamespace + "/serial_port", _serialPort, "");
     nh.param<int>("/" + _roverNamespace + "/serial_baud", _serialBaud, 115200);
+    nh.param<int>("/" + _roverNamespace + "/serial_max_baud", _serialMaxBaud, _serialBaud);  // negotiated after the ready signal
+    nh.param<bool>("/" + _roverNamespace + "/use_binary_protocol", _useBinaryProtocol, false);
+    nh.param<bool>("/" + _roverNamespace + "/use_state_snapshot", _useStateSnapshot, false);
+    nh.param<bool>("/" + _roverNamespace + "/use_compressed_streams", _useCompressedStreams, false);
+    nh.param<bool>("/" + _roverNamespace + "/use_quaternion_imu", _useQuaternionImu, false);  // orientation straight from the BNO055's fusion
+    nh.param<bool>("/" + _roverNamespace + "/use_imu_interrupt", _useImuInterrupt, false);  // sample on the BNO055's data ready pin
+    nh.param<int>("/" + _roverNamespace + "/imu_raw_rate_hz", _imuRawRateHz, 0);  // raw accel and gyro on bno055_raw instead of fusion. 0 is off
+    nh.param<int>("/" + _roverNamespace + "/control_rate_hz", _controlRateHz, 0);  // 0 keeps the firmware's default
+    nh.param<string>("/" + _roverNamespace + "/encoder_estimator", _encoderEstimator, "");  // window, edge or blended. Empty keeps the firmware's default
     nh.param<string>("/" + _roverNamespace + "/imu_frame_id", _imuFrameID, "bno055_imu");
     nh.param<string>("/" + _roverNamespace + "/enc_frame_id", _encFrameID, "encoders");
     nh.param<string>("/" + _roverNamespace + "/motors_topic", _motorsTopicName, "motors");
@@ -21,6 +30,8 @@ Rover6SerialBridge::Rover6SerialBridge(ros::NodeHandle* nodehandle):nh(*nodehand
     nh.param<int>("/" + _roverNamespace + "/tilt_servo_num", _tiltServoNum, 3);
 
     imu_msg.header.frame_id = _imuFrameID;
+    imu_raw_msg.header.frame_id = _imuFrameID;
+    imu_raw_msg.orientation_covariance[0] = -1.0;  // no orientation estimate
     enc_msg.header.frame_id = _encFrameID;
     fsr_msg.header.frame_id = "fsr";
     safety_msg.header.frame_id = "safety";
@@ -38,6 +49,56 @@ Rover6SerialBridge::Rover6SerialBridge(ros::NodeHandle* nodehandle):nh(*nodehand
     _recvCharIndex = 0;
     _recvCharBuffer = new char[0xfff];
 
+    _binaryMode = false;
+    _cobsBuffer = new uint8_t[BINARY_PACKET_BUFFER_SIZE];
+    _cobsBufferIndex = 0;
+    _binaryPacket = new uint8_t[BINARY_PACKET_BUFFER_SIZE];
+    _binaryPacketLen = 0;
+    _binaryPacketIndex = 0;
+
+    _currentBaud = (uint32_t)_serialBaud;
+    _deviceMaxBaud = (uint32_t)_serialBaud;
+    _baudReplyReceived = false;
+    _baudReplyRate = 0;
+    _baudReplyStatus = 0;
+    _probeCount = 0;
+    _probeErrors = 0;
+    _ackReceived = false;
+    _lastAckedPacketNum = 0;
+    _lostCommandCount = 0;
+    _rxPacketCount = 0;
+    _rxErrorCount = 0;
+    _windowStartPackets = 0;
+    _windowStartErrors = 0;
+    _linkWindowTime = ros::Time::now();
+    _lastRxTime = ros::Time::now();
+    _heartbeatTime = ros::Time::now();
+
+    _reliableSeq = 0;
+    _rackReceived = false;
+    _rackSeq = 0;
+    _rackStatus = 0;
+
+    _subReplyReceived = false;
+    _subReplyStream = "";
+    _subReplyRate = 0;
+    _subReplyStatus = 0;
+    _subReplyLoad = 0;
+    _subReplyBudget = 0;
+
+    _encKeyframeId = -1;
+    _encKeyTimeMs = 0;
+    _encKeyLeft = 0;
+    _encKeyRight = 0;
+    _bnoKeyframeId = -1;
+    _bnoKeyIsQuaternion = false;
+    _bnoKeyTimeMs = 0;
+    memset(_bnoKeyValues, 0, sizeof(_bnoKeyValues));
+
+    for (size_t index = 0; index < sizeof(ROVER6_LOG_TABLE) / sizeof(ROVER6_LOG_TABLE[0]); index++) {
+        _logTable[ROVER6_LOG_TABLE[index].id] = ROVER6_LOG_TABLE[index].format;
+    }
+
     _dateString = new char[16];
 
     readyState = new StructReadyState;
@@ -49,6 +110,7 @@ Rover6SerialBridge::Rover6SerialBridge(ros::NodeHandle* nodehandle):nh(*nodehand
     offsetTimeMs = 0;
 
     imu_pub = nh.advertise<sensor_msgs::Imu>("bno055", 100);
+    imu_raw_pub = nh.advertise<sensor_msgs::Imu>("bno055_raw", 400);
     enc_pub = nh.advertise<rover6_serial_bridge::Rover6Encoder>("encoders", 100);
     fsr_pub = nh.advertise<rover6_serial_bridge::Rover6FSR>("fsrs", 100);
     safety_pub = nh.advertise<rover6_serial_bridge::Rover6Safety>("safety", 100);
@@ -56,12 +118,13 @@ Rover6SerialBridge::Rover6SerialBridge(ros::NodeHandle* nodehandle):nh(*nodehand
     servo_pub = nh.advertise<rover6_serial_bridge::Rover6ServoPos>("servo_pos", 10);
     tof_pub = nh.advertise<rover6_serial_bridge::Rover6TOF>("tof", 10);
 
-    motors_sub = nh.subscribe(_motorsTopicName, 100, &Rover6SerialBridge::motorsCallback, this);
+    motors_sub = nh.subscribe(_motorsTopicName, 1, &Rover6SerialBridge::motorsCallback, this);  // only the latest setpoint matters
     servos_sub = nh.subscribe(_servosTopicName, 100, &Rover6SerialBridge::servosCallback, this);
 
     pid_service = nh.advertiseService("rover6_pid", &Rover6SerialBridge::set_pid, this);
     safety_service = nh.advertiseService("rover6_safety", &Rover6SerialBridge::set_safety_thresholds, this);
     menu_service = nh.advertiseService("rover6_menu", &Rover6SerialBridge::send_menu_event, this);
+    stream_rate_service = nh.advertiseService("rover6_stream_rate", &Rover6SerialBridge::set_stream_rate, this);
 
     ROS_INFO("Rover 6 serial bridge init done");
 }
@@ -138,6 +201,188 @@ void Rover6SerialBridge::checkReady()
     }
 }
 
+void Rover6SerialBridge::negotiateBinaryMode()
+{
+    ROS_INFO("Requesting binary protocol.");
+
+    ros::Time begin_time = ros::Time::now();
+    ros::Duration timeout = ros::Duration(1.0);
+
+    // the device confirms in ASCII before switching. processSerialPacket sets _binaryMode
+    writeSerial("bin", "d", 1);
+
+    while (!_binaryMode)
+    {
+        if (!ros::ok()) {
+            return;
+        }
+        if ((ros::Time::now() - begin_time) > timeout) {
+            ROS_WARN("Device didn't confirm binary protocol. Staying in ASCII mode");
+            return;
+        }
+        if (_serialRef.available() > 2) {
+            readSerial();
+        }
+    }
+    ROS_INFO("Binary protocol enabled.");
+}
+
+void Rover6SerialBridge::negotiateBaud()
+{
+    uint32_t max_baud = (uint32_t)_serialMaxBaud < _deviceMaxBaud ? (uint32_t)_serialMaxBaud : _deviceMaxBaud;
+    if (max_baud <= _currentBaud) {
+        return;
+    }
+    ROS_INFO("Negotiating data baud. Max rate: %u", max_baud);
+
+    // step down from the fastest rate until one passes the probe
+    for (size_t index = 0; index < NUM_BAUD_RATES; index++) {
+        uint32_t baud = BAUD_RATES[index];
+        if (baud > max_baud) {
+            continue;
+        }
+        if (baud <= _currentBaud) {
+            break;
+        }
+        if (tryBaud(baud)) {
+            ROS_INFO("Data baud set to %u", baud);
+            return;
+        }
+        ROS_WARN("Baud %u failed. Trying a slower rate", baud);
+    }
+    ROS_WARN("Staying at %u baud", _currentBaud);
+}
+
+bool Rover6SerialBridge::tryBaud(uint32_t baud)
+{
+    uint32_t prev_baud = _currentBaud;
+
+    writeSerial("baud", "ud", baud, 0);
+    if (!waitForBaudReply(1.0) || _baudReplyRate != baud || _baudReplyStatus != 1) {
+        return false;  // not accepted. The device is still at the previous rate
+    }
+    // the device switches once its reply has been sent
+    setPortBaud(baud);
+
+    _probeCount = 0;
+    _probeErrors = 0;
+    unsigned long long rx_errors = _rxErrorCount;
+    writeSerial("prb", "d", BAUD_PROBE_PACKETS);
+
+    ros::Time begin_time = ros::Time::now();
+    while (_probeCount + _probeErrors < BAUD_PROBE_PACKETS && ros::ok()) {
+        if ((ros::Time::now() - begin_time).toSec() > BAUD_PROBE_TIMEOUT_S) {
+            break;
+        }
+        if (_serialRef.available() > 2) {
+            readSerial();
+        }
+    }
+
+    bool success = _probeCount == BAUD_PROBE_PACKETS && _probeErrors == 0 && _rxErrorCount == rx_errors;
+    if (success) {
+        writeSerial("baud", "ud", baud, 1);
+        success = waitForBaudReply(BAUD_PROBE_TIMEOUT_S) && _baudReplyRate == baud && _baudReplyStatus == 2;
+    }
+    if (!success) {
+        ROS_WARN("Baud %u probe: %u of %d packets intact, %u corrupt", baud, _probeCount, BAUD_PROBE_PACKETS, _probeErrors);
+        // the device returns to the previous rate on its own once it stops hearing from us
+        setPortBaud(prev_baud);
+        ros::Duration(BAUD_FALLBACK_WAIT_S).sleep();
+        _serialRef.flushInput();
+    }
+    return success;
+}
+
+bool Rover6SerialBridge::waitForBaudReply(double timeout_s)
+{
+    // processSerialPacket sets _baudReplyReceived
+    _baudReplyReceived = false;
+    ros::Time begin_time = ros::Time::now();
+    while (!_baudReplyReceived)
+    {
+        if (!ros::ok()) {
+            return false;
+        }
+        if ((ros::Time::now() - begin_time).toSec() > timeout_s) {
+            return false;
+        }
+        if (_serialRef.available() > 2) {
+            readSerial();
+        }
+    }
+    return true;
+}
+
+void Rover6SerialBridge::setPortBaud(uint32_t baud)
+{
+    _serialRef.flush();
+    ros::Duration(0.01).sleep();  // let the device finish sending at the old rate and switch
+    _serialRef.setBaudrate(baud);
+    _serialRef.flushInput();
+    _recvCharIndex = 0;
+    _cobsBufferIndex = 0;
+    _currentBaud = baud;
+    _lastRxTime = ros::Time::now();
+}
+
+void Rover6SerialBridge::checkLinkHealth()
+{
+    if (_currentBaud == (uint32_t)_serialBaud) {
+        return;
+    }
+    // the device drops back to the default rate if it stops hearing from us
+    if ((ros::Time::now() - _heartbeatTime).toSec() > BAUD_HEARTBEAT_S) {
+        writeSerial("prb", "d", 0);
+        _heartbeatTime = ros::Time::now();
+    }
+
+    if ((ros::Time::now() - _lastRxTime).toSec() > BAUD_SILENCE_TIMEOUT_S) {
+        ROS_WARN("No packets from the device at %u baud", _currentBaud);
+        fallBackBaud();
+        return;
+    }
+    if ((ros::Time::now() - _linkWindowTime).toSec() < BAUD_ERROR_WINDOW_S) {
+        return;
+    }
+    unsigned long long packets = _rxPacketCount - _windowStartPackets;
+    unsigned long long errors = _rxErrorCount - _windowStartErrors;
+    _windowStartPackets = _rxPacketCount;
+    _windowStartErrors = _rxErrorCount;
+    _linkWindowTime = ros::Time::now();
+
+    if (errors >= BAUD_MIN_ERRORS && errors * 100 > (packets + errors) * BAUD_MAX_ERROR_PERCENT) {
+        ROS_WARN("Receive error rate too high at %u baud (%llu errors, %llu packets)", _currentBaud, errors, packets);
+        fallBackBaud();
+    }
+}
+
+void Rover6SerialBridge::fallBackBaud()
+{
+    // don't try this rate or anything faster again
+    _serialMaxBaud = _serialBaud;
+    for (size_t index = 0; index < NUM_BAUD_RATES; index++) {
+        if (BAUD_RATES[index] < _currentBaud) {
+            _serialMaxBaud = BAUD_RATES[index];
+            break;
+        }
+    }
+
+    // stay quiet until the device gives up on the current rate as well
+    setPortBaud(_serialBaud);
+    ros::Duration(BAUD_FALLBACK_WAIT_S).sleep();
+    _serialRef.flushInput();
+
+    // the ready signal puts the device back in ASCII mode
+    _binaryMode = false;
+    readyState->is_ready = false;
+    checkReady();
+    negotiateBaud();
+    if (_useBinaryProtocol) {
+        negotiateBinaryMode();
+    }
+}
+
 bool Rover6SerialBridge::waitForPacketStart()
 {
     stringstream msg_buffer;
@@ -172,6 +417,9 @@ bool Rover6SerialBridge::waitForPacketStart()
 
 bool Rover6SerialBridge::readSerial()
 {
+    if (_binaryMode) {
+        return readBinaryPacket();
+    }
     if (!waitForPacketStart()) {
         return false;
     }
@@ -199,6 +447,7 @@ bool Rover6SerialBridge::readSerial()
     if (_serialBuffer.length() < 5) {
         ROS_ERROR_STREAM("Received packet has an invalid number of characters! " << _serialBuffer);
         _readPacketNum++;
+        _rxErrorCount++;
         return false;
     }
 
@@ -215,6 +464,7 @@ bool Rover6SerialBridge::readSerial()
     }
     catch (exception& e) {
         ROS_ERROR_STREAM("Failed to parse checksum. Buffer: " << _serialBuffer << ". Exception: " << e.what());
+        _rxErrorCount++;
         return false;
     }
 
@@ -223,6 +473,7 @@ bool Rover6SerialBridge::readSerial()
         ROS_ERROR("Checksum failed! recv %d != calc %d", calc_checksum, recv_checksum);
         ROS_ERROR_STREAM("Buffer: " << _serialBuffer);
         _readPacketNum++;
+        _rxErrorCount++;
         return false;
     }
 
@@ -232,7 +483,7 @@ bool Rover6SerialBridge::readSerial()
         _readPacketNum++;
         return false;
     }
-    uint32_t recv_packet_num = (uint32_t)stoi(_currentBufferSegment);
+    uint32_t recv_packet_num = (uint32_t)segmentAsInt();
     if (recv_packet_num != _readPacketNum) {
         ROS_ERROR("Received packet num doesn't match local count. recv %d != local %d", recv_packet_num, _readPacketNum);
         ROS_ERROR_STREAM("Buffer: " << _serialBuffer);
@@ -261,11 +512,220 @@ bool Rover6SerialBridge::readSerial()
     }
 
     _readPacketNum++;
+    _rxPacketCount++;
+    _lastRxTime = ros::Time::now();
     return true;
 }
 
+bool Rover6SerialBridge::readBinaryPacket()
+{
+    // accumulate bytes until the COBS delimiter. Partial frames are kept for the next call
+    uint8_t c;
+    ros::Time wait_time = ros::Time::now();
+    ros::Duration wait_timeout = ros::Duration(0.05);
+    while (true) {
+        if (ros::Time::now() - wait_time > wait_timeout) {
+            return false;
+        }
+        if (!_serialRef.available()) {
+            continue;
+        }
+        _serialRef.read(&c, 1);
+        if (c == COBS_DELIMITER) {
+            break;
+        }
+        if (_cobsBufferIndex >= BINARY_PACKET_BUFFER_SIZE) {
+            ROS_ERROR("Binary packet exceeded buffer size! Dropping frame");
+            _cobsBufferIndex = 0;
+            _readPacketNum++;
+            _rxErrorCount++;
+            return false;
+        }
+        _cobsBuffer[_cobsBufferIndex++] = c;
+    }
+    size_t cobs_len = _cobsBufferIndex;
+    _cobsBufferIndex = 0;
+    if (cobs_len == 0) {
+        return false;
+    }
+
+    _binaryPacketLen = cobsDecode(_cobsBuffer, cobs_len, _binaryPacket);
+    _binaryPacketIndex = 0;
+
+    // 4 bytes for packet num
+    // 1 byte for category length + at least 1 category char
+    // 2 bytes for checksum
+    if (_binaryPacketLen < 8) {
+        ROS_ERROR("Received binary packet is malformed or too short (%lu bytes)", _binaryPacketLen);
+        _readPacketNum++;
+        _rxErrorCount++;
+        return false;
+    }
+
+    uint16_t calc_crc = crc16(_binaryPacket, _binaryPacketLen - 2);
+    uint16_t recv_crc = (uint16_t)_binaryPacket[_binaryPacketLen - 2] | ((uint16_t)_binaryPacket[_binaryPacketLen - 1] << 8);
+    if (calc_crc != recv_crc) {
+        ROS_ERROR("CRC failed! recv %04x != calc %04x", recv_crc, calc_crc);
+        _readPacketNum++;
+        _rxErrorCount++;
+        return false;
+    }
+    // remove checksum
+    _binaryPacketLen -= 2;
+
+    string category;
+    try {
+        uint32_t recv_packet_num = segmentAsUInt();
+        if (recv_packet_num != _readPacketNum) {
+            ROS_ERROR("Received packet num doesn't match local count. recv %d != local %d", recv_packet_num, _readPacketNum);
+            _readPacketNum = recv_packet_num;
+        }
+        category = segmentAsString();
+    }
+    catch (exception& e) {
+        ROS_ERROR_STREAM("Failed to parse binary packet header: " << e.what());
+        _readPacketNum++;
+        return false;
+    }
+
+    try {
+        processSerialPacket(category);
+    }
+    catch (exception& e) {
+        ROS_ERROR_STREAM("Exception in processSerialPacket: " << e.what());
+        return false;
+    }
+
+    _readPacketNum++;
+    _rxPacketCount++;
+    _lastRxTime = ros::Time::now();
+    return true;
+}
+
+const uint8_t* Rover6SerialBridge::consumeBinary(size_t length)
+{
+    if (_binaryPacketIndex + length > _binaryPacketLen) {
+        throw out_of_range("Binary packet is shorter than its format");
+    }
+    const uint8_t* data = _binaryPacket + _binaryPacketIndex;
+    _binaryPacketIndex += length;
+    return data;
+}
+
+size_t Rover6SerialBridge::cobsDecode(const uint8_t* src, size_t length, uint8_t* dst)
+{
+    // mirrors rover6_cobs::cobs_decode in the firmware. Returns 0 if the frame is malformed
+    size_t read_index = 0;
+    size_t write_index = 0;
+
+    while (read_index < length) {
+        uint8_t code = src[read_index];
+        if (code == COBS_DELIMITER || read_index + code > length) {
+            return 0;
+        }
+        read_index++;
+        for (uint8_t index = 1; index < code; index++) {
+            dst[write_index++] = src[read_index++];
+        }
+        if (code != 0xff && read_index != length) {
+            dst[write_index++] = COBS_DELIMITER;
+        }
+    }
+    return write_index;
+}
+
+uint16_t Rover6SerialBridge::crc16(const uint8_t* data, size_t length)
+{
+    // CRC-16/CCITT-FALSE (poly 0x1021, init 0xffff)
+    uint16_t crc = 0xffff;
+    for (size_t index = 0; index < length; index++) {
+        uint8_t x = (crc >> 8) ^ data[index];
+        x ^= x >> 4;
+        crc = (crc << 8) ^ ((uint16_t)x << 12) ^ ((uint16_t)x << 5) ^ (uint16_t)x;
+    }
+    return crc;
+}
+
+// Segment accessors read the current ASCII segment or consume the next binary field.
+// Binary field widths follow the firmware's format characters: d, u, l, and f are 4 bytes,
+// s is a length byte followed by the characters, v and f with a decimal places digit (f4) are varints.
+int32_t Rover6SerialBridge::segmentAsInt()
+{
+    if (!_binaryMode) {
+        return (int32_t)stol(_currentBufferSegment);
+    }
+    int32_t value;
+    memcpy(&value, consumeBinary(4), 4);
+    return value;
+}
+
+uint32_t Rover6SerialBridge::segmentAsUInt()
+{
+    if (!_binaryMode) {
+        return (uint32_t)stoul(_currentBufferSegment);
+    }
+    uint32_t value;
+    memcpy(&value, consumeBinary(4), 4);
+    return value;
+}
+
+// Zigzag varint in binary mode (1 to 5 bytes). A plain integer in ASCII mode
+int32_t Rover6SerialBridge::segmentAsVarInt()
+{
+    if (!_binaryMode) {
+        return (int32_t)stol(_currentBufferSegment);
+    }
+    uint32_t value = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        uint8_t b = *consumeBinary(1);
+        value |= (uint32_t)(b & 0x7f) << shift;
+        if ((b & 0x80) == 0) {
+            return (int32_t)((value >> 1) ^ -(value & 1));
+        }
+    }
+    throw out_of_range("Varint is longer than 5 bytes");
+}
+
+double Rover6SerialBridge::segmentAsFloat()
+{
+    if (!_binaryMode) {
+        return stod(_currentBufferSegment);
+    }
+    float value;
+    memcpy(&value, consumeBinary(4), 4);
+    return (double)value;
+}
+
+// Fields sent with a decimal places digit, e.g. f4. A zigzag varint scaled by 10^decimals in binary
+// mode (INT32_MIN means NaN). A plain decimal number in ASCII mode
+double Rover6SerialBridge::segmentAsFixed(int decimals)
+{
+    if (!_binaryMode) {
+        return stod(_currentBufferSegment);
+    }
+    int32_t value = segmentAsVarInt();
+    if (value == INT32_MIN) {
+        return NAN;
+    }
+    return value / pow(10.0, decimals);
+}
+
+string Rover6SerialBridge::segmentAsString()
+{
+    if (!_binaryMode) {
+        return _currentBufferSegment;
+    }
+    size_t length = *consumeBinary(1);
+    const char* data = (const char*)consumeBinary(length);
+    return string(data, length);
+}
+
 bool Rover6SerialBridge::getNextSegment()
 {
+    if (_binaryMode) {
+        // binary fields are consumed by the segmentAs* accessors
+        return _binaryPacketIndex < _binaryPacketLen;
+    }
     if (_serialBufferIndex >= _serialBuffer.length()) {
         return false;
     }
@@ -286,20 +746,76 @@ bool Rover6SerialBridge::getNextSegment()
 void Rover6SerialBridge::processSerialPacket(string category)
 {
     if (category.compare("txrx") == 0) {
-        CHECK_SEGMENT(0); unsigned long long packet_num = (unsigned long long)stol(_currentBufferSegment);
-        CHECK_SEGMENT(1); int error_code = stoi(_currentBufferSegment);
+        CHECK_SEGMENT(0); unsigned long long packet_num = (unsigned long long)segmentAsInt();
+        CHECK_SEGMENT(1); int error_code = segmentAsInt();
         // CHECK_SEGMENT(2); string message = _currentBufferSegment;
 
         if (error_code != 0) {
             logPacketErrorCode(error_code, packet_num);
         }
     }
+    else if (category.compare("ack") == 0) {
+        // cumulative acknowledgement. Errors in the range were already reported with txrx
+        CHECK_SEGMENT(0); uint32_t first_num = segmentAsUInt();
+        CHECK_SEGMENT(1); uint32_t last_num = segmentAsUInt();
+        CHECK_SEGMENT(2); uint32_t ok_count = segmentAsUInt();
+        CHECK_SEGMENT(3); uint32_t error_count = segmentAsUInt();
+
+        if (_ackReceived && first_num > _lastAckedPacketNum + 1) {
+            first_num = _lastAckedPacketNum + 1;  // include packets lost between acknowledgements
+        }
+        uint32_t span = last_num - first_num + 1;
+        if (last_num >= first_num && ok_count + error_count < span) {
+            uint32_t lost = span - ok_count - error_count;
+            _lostCommandCount += lost;
+            ROS_WARN("%u of packets #%u to #%u never reached the device (%llu total)", lost, first_num, last_num, _lostCommandCount);
+        }
+        _lastAckedPacketNum = last_num;
+        _ackReceived = true;
+    }
     else if (category.compare("bno") == 0) {
         parseImu();
     }
+    else if (category.compare("bnok") == 0) {
+        parseImu(KEY_FRAME);
+    }
+    else if (category.compare("bnod") == 0) {
+        parseImu(DELTA_FRAME);
+    }
+    else if (category.compare("bnor") == 0) {
+        parseImuRaw();
+    }
+    else if (category.compare("bnoq") == 0) {
+        parseImu(FULL_FRAME, true);
+    }
+    else if (category.compare("bnqk") == 0) {
+        parseImu(KEY_FRAME, true);
+    }
+    else if (category.compare("bnqd") == 0) {
+        parseImu(DELTA_FRAME, true);
+    }
+    else if (category.compare("bcal") == 0) {
+        // BNO055 calibration status, sent when it changes. Each is 0 (none) to 3 (full)
+        CHECK_SEGMENT(0); segmentAsUInt();  // time ms
+        CHECK_SEGMENT(1); uint32_t system = segmentAsUInt();
+        CHECK_SEGMENT(2); uint32_t gyro = segmentAsUInt();
+        CHECK_SEGMENT(3); uint32_t accel = segmentAsUInt();
+        CHECK_SEGMENT(4); uint32_t mag = segmentAsUInt();
+        CHECK_SEGMENT(5); uint32_t offsets = segmentAsUInt();
+        const char* offsets_names[] = {"none stored", "restored from EEPROM", "saved to EEPROM"};
+        ROS_INFO("IMU calibration: system %u, gyro %u, accel %u, mag %u. Offsets %s",
+            system, gyro, accel, mag, offsets < 3 ? offsets_names[offsets] : "unknown"
+        );
+    }
     else if (category.compare("enc") == 0) {
         parseEncoder();
     }
+    else if (category.compare("enck") == 0) {
+        parseEncoder(KEY_FRAME);
+    }
+    else if (category.compare("encd") == 0) {
+        parseEncoder(DELTA_FRAME);
+    }
     else if (category.compare("fsr") == 0) {
         parseFSR();
     }
@@ -318,11 +834,97 @@ void Rover6SerialBridge::processSerialPacket(string category)
     else if (category.compare("lox") == 0) {
         parseTOF();
     }
+    else if (category.compare("state") == 0) {
+        parseState();
+    }
+    else if (category.compare("stateq") == 0) {
+        parseState(true);
+    }
     else if (category.compare("ready") == 0) {
-        CHECK_SEGMENT(0); readyState->time_ms = (uint32_t)stoi(_currentBufferSegment);
-        CHECK_SEGMENT(1); readyState->rover_name = _currentBufferSegment;
+        CHECK_SEGMENT(0); readyState->time_ms = segmentAsUInt();
+        CHECK_SEGMENT(1); readyState->rover_name = segmentAsString();
+        if (getNextSegment()) {
+            _deviceMaxBaud = segmentAsUInt();  // older firmware doesn't send this
+        }
         readyState->is_ready = true;
-        ROS_INFO_STREAM("Received ready signal! Rover name: " << _currentBufferSegment);
+        ROS_INFO_STREAM("Received ready signal! Rover name: " << readyState->rover_name);
+    }
+    else if (category.compare("bin") == 0) {
+        CHECK_SEGMENT(0); _binaryMode = segmentAsInt() == 1;
+        // the next byte from the device is in the new encoding
+        _cobsBufferIndex = 0;
+    }
+    else if (category.compare("baud") == 0) {
+        CHECK_SEGMENT(0); _baudReplyRate = segmentAsUInt();
+        CHECK_SEGMENT(1); _baudReplyStatus = segmentAsInt();
+        _baudReplyReceived = true;
+    }
+    else if (category.compare("prb") == 0) {
+        CHECK_SEGMENT(0); uint32_t index = segmentAsUInt();
+        CHECK_SEGMENT(1); segmentAsUInt();  // number of probe packets
+        CHECK_SEGMENT(2); uint32_t pattern = segmentAsUInt();
+        CHECK_SEGMENT(3); uint32_t inverse = segmentAsUInt();
+        CHECK_SEGMENT(4); uint32_t baud = segmentAsUInt();
+        uint32_t expected = index * 2654435761UL;
+        if (pattern == expected && inverse == ~expected && baud == _currentBaud) {
+            _probeCount++;
+        }
+        else {
+            _probeErrors++;
+        }
+    }
+    else if (category.compare("rack") == 0) {
+        CHECK_SEGMENT(0); _rackSeq = segmentAsUInt();
+        CHECK_SEGMENT(1); _rackStatus = segmentAsInt();
+        _rackReceived = true;
+    }
+    else if (category.compare("sub") == 0) {
+        CHECK_SEGMENT(0); _subReplyStream = segmentAsString();
+        CHECK_SEGMENT(1); _subReplyRate = segmentAsInt();
+        CHECK_SEGMENT(2); _subReplyStatus = segmentAsInt();
+        CHECK_SEGMENT(3); _subReplyLoad = segmentAsUInt();
+        CHECK_SEGMENT(4); _subReplyBudget = segmentAsUInt();
+        _subReplyReceived = true;
+    }
+    else if (category.compare("txq") == 0) {
+        CHECK_SEGMENT(0); segmentAsUInt();  // time ms
+        CHECK_SEGMENT(1); uint32_t dropped_low = segmentAsUInt();
+        CHECK_SEGMENT(2); uint32_t dropped_high = segmentAsUInt();
+        CHECK_SEGMENT(3); uint32_t high_water = segmentAsUInt();
+        ROS_WARN("Device transmit queue overflowed. Dropped %u telemetry and %u priority packets. Max queue usage: %u bytes",
+            dropped_low, dropped_high, high_water
+        );
+    }
+    else if (category.compare("ctl") == 0) {
+        // control loop period jitter since the last report
+        CHECK_SEGMENT(0); segmentAsUInt();  // time ms
+        CHECK_SEGMENT(1); uint32_t rate_hz = segmentAsUInt();
+        CHECK_SEGMENT(2); uint32_t num_periods = segmentAsUInt();
+        CHECK_SEGMENT(3); int32_t min_jitter_us = segmentAsInt();
+        CHECK_SEGMENT(4); double mean_jitter_us = segmentAsFixed(1);
+        CHECK_SEGMENT(5); int32_t max_jitter_us = segmentAsInt();
+        CHECK_SEGMENT(6); uint32_t max_run_us = segmentAsUInt();
+        if (num_periods == 0 || rate_hz == 0) {
+            return;
+        }
+        int32_t period_us = 1000000 / rate_hz;
+        ROS_DEBUG("Control loop at %u Hz: %u periods, jitter min %d us, mean %0.1f us, max %d us. Longest run %u us",
+            rate_hz, num_periods, min_jitter_us, mean_jitter_us, max_jitter_us, max_run_us
+        );
+        if (max_jitter_us > period_us / 4 || -min_jitter_us > period_us / 4) {
+            ROS_WARN("Control loop period is off by up to %d us (%d us nominal)",
+                max_jitter_us > -min_jitter_us ? max_jitter_us : -min_jitter_us, period_us
+            );
+        }
+    }
+    else if (category.compare("log") == 0) {
+        parseLog();
+    }
+    else if (category.compare("msg") == 0) {
+        // firmware built with ROVER6_LOG_TEXT. Only sent as a packet in binary mode. In ASCII mode messages are raw lines
+        CHECK_SEGMENT(0); string level = segmentAsString();
+        CHECK_SEGMENT(1); string message = segmentAsString();
+        ROS_INFO_STREAM("Device message: " << level << "\t" << message);
     }
 }
 
@@ -331,10 +933,57 @@ void Rover6SerialBridge::writeSerial(string name, const char *formats, ...)
 {
     va_list args;
     va_start(args, formats);
-    string packet;
-    stringstream sstream;
-    sstream << PACKET_START_0 << PACKET_START_1 << _writePacketNum << "\t" << name;
+    string fields = formatFields(formats, args);
+    va_end(args);
+    writePacket(name, fields);
+}
 
+// Sends a configuration command wrapped as rel <seq> <name> <fields> and waits for the device's
+// rack <seq> <status>. Retransmits with the same seq on timeout. The device doesn't apply a repeated
+// seq twice. Returns true if the device applied the command
+bool Rover6SerialBridge::writeReliable(string name, const char *formats, ...)
+{
+    va_list args;
+    va_start(args, formats);
+    string fields = formatFields(formats, args);
+    va_end(args);
+
+    uint32_t seq = _reliableSeq++;
+    stringstream rel_fields;
+    rel_fields << "\t" << seq << "\t" << name << fields;
+
+    for (int attempt = 0; attempt < RELIABLE_MAX_ATTEMPTS; attempt++) {
+        if (attempt > 0) {
+            ROS_WARN_STREAM("No acknowledgement for " << name << " (seq " << seq << "). Retransmitting");
+        }
+        _rackReceived = false;
+        writePacket("rel", rel_fields.str());
+
+        ros::Time begin_time = ros::Time::now();
+        while (ros::ok() && (ros::Time::now() - begin_time).toSec() < RELIABLE_TIMEOUT_S) {
+            if (_serialRef.available() > 2) {
+                readSerial();
+            }
+            if (_rackReceived && _rackSeq == seq) {
+                switch (_rackStatus) {
+                    case 0: return true;
+                    case 1: ROS_ERROR_STREAM("Device rejected " << name << ": missing fields"); break;
+                    case 2: ROS_ERROR_STREAM("Device rejected " << name << ": unknown command"); break;
+                    case 3: ROS_ERROR_STREAM("Device rejected " << name << ": invalid values"); break;
+                    default: ROS_ERROR_STREAM("Device rejected " << name << " with status " << _rackStatus); break;
+                }
+                return false;
+            }
+        }
+    }
+    ROS_ERROR_STREAM("Device never acknowledged " << name << " (seq " << seq << ") after " << RELIABLE_MAX_ATTEMPTS << " attempts");
+    return false;
+}
+
+// One tab separated field per format character
+string Rover6SerialBridge::formatFields(const char *formats, va_list args)
+{
+    stringstream sstream;
     while (*formats != '\0') {
         sstream << "\t";
         if (*formats == 'd') {
@@ -358,7 +1007,14 @@ void Rover6SerialBridge::writeSerial(string name, const char *formats, ...)
         }
         ++formats;
     }
-    va_end(args);
+    return sstream.str();
+}
+
+void Rover6SerialBridge::writePacket(string name, string fields)
+{
+    string packet;
+    stringstream sstream;
+    sstream << PACKET_START_0 << PACKET_START_1 << _writePacketNum << "\t" << name << fields;
 
     packet = sstream.str();
 
@@ -394,9 +1050,37 @@ void Rover6SerialBridge::setup()
     // wait for startup messages from the microcontroller
     checkReady();
 
+    negotiateBaud();
+    if (_useBinaryProtocol) {
+        negotiateBinaryMode();
+    }
+
     // tell the microcontroller to start
     resetSensors();
     setActive(true);
+    setSnapshotMode(_useStateSnapshot);
+    setCompression(_useCompressedStreams);
+    setQuaternionMode(_useQuaternionImu);
+    setImuInterrupt(_useImuInterrupt);
+    if (_imuRawRateHz > 0) {
+        setImuRawRate(_imuRawRateHz);
+    }
+    if (_controlRateHz > 0) {
+        setControlRate(_controlRateHz);
+    }
+    if (!_encoderEstimator.empty()) {
+        setEncoderEstimator(_encoderEstimator);
+    }
+
+    // optional map of stream name to rate in Hz. Streams not listed keep the firmware's defaults
+    map<string, int> stream_rates;
+    if (nh.getParam("/" + _roverNamespace + "/stream_rates", stream_rates)) {
+        for (map<string, int>::iterator it = stream_rates.begin(); it != stream_rates.end(); ++it) {
+            string message;
+            subscribeStream(it->first, it->second, &message);
+            ROS_INFO_STREAM(message);
+        }
+    }
     setReporting(true);
 }
 
@@ -410,6 +1094,8 @@ void Rover6SerialBridge::loop()
         }
     }
 
+    checkLinkHealth();
+
     ROS_INFO_THROTTLE(15, "Read packet num: %llu", _readPacketNum);
 }
 
@@ -449,7 +1135,7 @@ int Rover6SerialBridge::run()
 }
 
 void Rover6SerialBridge::motorsCallback(const rover6_serial_bridge::Rover6Motors::ConstPtr& msg) {
-    // motor commands in ticks per second
+    // motor commands in ticks per second. Best effort: a lost setpoint is replaced by the next one, so it isn't sent with writeReliable
     // ROS_DEBUG("left motor: %f, right motor: %f", msg->left, msg->right);
     // if (motors_msg.left != msg->left || motors_msg.right != msg->right) {
     writeSerial("m", "ff", msg->left, msg->right);
@@ -488,18 +1174,18 @@ void Rover6SerialBridge::writeServo(unsigned int n, float command, uint8_t mode)
 bool Rover6SerialBridge::set_pid(rover6_serial_bridge::Rover6PidSrv::Request  &req,
          rover6_serial_bridge::Rover6PidSrv::Response &res)
 {
-    writeK(req.kp_A, req.ki_A, req.kd_A, req.kp_B, req.ki_B, req.kd_B, req.speed_kA, req.speed_kB);
     ROS_INFO("Setting pid: kp_A=%f, ki_A=%f, kd_A=%f, kp_B=%f, ki_B=%f, kd_B=%f, speed_kA=%f, speed_kB=%f",
         req.kp_A, req.ki_A, req.kd_A, req.kp_B, req.ki_B, req.kd_B, req.speed_kA, req.speed_kB
     );
-    res.resp = true;
+    // true only once the device has acknowledged every gain
+    res.resp = writeK(req.kp_A, req.ki_A, req.kd_A, req.kp_B, req.ki_B, req.kd_B, req.speed_kA, req.speed_kB);
     return true;
 }
 
 bool Rover6SerialBridge::set_safety_thresholds(rover6_serial_bridge::Rover6SafetySrv::Request  &req,
          rover6_serial_bridge::Rover6SafetySrv::Response &res)
 {
-    writeObstacleThresholds(
+    bool thresholds_set = writeObstacleThresholds(
         req.back_obstacle_threshold, req.back_ledge_threshold,
         req.front_obstacle_threshold, req.front_ledge_threshold
     );
@@ -513,7 +1199,7 @@ bool Rover6SerialBridge::set_safety_thresholds(rover6_serial_bridge::Rover6Safet
     ROS_INFO("Setting servos: front_servo_command=%d, back_servo_command=%d",
         req.front_servo_command, req.back_servo_command
     );
-    res.resp = true;
+    res.resp = thresholds_set;  // tilter servo commands are setpoints and stay best effort
     return true;
 }
 
@@ -526,32 +1212,148 @@ bool Rover6SerialBridge::send_menu_event(rover6_serial_bridge::Rover6MenuSrv::Re
 }
 
 
-void Rover6SerialBridge::setActive(bool state)
+bool Rover6SerialBridge::set_stream_rate(rover6_serial_bridge::Rover6StreamRateSrv::Request &req, rover6_serial_bridge::Rover6StreamRateSrv::Response &res)
+{
+    string message;
+    res.resp = subscribeStream(req.stream, req.rate_hz, &message);
+    res.rate_hz = _subReplyRate;
+    res.message = message;
+    ROS_INFO_STREAM(message);
+    return true;
+}
+
+
+bool Rover6SerialBridge::setActive(bool state)
 {
     if (state) {
-        writeSerial("<>", "d", 1);
+        return writeReliable("<>", "d", 1);
     }
     else {
-        writeSerial("<>", "d", 0);
+        return writeReliable("<>", "d", 0);
     }
 }
 
 void Rover6SerialBridge::softRestart() {
+    // the device resets before it could acknowledge, so this can't be sent reliably
     writeSerial("<>", "d", 2);
 }
 
-void Rover6SerialBridge::setReporting(bool state)
+bool Rover6SerialBridge::setReporting(bool state)
 {
     if (state) {
-        writeSerial("[]", "d", 1);
+        return writeReliable("[]", "d", 1);
     }
     else {
-        writeSerial("[]", "d", 0);
+        return writeReliable("[]", "d", 0);
     }
 }
 
-void Rover6SerialBridge::resetSensors() {
-    writeSerial("[]", "d", 2);
+bool Rover6SerialBridge::setSnapshotMode(bool state)
+{
+    if (state) {
+        return writeReliable("snap", "d", 1);
+    }
+    else {
+        return writeReliable("snap", "d", 0);
+    }
+}
+
+bool Rover6SerialBridge::setCompression(bool state)
+{
+    if (state) {
+        return writeReliable("zip", "d", 1);
+    }
+    else {
+        return writeReliable("zip", "d", 0);
+    }
+}
+
+// The device reports its fused quaternion instead of euler angles. See rover6_bno.h in the firmware
+bool Rover6SerialBridge::setQuaternionMode(bool state)
+{
+    if (state) {
+        return writeReliable("quat", "d", 1);
+    }
+    else {
+        return writeReliable("quat", "d", 0);
+    }
+}
+
+// The device samples the IMU on its data ready interrupt and stamps samples with the interrupt's time.
+// It falls back to its timer if the interrupt pin isn't wired
+bool Rover6SerialBridge::setImuInterrupt(bool state)
+{
+    if (state) {
+        return writeReliable("bint", "d", 1);
+    }
+    else {
+        return writeReliable("bint", "d", 0);
+    }
+}
+
+// Raw accel and gyro samples in batches instead of fusion output. The device clamps the rate to 400 Hz
+bool Rover6SerialBridge::setImuRawRate(int rate_hz)
+{
+    return writeReliable("braw", "d", rate_hz);
+}
+
+// Speed control loop rate on the device. It clamps the rate to 1..1000 Hz
+bool Rover6SerialBridge::setControlRate(int rate_hz)
+{
+    return writeReliable("ctl", "d", rate_hz);
+}
+
+// Encoder speed estimator on the device. See rover6_encoders.h in the firmware
+bool Rover6SerialBridge::setEncoderEstimator(string estimator)
+{
+    int index;
+    if (estimator == "window") {
+        index = 0;
+    }
+    else if (estimator == "edge") {
+        index = 1;
+    }
+    else if (estimator == "blended") {
+        index = 2;
+    }
+    else {
+        ROS_ERROR_STREAM("Unknown encoder estimator: " << estimator << ". Use window, edge or blended");
+        return false;
+    }
+    return writeReliable("est", "d", index);
+}
+
+bool Rover6SerialBridge::subscribeStream(string stream, int rate_hz, string* message)
+{
+    _subReplyReceived = false;
+    writeSerial("sub", "sd", stream.c_str(), rate_hz);
+
+    ros::Time begin_time = ros::Time::now();
+    while (!_subReplyReceived || _subReplyStream != stream)
+    {
+        if (!ros::ok() || (ros::Time::now() - begin_time).toSec() > 0.5) {
+            *message = "No reply from the device for stream " + stream;
+            return false;
+        }
+        if (_serialRef.available() > 2) {
+            readSerial();
+        }
+    }
+
+    stringstream msg_buffer;
+    switch (_subReplyStatus) {
+        case 0: msg_buffer << "Stream " << stream << " set to " << _subReplyRate << " Hz"; break;
+        case 1: msg_buffer << "Unknown stream " << stream; break;
+        case 2: msg_buffer << "Stream " << stream << " at " << rate_hz << " Hz exceeds the link budget. Staying at " << _subReplyRate << " Hz"; break;
+        default: msg_buffer << "Stream " << stream << " returned status " << _subReplyStatus; break;
+    }
+    msg_buffer << " (link load " << _subReplyLoad << " of " << _subReplyBudget << " bytes/s)";
+    *message = msg_buffer.str();
+    return _subReplyStatus == 0;
+}
+
+bool Rover6SerialBridge::resetSensors() {
+    return writeReliable("[]", "d", 2);
 }
 
 // void Rover6SerialBridge::writeCurrentState()
@@ -567,43 +1369,125 @@ void Rover6SerialBridge::writeSpeed(float speedA, float speedB) {
     writeSerial("m", "ff", speedA, speedB);
 }
 
-void Rover6SerialBridge::writeK(float kp_A, float ki_A, float kd_A, float kp_B, float ki_B, float kd_B, float speed_kA, float speed_kB) {
+bool Rover6SerialBridge::writeK(float kp_A, float ki_A, float kd_A, float kp_B, float ki_B, float kd_B, float speed_kA, float speed_kB) {
     // writeSerial("ks", "ffffffff", kp_A, ki_A, kd_A, kp_B, ki_B, kd_B, speed_kA, speed_kB);
-    writeSerial("ks", "df", 0, kp_A);
-    writeSerial("ks", "df", 1, ki_A);
-    writeSerial("ks", "df", 2, kd_A);
-    writeSerial("ks", "df", 3, kp_B);
-    writeSerial("ks", "df", 4, ki_B);
-    writeSerial("ks", "df", 5, kd_B);
-    writeSerial("ks", "df", 6, speed_kA);
-    writeSerial("ks", "df", 7, speed_kB);
+    float ks[] = {kp_A, ki_A, kd_A, kp_B, ki_B, kd_B, speed_kA, speed_kB};
+    bool success = true;
+    for (int index = 0; index < 8; index++) {
+        // keep going so one lost gain doesn't hold back the rest
+        success = writeReliable("ks", "df", index, ks[index]) && success;
+    }
+    return success;
 }
 
-void Rover6SerialBridge::writeObstacleThresholds(int back_lower, int back_upper, int front_lower, int front_upper) {
-    writeSerial("safe", "dddd", front_upper, back_upper, front_lower, back_lower);
+bool Rover6SerialBridge::writeObstacleThresholds(int back_lower, int back_upper, int front_lower, int front_upper) {
+    return writeReliable("safe", "dddd", front_upper, back_upper, front_lower, back_lower);
 }
 
-void Rover6SerialBridge::parseImu()
+void Rover6SerialBridge::parseImu(StreamFrameType frame_type, bool is_quaternion)
 {
+    // quaternion packets have one more orientation value in front of the gyro and accel values
+    size_t num_values = is_quaternion ? BNO_NUM_QUAT_VECTOR_VALUES : BNO_NUM_VECTOR_VALUES;
+    size_t offset = num_values - BNO_NUM_VECTOR_VALUES;
     double roll, pitch, yaw;
-    CHECK_SEGMENT(0); imu_msg.header.stamp = getDeviceTime((uint32_t)stol(_currentBufferSegment));
-    CHECK_SEGMENT(1); yaw = stof(_currentBufferSegment);
-    CHECK_SEGMENT(2); pitch = stof(_currentBufferSegment);
-    CHECK_SEGMENT(3); roll = stof(_currentBufferSegment);
-    CHECK_SEGMENT(4); imu_msg.angular_velocity.x = stof(_currentBufferSegment);
-    CHECK_SEGMENT(5); imu_msg.angular_velocity.y = stof(_currentBufferSegment);
-    CHECK_SEGMENT(6); imu_msg.angular_velocity.z = stof(_currentBufferSegment);
-    CHECK_SEGMENT(7); imu_msg.linear_acceleration.x = stof(_currentBufferSegment);
-    CHECK_SEGMENT(8); imu_msg.linear_acceleration.y = stof(_currentBufferSegment);
-    CHECK_SEGMENT(9); imu_msg.linear_acceleration.z = stof(_currentBufferSegment);
-    eulerToQuat(roll, pitch, yaw);
+    if (frame_type == FULL_FRAME) {
+        CHECK_SEGMENT(0); imu_msg.header.stamp = getDeviceTime(segmentAsUInt());
+        if (is_quaternion) {
+            CHECK_SEGMENT(1); imu_msg.orientation.w = segmentAsFixed(5);
+            CHECK_SEGMENT(2); imu_msg.orientation.x = segmentAsFixed(5);
+            CHECK_SEGMENT(3); imu_msg.orientation.y = segmentAsFixed(5);
+            CHECK_SEGMENT(4); imu_msg.orientation.z = segmentAsFixed(5);
+        }
+        else {
+            CHECK_SEGMENT(1); yaw = segmentAsFixed(4);
+            CHECK_SEGMENT(2); pitch = segmentAsFixed(4);
+            CHECK_SEGMENT(3); roll = segmentAsFixed(4);
+        }
+        CHECK_SEGMENT(4 + offset); imu_msg.angular_velocity.x = segmentAsFixed(4);
+        CHECK_SEGMENT(5 + offset); imu_msg.angular_velocity.y = segmentAsFixed(4);
+        CHECK_SEGMENT(6 + offset); imu_msg.angular_velocity.z = segmentAsFixed(4);
+        CHECK_SEGMENT(7 + offset); imu_msg.linear_acceleration.x = segmentAsFixed(2);
+        CHECK_SEGMENT(8 + offset); imu_msg.linear_acceleration.y = segmentAsFixed(2);
+        CHECK_SEGMENT(9 + offset); imu_msg.linear_acceleration.z = segmentAsFixed(2);
+        if (!is_quaternion) {
+            eulerToQuat(roll, pitch, yaw);
+        }
+
+        imu_pub.publish(imu_msg);
+        return;
+    }
+
+    // compressed frames hold fixed point values in the same order as the bno or bnoq packet
+    int32_t values[BNO_NUM_QUAT_VECTOR_VALUES];
+    if (frame_type == KEY_FRAME) {
+        CHECK_SEGMENT(0); int keyframe_id = (int)segmentAsUInt();
+        CHECK_SEGMENT(1); uint32_t time_ms = segmentAsUInt();
+        for (size_t index = 0; index < num_values; index++) {
+            CHECK_SEGMENT(index + 2); values[index] = segmentAsInt();
+        }
+        CHECK_SEGMENT(num_values + 2); segmentAsInt();  // temperature
+        _bnoKeyframeId = keyframe_id;
+        _bnoKeyIsQuaternion = is_quaternion;
+        _bnoKeyTimeMs = time_ms;
+        memcpy(_bnoKeyValues, values, sizeof(values));
+        imu_msg.header.stamp = getDeviceTime(time_ms);
+    }
+    else {
+        CHECK_SEGMENT(0); int keyframe_id = (int)segmentAsVarInt();
+        if (keyframe_id != _bnoKeyframeId || is_quaternion != _bnoKeyIsQuaternion) {
+            // the keyframe this delta refers to was lost. Wait for the next one
+            ROS_DEBUG("Dropping IMU delta for keyframe %d. Current keyframe is %d", keyframe_id, _bnoKeyframeId);
+            return;
+        }
+        CHECK_SEGMENT(1); imu_msg.header.stamp = getDeviceTime(_bnoKeyTimeMs + (uint32_t)segmentAsVarInt());
+        for (size_t index = 0; index < num_values; index++) {
+            CHECK_SEGMENT(index + 2); values[index] = _bnoKeyValues[index] + segmentAsVarInt();
+        }
+    }
+
+    if (is_quaternion) {
+        imu_msg.orientation.w = values[0] / BNO_QUAT_COMPRESSED_SCALES[0];
+        imu_msg.orientation.x = values[1] / BNO_QUAT_COMPRESSED_SCALES[1];
+        imu_msg.orientation.y = values[2] / BNO_QUAT_COMPRESSED_SCALES[2];
+        imu_msg.orientation.z = values[3] / BNO_QUAT_COMPRESSED_SCALES[3];
+    }
+    else {
+        yaw = values[0] / BNO_COMPRESSED_SCALES[0];
+        pitch = values[1] / BNO_COMPRESSED_SCALES[1];
+        roll = values[2] / BNO_COMPRESSED_SCALES[2];
+        eulerToQuat(roll, pitch, yaw);
+    }
+    imu_msg.angular_velocity.x = values[3 + offset] / BNO_COMPRESSED_SCALES[3];
+    imu_msg.angular_velocity.y = values[4 + offset] / BNO_COMPRESSED_SCALES[4];
+    imu_msg.angular_velocity.z = values[5 + offset] / BNO_COMPRESSED_SCALES[5];
+    imu_msg.linear_acceleration.x = values[6 + offset] / BNO_COMPRESSED_SCALES[6];
+    imu_msg.linear_acceleration.y = values[7 + offset] / BNO_COMPRESSED_SCALES[7];
+    imu_msg.linear_acceleration.z = values[8 + offset] / BNO_COMPRESSED_SCALES[8];
 
     imu_pub.publish(imu_msg);
 }
 
+void Rover6SerialBridge::parseImuRaw()
+{
+    // each sample has its time from the previous one in us, then gyro and accel in the BNO055's LSBs
+    CHECK_SEGMENT(0); ros::Time stamp = getDeviceTime(segmentAsUInt());
+    for (size_t index = 0; index < BNO_RAW_BATCH_LEN; index++) {
+        size_t segment = 1 + index * 7;
+        CHECK_SEGMENT(segment); stamp += ros::Duration(segmentAsVarInt() * 1E-6);
+        CHECK_SEGMENT(segment + 1); imu_raw_msg.angular_velocity.x = segmentAsVarInt() / BNO_RAW_GYRO_SCALE;
+        CHECK_SEGMENT(segment + 2); imu_raw_msg.angular_velocity.y = segmentAsVarInt() / BNO_RAW_GYRO_SCALE;
+        CHECK_SEGMENT(segment + 3); imu_raw_msg.angular_velocity.z = segmentAsVarInt() / BNO_RAW_GYRO_SCALE;
+        CHECK_SEGMENT(segment + 4); imu_raw_msg.linear_acceleration.x = segmentAsVarInt() / BNO_RAW_ACCEL_SCALE;
+        CHECK_SEGMENT(segment + 5); imu_raw_msg.linear_acceleration.y = segmentAsVarInt() / BNO_RAW_ACCEL_SCALE;
+        CHECK_SEGMENT(segment + 6); imu_raw_msg.linear_acceleration.z = segmentAsVarInt() / BNO_RAW_ACCEL_SCALE;
+        imu_raw_msg.header.stamp = stamp;
+        imu_raw_pub.publish(imu_raw_msg);
+    }
+}
+
 void Rover6SerialBridge::logPacketErrorCode(int error_code, unsigned long long packet_num)
 {
-    ROS_WARN("Packet %d returned an error!");
+    ROS_WARN("Packet %llu returned an error!", packet_num);
     switch (error_code) {
         case 1: ROS_WARN("c1 != \\x12", packet_num); break;
         case 2: ROS_WARN("c2 != \\x34", packet_num); break;
@@ -613,6 +1497,7 @@ void Rover6SerialBridge::logPacketErrorCode(int error_code, unsigned long long p
         case 6: ROS_WARN("packet counts not synchronized", packet_num); break;
         case 7: ROS_WARN("failed to find category segment", packet_num); break;
         case 8: ROS_WARN("invalid format", packet_num); break;
+        case 9: ROS_WARN("packet exceeds receive buffer", packet_num); break;
     }
 }
 
@@ -632,51 +1517,81 @@ void Rover6SerialBridge::eulerToQuat(double roll, double pitch, double yaw)
 }
 
 
-void Rover6SerialBridge::parseEncoder()
+void Rover6SerialBridge::parseEncoder(StreamFrameType frame_type)
 {
-    CHECK_SEGMENT(0); enc_msg.header.stamp = getDeviceTime((uint32_t)stol(_currentBufferSegment));
-    CHECK_SEGMENT(1); enc_msg.left_ticks = stol(_currentBufferSegment);
-    CHECK_SEGMENT(2); enc_msg.right_ticks = stol(_currentBufferSegment);
-    CHECK_SEGMENT(3); enc_msg.left_speed_ticks_per_s = stol(_currentBufferSegment);
-    CHECK_SEGMENT(4); enc_msg.right_speed_ticks_per_s = stol(_currentBufferSegment);
+    if (frame_type == FULL_FRAME) {
+        CHECK_SEGMENT(0); enc_msg.header.stamp = getDeviceTime(segmentAsUInt());
+        CHECK_SEGMENT(1); enc_msg.left_ticks = segmentAsInt();
+        CHECK_SEGMENT(2); enc_msg.right_ticks = segmentAsInt();
+        CHECK_SEGMENT(3); enc_msg.left_speed_ticks_per_s = (int64_t)llround(segmentAsFixed(1));
+        CHECK_SEGMENT(4); enc_msg.right_speed_ticks_per_s = (int64_t)llround(segmentAsFixed(1));
+    }
+    else if (frame_type == KEY_FRAME) {
+        CHECK_SEGMENT(0); int keyframe_id = (int)segmentAsUInt();
+        CHECK_SEGMENT(1); uint32_t time_ms = segmentAsUInt();
+        CHECK_SEGMENT(2); int64_t left_ticks = segmentAsInt();
+        CHECK_SEGMENT(3); int64_t right_ticks = segmentAsInt();
+        CHECK_SEGMENT(4); enc_msg.left_speed_ticks_per_s = (int64_t)llround(segmentAsFixed(1));
+        CHECK_SEGMENT(5); enc_msg.right_speed_ticks_per_s = (int64_t)llround(segmentAsFixed(1));
+        _encKeyframeId = keyframe_id;
+        _encKeyTimeMs = time_ms;
+        _encKeyLeft = left_ticks;
+        _encKeyRight = right_ticks;
+        enc_msg.header.stamp = getDeviceTime(time_ms);
+        enc_msg.left_ticks = left_ticks;
+        enc_msg.right_ticks = right_ticks;
+    }
+    else {
+        CHECK_SEGMENT(0); int keyframe_id = (int)segmentAsVarInt();
+        if (keyframe_id != _encKeyframeId) {
+            // the keyframe this delta refers to was lost. Wait for the next one
+            ROS_DEBUG("Dropping encoder delta for keyframe %d. Current keyframe is %d", keyframe_id, _encKeyframeId);
+            return;
+        }
+        CHECK_SEGMENT(1); enc_msg.header.stamp = getDeviceTime(_encKeyTimeMs + (uint32_t)segmentAsVarInt());
+        CHECK_SEGMENT(2); enc_msg.left_ticks = _encKeyLeft + segmentAsVarInt();
+        CHECK_SEGMENT(3); enc_msg.right_ticks = _encKeyRight + segmentAsVarInt();
+        CHECK_SEGMENT(4); enc_msg.left_speed_ticks_per_s = segmentAsVarInt();
+        CHECK_SEGMENT(5); enc_msg.right_speed_ticks_per_s = segmentAsVarInt();
+    }
 
     enc_pub.publish(enc_msg);
 }
 
 void Rover6SerialBridge::parseFSR()
 {
-  CHECK_SEGMENT(0); fsr_msg.header.stamp = getDeviceTime((uint32_t)stol(_currentBufferSegment));
-  CHECK_SEGMENT(1); fsr_msg.left = (uint16_t)stoi(_currentBufferSegment);
-  CHECK_SEGMENT(2); fsr_msg.right = (uint16_t)stoi(_currentBufferSegment);
+  CHECK_SEGMENT(0); fsr_msg.header.stamp = getDeviceTime(segmentAsUInt());
+  CHECK_SEGMENT(1); fsr_msg.left = (uint16_t)segmentAsInt();
+  CHECK_SEGMENT(2); fsr_msg.right = (uint16_t)segmentAsInt();
 
   fsr_pub.publish(fsr_msg);
 }
 
 void Rover6SerialBridge::parseSafety()
 {
-    CHECK_SEGMENT(0); safety_msg.header.stamp = getDeviceTime((uint32_t)stol(_currentBufferSegment));
-    CHECK_SEGMENT(1); safety_msg.is_left_bumper_trig = (bool)stoi(_currentBufferSegment);
-    CHECK_SEGMENT(2); safety_msg.is_right_bumper_trig = (bool)stoi(_currentBufferSegment);
-    CHECK_SEGMENT(3); safety_msg.is_front_tof_trig = (bool)stoi(_currentBufferSegment);
-    CHECK_SEGMENT(4); safety_msg.is_back_tof_trig = (bool)stoi(_currentBufferSegment);
-    CHECK_SEGMENT(5); safety_msg.is_front_tof_ok = (bool)stoi(_currentBufferSegment);
-    CHECK_SEGMENT(6); safety_msg.is_back_tof_ok = (bool)stoi(_currentBufferSegment);
-    CHECK_SEGMENT(7); safety_msg.are_servos_active = (bool)stoi(_currentBufferSegment);
-    CHECK_SEGMENT(8); safety_msg.are_motors_active = (bool)stoi(_currentBufferSegment);
-    CHECK_SEGMENT(9); safety_msg.voltage_ok = (bool)stoi(_currentBufferSegment);
-    CHECK_SEGMENT(10); safety_msg.is_active = (bool)stoi(_currentBufferSegment);
-    CHECK_SEGMENT(11); safety_msg.is_reporting_enabled = (bool)stoi(_currentBufferSegment);
-    CHECK_SEGMENT(12); safety_msg.is_speed_pid_enabled = (bool)stoi(_currentBufferSegment);
+    CHECK_SEGMENT(0); safety_msg.header.stamp = getDeviceTime(segmentAsUInt());
+    CHECK_SEGMENT(1); safety_msg.is_left_bumper_trig = (bool)segmentAsInt();
+    CHECK_SEGMENT(2); safety_msg.is_right_bumper_trig = (bool)segmentAsInt();
+    CHECK_SEGMENT(3); safety_msg.is_front_tof_trig = (bool)segmentAsInt();
+    CHECK_SEGMENT(4); safety_msg.is_back_tof_trig = (bool)segmentAsInt();
+    CHECK_SEGMENT(5); safety_msg.is_front_tof_ok = (bool)segmentAsInt();
+    CHECK_SEGMENT(6); safety_msg.is_back_tof_ok = (bool)segmentAsInt();
+    CHECK_SEGMENT(7); safety_msg.are_servos_active = (bool)segmentAsInt();
+    CHECK_SEGMENT(8); safety_msg.are_motors_active = (bool)segmentAsInt();
+    CHECK_SEGMENT(9); safety_msg.voltage_ok = (bool)segmentAsInt();
+    CHECK_SEGMENT(10); safety_msg.is_active = (bool)segmentAsInt();
+    CHECK_SEGMENT(11); safety_msg.is_reporting_enabled = (bool)segmentAsInt();
+    CHECK_SEGMENT(12); safety_msg.is_speed_pid_enabled = (bool)segmentAsInt();
 
     safety_pub.publish(safety_msg);
 }
 
 void Rover6SerialBridge::parseINA()
 {
-    CHECK_SEGMENT(0); ina_msg.header.stamp = getDeviceTime((uint32_t)stol(_currentBufferSegment));
-    CHECK_SEGMENT(1); ina_msg.current = stof(_currentBufferSegment);
-    CHECK_SEGMENT(2); // ina_msg doesn't have a slot for power
-    CHECK_SEGMENT(3); ina_msg.voltage = stof(_currentBufferSegment);
+    CHECK_SEGMENT(0); ina_msg.header.stamp = getDeviceTime(segmentAsUInt());
+    CHECK_SEGMENT(1); ina_msg.current = segmentAsFixed(1);
+    CHECK_SEGMENT(2); segmentAsFixed(0);  // ina_msg doesn't have a slot for power
+    CHECK_SEGMENT(3); ina_msg.voltage = segmentAsFixed(3);
 
     ina_pub.publish(ina_msg);
 }
@@ -690,21 +1605,222 @@ void Rover6SerialBridge::parseIR()
 
 void Rover6SerialBridge::parseServo()
 {
-    CHECK_SEGMENT(0); // time ms
-    CHECK_SEGMENT(1); servo_msg.num = stoi(_currentBufferSegment);
-    CHECK_SEGMENT(2); servo_msg.value = stoi(_currentBufferSegment);
+    CHECK_SEGMENT(0); segmentAsUInt();  // time ms
+    CHECK_SEGMENT(1); servo_msg.num = segmentAsInt();
+    CHECK_SEGMENT(2); servo_msg.value = segmentAsInt();
     servo_pub.publish(servo_msg);
 }
 
 void Rover6SerialBridge::parseTOF()
 {
-    CHECK_SEGMENT(0); tof_msg.header.stamp = getDeviceTime((uint32_t)stol(_currentBufferSegment));
-    CHECK_SEGMENT(1); tof_msg.front_mm = stoi(_currentBufferSegment);
-    CHECK_SEGMENT(2); tof_msg.back_mm = stoi(_currentBufferSegment);
-    CHECK_SEGMENT(3); tof_msg.front_measure_status = stoi(_currentBufferSegment);
-    CHECK_SEGMENT(4); tof_msg.back_measure_status = stoi(_currentBufferSegment);
-    CHECK_SEGMENT(5); tof_msg.front_status = stoi(_currentBufferSegment);
-    CHECK_SEGMENT(6); tof_msg.back_status = stoi(_currentBufferSegment);
+    CHECK_SEGMENT(0); tof_msg.header.stamp = getDeviceTime(segmentAsUInt());
+    CHECK_SEGMENT(1); tof_msg.front_mm = segmentAsInt();
+    CHECK_SEGMENT(2); tof_msg.back_mm = segmentAsInt();
+    CHECK_SEGMENT(3); tof_msg.front_measure_status = segmentAsInt();
+    CHECK_SEGMENT(4); tof_msg.back_measure_status = segmentAsInt();
+    CHECK_SEGMENT(5); tof_msg.front_status = segmentAsInt();
+    CHECK_SEGMENT(6); tof_msg.back_status = segmentAsInt();
 
     tof_pub.publish(tof_msg);
 }
+
+void Rover6SerialBridge::parseState(bool is_quaternion)
+{
+    // one packet holds the latest encoder, IMU, TOF, and safety values.
+    // Only the sections marked fresh are published. stateq has a quaternion in place of the euler angles
+    size_t offset = is_quaternion ? 1 : 0;
+    double roll, pitch, yaw;
+    CHECK_SEGMENT(0); ros::Time stamp = getDeviceTime(segmentAsUInt());
+    CHECK_SEGMENT(1); uint32_t fresh_mask = segmentAsUInt();
+
+    CHECK_SEGMENT(2); enc_msg.left_ticks = segmentAsInt();
+    CHECK_SEGMENT(3); enc_msg.right_ticks = segmentAsInt();
+    CHECK_SEGMENT(4); enc_msg.left_speed_ticks_per_s = (int64_t)llround(segmentAsFixed(1));
+    CHECK_SEGMENT(5); enc_msg.right_speed_ticks_per_s = (int64_t)llround(segmentAsFixed(1));
+
+    if (is_quaternion) {
+        CHECK_SEGMENT(6); imu_msg.orientation.w = segmentAsFixed(5);
+        CHECK_SEGMENT(7); imu_msg.orientation.x = segmentAsFixed(5);
+        CHECK_SEGMENT(8); imu_msg.orientation.y = segmentAsFixed(5);
+        CHECK_SEGMENT(9); imu_msg.orientation.z = segmentAsFixed(5);
+    }
+    else {
+        CHECK_SEGMENT(6); yaw = segmentAsFixed(4);
+        CHECK_SEGMENT(7); pitch = segmentAsFixed(4);
+        CHECK_SEGMENT(8); roll = segmentAsFixed(4);
+    }
+    CHECK_SEGMENT(9 + offset); imu_msg.angular_velocity.x = segmentAsFixed(4);
+    CHECK_SEGMENT(10 + offset); imu_msg.angular_velocity.y = segmentAsFixed(4);
+    CHECK_SEGMENT(11 + offset); imu_msg.angular_velocity.z = segmentAsFixed(4);
+    CHECK_SEGMENT(12 + offset); imu_msg.linear_acceleration.x = segmentAsFixed(2);
+    CHECK_SEGMENT(13 + offset); imu_msg.linear_acceleration.y = segmentAsFixed(2);
+    CHECK_SEGMENT(14 + offset); imu_msg.linear_acceleration.z = segmentAsFixed(2);
+    CHECK_SEGMENT(15 + offset); segmentAsInt();  // temperature
+
+    CHECK_SEGMENT(16 + offset); tof_msg.front_mm = segmentAsInt();
+    CHECK_SEGMENT(17 + offset); tof_msg.back_mm = segmentAsInt();
+    CHECK_SEGMENT(18 + offset); tof_msg.front_measure_status = segmentAsInt();
+    CHECK_SEGMENT(19 + offset); tof_msg.back_measure_status = segmentAsInt();
+    CHECK_SEGMENT(20 + offset); tof_msg.front_status = segmentAsInt();
+    CHECK_SEGMENT(21 + offset); tof_msg.back_status = segmentAsInt();
+
+    CHECK_SEGMENT(22 + offset); uint32_t safety_bits = segmentAsUInt();
+
+    if (fresh_mask & SNAPSHOT_FRESH_ENC) {
+        enc_msg.header.stamp = stamp;
+        enc_pub.publish(enc_msg);
+    }
+    if (fresh_mask & SNAPSHOT_FRESH_BNO) {
+        imu_msg.header.stamp = stamp;
+        if (!is_quaternion) {
+            eulerToQuat(roll, pitch, yaw);
+        }
+        imu_pub.publish(imu_msg);
+    }
+    if (fresh_mask & SNAPSHOT_FRESH_LOX) {
+        tof_msg.header.stamp = stamp;
+        tof_pub.publish(tof_msg);
+    }
+    if (fresh_mask & SNAPSHOT_FRESH_SAFETY) {
+        // same bit order as the fields in the safe packet
+        safety_msg.header.stamp = stamp;
+        safety_msg.is_left_bumper_trig = (safety_bits >> 0) & 1;
+        safety_msg.is_right_bumper_trig = (safety_bits >> 1) & 1;
+        safety_msg.is_front_tof_trig = (safety_bits >> 2) & 1;
+        safety_msg.is_back_tof_trig = (safety_bits >> 3) & 1;
+        safety_msg.is_front_tof_ok = (safety_bits >> 4) & 1;
+        safety_msg.is_back_tof_ok = (safety_bits >> 5) & 1;
+        safety_msg.are_servos_active = (safety_bits >> 6) & 1;
+        safety_msg.are_motors_active = (safety_bits >> 7) & 1;
+        safety_msg.voltage_ok = (safety_bits >> 8) & 1;
+        safety_msg.is_active = (safety_bits >> 9) & 1;
+        safety_msg.is_reporting_enabled = (safety_bits >> 10) & 1;
+        safety_msg.is_speed_pid_enabled = (safety_bits >> 11) & 1;
+        safety_pub.publish(safety_msg);
+    }
+}
+
+void Rover6SerialBridge::parseLog()
+{
+    int level;
+    if (_binaryMode) {
+        CHECK_SEGMENT(0); level = *consumeBinary(1);
+    }
+    else {
+        CHECK_SEGMENT(0); level = segmentAsInt();
+    }
+    CHECK_SEGMENT(1); uint32_t id = segmentAsUInt();
+
+    // arguments are the rest of the packet in binary mode, one hex field in ASCII mode
+    vector<uint8_t> args;
+    if (_binaryMode) {
+        args.assign(_binaryPacket + _binaryPacketIndex, _binaryPacket + _binaryPacketLen);
+        _binaryPacketIndex = _binaryPacketLen;
+    }
+    else if (getNextSegment()) {
+        for (size_t index = 0; index + 1 < _currentBufferSegment.length(); index += 2) {
+            args.push_back((uint8_t)stoul(_currentBufferSegment.substr(index, 2), nullptr, 16));
+        }
+    }
+
+    map<uint32_t, string>::iterator entry = _logTable.find(id);
+    if (entry == _logTable.end()) {
+        ROS_WARN("Device sent unknown log ID 0x%08x. Regenerate rover6_log_table.h with firmware/scripts/generate_log_table.py", id);
+        return;
+    }
+
+    string message;
+    try {
+        message = formatLog(entry->second, args);
+    }
+    catch (exception& e) {
+        message = entry->second + " (" + e.what() + ")";
+    }
+
+    if (level == LOG_LEVEL_ERROR) {
+        ROS_ERROR_STREAM("Device message: " << message);
+    }
+    else {
+        ROS_INFO_STREAM("Device message: " << message);
+    }
+}
+
+// Expands a printf style format string with arguments encoded by the firmware's rover6_log::LogArgs:
+// integers are zigzag varints, floats are float32, strings are a length byte followed by the characters
+string Rover6SerialBridge::formatLog(const string& format, const vector<uint8_t>& args)
+{
+    string message;
+    char buffer[0x100];
+    size_t arg_index = 0;
+    size_t index = 0;
+    while (index < format.length()) {
+        char c = format.at(index++);
+        if (c != '%') {
+            message += c;
+            continue;
+        }
+
+        // keep flags, width, and precision. Length modifiers are replaced to match the decoded types
+        string spec = "%";
+        while (index < format.length() && strchr("-+ #0123456789.", format.at(index)) != NULL) {
+            spec += format.at(index++);
+        }
+        while (index < format.length() && strchr("hlLqjzt", format.at(index)) != NULL) {
+            index++;
+        }
+        if (index >= format.length()) {
+            break;
+        }
+        char conversion = format.at(index++);
+
+        if (conversion == '%') {
+            message += '%';
+            continue;
+        }
+        else if (strchr("diuxXoc", conversion) != NULL) {
+            uint64_t value = 0;
+            for (int shift = 0; ; shift += 7) {
+                if (shift >= 70) {
+                    throw out_of_range("Log varint is longer than 10 bytes");
+                }
+                uint8_t b = *consumeLogArg(args, &arg_index, 1);
+                value |= (uint64_t)(b & 0x7f) << shift;
+                if ((b & 0x80) == 0) {
+                    break;
+                }
+            }
+            long long decoded = (long long)((value >> 1) ^ -(value & 1));
+            if (conversion == 'c') {
+                snprintf(buffer, sizeof(buffer), (spec + conversion).c_str(), (int)decoded);
+            }
+            else {
+                snprintf(buffer, sizeof(buffer), (spec + "ll" + conversion).c_str(), decoded);
+            }
+        }
+        else if (strchr("fFeEgGaA", conversion) != NULL) {
+            float value;
+            memcpy(&value, consumeLogArg(args, &arg_index, 4), 4);
+            snprintf(buffer, sizeof(buffer), (spec + conversion).c_str(), (double)value);
+        }
+        else if (conversion == 's') {
+            size_t length = *consumeLogArg(args, &arg_index, 1);
+            string value((const char*)consumeLogArg(args, &arg_index, length), length);
+            snprintf(buffer, sizeof(buffer), (spec + conversion).c_str(), value.c_str());
+        }
+        else {
+            throw invalid_argument(string("Unsupported log conversion %") + conversion);
+        }
+        message += buffer;
+    }
+    return message;
+}
+
+const uint8_t* Rover6SerialBridge::consumeLogArg(const vector<uint8_t>& args, size_t* index, size_t length)
+{
+    if (*index + length > args.size()) {
+        throw out_of_range("truncated log arguments");
+    }
+    const uint8_t* data = args.data() + *index;
+    *index += length;
+    return data;
+}